@@ -9,6 +9,8 @@
 
 #include "retro-controller.h"
 
+#include "retro-input-private.h"
+
 G_DEFINE_INTERFACE (RetroController, retro_controller, G_TYPE_OBJECT);
 
 enum {
@@ -38,6 +40,10 @@ retro_controller_default_init (RetroControllerInterface *iface)
  *
  * Gets the state of an input of @self.
  *
+ * Relative inputs, namely the X and Y axes of a mouse, report the motion since
+ * they were last read: reading them must reset them to 0, otherwise their
+ * motion would be applied again each time the controller's state is synced.
+ *
  * Returns: the input's state
  */
 gint16
@@ -55,6 +61,56 @@ retro_controller_get_input_state (RetroController *self,
   return iface->get_input_state (self, input);
 }
 
+/**
+ * retro_controller_get_input_states:
+ * @self: a #RetroController
+ * @controller_type: a #RetroControllerType
+ * @states: (array length=n_states) (out caller-allocates): the return location
+ *   for the states
+ * @n_states: the length of @states
+ *
+ * Gets the states of all the inputs of @self for the given controller type, in
+ * one go. The state of the input with the given id and index is stored at
+ * `index * retro_controller_type_get_id_count (controller_type) + id`, and
+ * inputs that don't fit in @states are ignored.
+ *
+ * Controllers can implement this to avoid being queried input by input, which
+ * is much slower for types with many inputs like keyboards.
+ */
+void
+retro_controller_get_input_states (RetroController     *self,
+                                   RetroControllerType  controller_type,
+                                   gint16              *states,
+                                   gsize                n_states)
+{
+  RetroControllerInterface *iface;
+  RetroInput input;
+  gint max_id, max_index;
+  gsize next;
+
+  g_return_if_fail (RETRO_IS_CONTROLLER (self));
+  g_return_if_fail (states != NULL || n_states == 0);
+
+  iface = RETRO_CONTROLLER_GET_IFACE (self);
+
+  if (iface->get_input_states != NULL) {
+    iface->get_input_states (self, controller_type, states, n_states);
+
+    return;
+  }
+
+  max_id = retro_controller_type_get_id_count (controller_type);
+  max_index = retro_controller_type_get_index_count (controller_type);
+  next = 0;
+
+  for (gint index = 0; index < max_index; index++) {
+    for (gint id = 0; id < max_id && next < n_states; id++) {
+      retro_input_init (&input, controller_type, id, index);
+      states[next++] = retro_controller_get_input_state (self, &input);
+    }
+  }
+}
+
 /**
  * retro_controller_get_controller_type:
  * @self: a #RetroController
@@ -19,11 +19,15 @@ G_DECLARE_INTERFACE (RetroController, retro_controller, RETRO, CONTROLLER, GObje
 /**
  * RetroControllerInterface:
  * @parent_iface: The parent interface.
- * @get_input_state: Gets the state from on of the controller's inputs.
+ * @get_input_state: Gets the state from on of the controller's inputs. The
+ *   relative ones must be reset when read, see
+ *   retro_controller_get_input_state().
  * @get_controller_type: Gets the type of the controller.
  * @get_capabilities: Gets the capabilities of the controller.
  * @get_supports_rumble: Gets whether the controller supports rumble.
  * @set_rumble_state: Sets the rumble state of the controller.
+ * @get_input_states: Gets the states of all the inputs of a controller type at
+ *   once, optional.
  *
  * An interface for a controller, e.g. a gamepad.
  **/
@@ -39,10 +43,18 @@ struct _RetroControllerInterface
   void (*set_rumble_state) (RetroController   *self,
                             RetroRumbleEffect  effect,
                             guint16            strength);
+  void (*get_input_states) (RetroController     *self,
+                            RetroControllerType  controller_type,
+                            gint16              *states,
+                            gsize                n_states);
 };
 
 gint16 retro_controller_get_input_state (RetroController *self,
                                          RetroInput      *input);
+void retro_controller_get_input_states (RetroController     *self,
+                                        RetroControllerType  controller_type,
+                                        gint16              *states,
+                                        gsize                n_states);
 RetroControllerType retro_controller_get_controller_type (RetroController *self);
 guint64 retro_controller_get_capabilities (RetroController *self);
 gboolean retro_controller_has_capability (RetroController     *self,
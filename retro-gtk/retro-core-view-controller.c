@@ -2,6 +2,7 @@
 
 #include "retro-core-view-controller-private.h"
 
+#include <string.h>
 #include "retro-controller.h"
 
 struct _RetroCoreViewController
@@ -39,6 +40,25 @@ retro_core_view_controller_get_input_state (RetroController *base,
   return result;
 }
 
+static void
+retro_core_view_controller_get_input_states (RetroController     *base,
+                                             RetroControllerType  controller_type,
+                                             gint16              *states,
+                                             gsize                n_states)
+{
+  RetroCoreViewController *self = RETRO_CORE_VIEW_CONTROLLER (base);
+  g_autoptr (RetroCoreView) view = NULL;
+
+  view = g_weak_ref_get (&self->view);
+  if (controller_type != self->controller_type || view == NULL) {
+    memset (states, 0, n_states * sizeof (gint16));
+
+    return;
+  }
+
+  retro_core_view_get_input_states (view, controller_type, states, n_states);
+}
+
 static RetroControllerType
 retro_core_view_controller_get_controller_type (RetroController *base)
 {
@@ -106,6 +126,7 @@ retro_controller_interface_init (RetroControllerInterface *iface)
   iface->get_capabilities = retro_core_view_controller_get_capabilities;
   iface->get_supports_rumble = retro_core_view_controller_get_supports_rumble;
   iface->set_rumble_state = retro_core_view_controller_set_rumble_state;
+  iface->get_input_states = retro_core_view_controller_get_input_states;
 }
 
 /* Public */
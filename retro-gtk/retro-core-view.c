@@ -9,6 +9,7 @@
 
 #include "retro-core-view.h"
 
+#include <string.h>
 #include "retro-gl-display-private.h"
 #include "retro-controller-codes-private.h"
 #include "retro-core-view-controller-private.h"
@@ -16,6 +17,11 @@
 #include "retro-keyboard-private.h"
 
 #define RETRO_CONTROLLER_TYPE_COUNT (RETRO_CONTROLLER_TYPE_POINTER + 1)
+#define DEFAULT_FRAMES_PER_SECOND 60.0
+/* Hardware keycodes are evdev codes offset by 8, which all fit in there. */
+#define N_HARDWARE_KEYCODES 1024
+#define N_MOUSE_BUTTONS 64
+#define BITSET_SIZE(n_bits) (((n_bits) + 63) / 64)
 
 struct _RetroCoreView
 {
@@ -24,10 +30,13 @@ struct _RetroCoreView
   RetroGLDisplay *display;
   gboolean can_grab_pointer;
   gboolean snap_pointer_to_borders;
-  GHashTable *key_state;
-  GHashTable *keyval_state;
+  guint64 key_state[BITSET_SIZE (N_HARDWARE_KEYCODES)];
+  guint64 keyboard_key_state[BITSET_SIZE (RETRO_KEYBOARD_KEY_LAST)];
+  /* The libretro key each hardware key was pressed as, the keyval of its
+   * release may differ if modifiers changed meanwhile. */
+  RetroKeyboardKey pressed_keyboard_keys[N_HARDWARE_KEYCODES];
   RetroKeyJoypadMapping *key_joypad_mapping;
-  GHashTable *mouse_button_state;
+  guint64 mouse_button_state[BITSET_SIZE (N_MOUSE_BUTTONS)];
   GdkScreen *grabbed_screen;
   GdkDevice *grabbed_device;
   gdouble mouse_x_delta;
@@ -39,6 +48,8 @@ struct _RetroCoreView
   gboolean pointer_is_on_display;
   gdouble pointer_x;
   gdouble pointer_y;
+  gint64 last_state_changed_time;
+  guint state_changed_source_id;
 };
 
 G_DEFINE_TYPE (RetroCoreView, retro_core_view, GTK_TYPE_EVENT_BOX)
@@ -61,39 +72,43 @@ static guint signals [N_SIGNALS];
 /* Private */
 
 static void
-set_input_pressed (GHashTable *table,
-                   guint       input)
+set_input_pressed (guint64 *bitset,
+                   gsize    n_inputs,
+                   guint    input)
 {
-  static gboolean value = TRUE;
+  if (input >= n_inputs)
+    return;
 
-  if (g_hash_table_contains (table, &input))
-    g_hash_table_replace (table,
-                          g_memdup (&input, sizeof (guint)),
-                          g_memdup (&value, sizeof (gboolean)));
-  else
-    g_hash_table_insert (table,
-                         g_memdup (&input, sizeof (guint)),
-                         g_memdup (&value, sizeof (gboolean)));
+  bitset[input / 64] |= G_GUINT64_CONSTANT (1) << (input % 64);
 }
 
 static void
-set_input_released (GHashTable *table,
-                    guint       input)
+set_input_released (guint64 *bitset,
+                    gsize    n_inputs,
+                    guint    input)
 {
-  g_hash_table_remove (table, &input);
+  if (input >= n_inputs)
+    return;
+
+  bitset[input / 64] &= ~(G_GUINT64_CONSTANT (1) << (input % 64));
 }
 
 static void
-reset_input (GHashTable *table)
+reset_input (guint64 *bitset,
+             gsize    n_inputs)
 {
-  g_hash_table_remove_all (table);
+  memset (bitset, 0, BITSET_SIZE (n_inputs) * sizeof (guint64));
 }
 
 static gboolean
-get_input_state (GHashTable *table,
-                 guint       input)
+get_input_state (const guint64 *bitset,
+                 gsize          n_inputs,
+                 guint          input)
 {
-  return g_hash_table_contains (table, &input);
+  if (input >= n_inputs)
+    return FALSE;
+
+  return (bitset[input / 64] >> (input % 64)) & 1;
 }
 
 static gint16
@@ -108,6 +123,59 @@ axis_to_retro_axis (gdouble value)
   return (gint16) (value * G_MAXINT16);
 }
 
+static void
+emit_controller_state_changed (RetroCoreView *self)
+{
+  if (self->state_changed_source_id != 0) {
+    g_source_remove (self->state_changed_source_id);
+    self->state_changed_source_id = 0;
+  }
+
+  self->last_state_changed_time = g_get_monotonic_time ();
+
+  g_signal_emit (self, signals[SIGNAL_CONTROLLER_STATE_CHANGED], 0);
+}
+
+static gboolean
+state_changed_timeout_cb (RetroCoreView *self)
+{
+  self->state_changed_source_id = 0;
+
+  emit_controller_state_changed (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Emits ::controller-state-changed at most once per emulated frame. */
+static void
+queue_controller_state_changed (RetroCoreView *self)
+{
+  gdouble frames_per_second = 0;
+  gint64 frame_duration, elapsed;
+
+  if (self->state_changed_source_id != 0)
+    return;
+
+  if (self->core != NULL)
+    frames_per_second = retro_core_get_frames_per_second (self->core);
+
+  if (frames_per_second <= 0)
+    frames_per_second = DEFAULT_FRAMES_PER_SECOND;
+
+  frame_duration = (gint64) (G_USEC_PER_SEC / frames_per_second);
+  elapsed = g_get_monotonic_time () - self->last_state_changed_time;
+
+  if (elapsed >= frame_duration) {
+    emit_controller_state_changed (self);
+
+    return;
+  }
+
+  self->state_changed_source_id =
+    g_timeout_add ((frame_duration - elapsed + 999) / 1000,
+                   (GSourceFunc) state_changed_timeout_cb, self);
+}
+
 static void
 recenter_pointer (RetroCoreView *self)
 {
@@ -156,7 +224,7 @@ grab (RetroCoreView *self,
 
   recenter_pointer (self);
 
-  g_signal_emit (self, signals[SIGNAL_CONTROLLER_STATE_CHANGED], 0);
+  emit_controller_state_changed (self);
 }
 
 static void
@@ -174,7 +242,7 @@ ungrab (RetroCoreView *self)
   g_clear_object (&self->grabbed_device);
   g_clear_object (&self->grabbed_screen);
 
-  g_signal_emit (self, signals[SIGNAL_CONTROLLER_STATE_CHANGED], 0);
+  emit_controller_state_changed (self);
 }
 
 static gboolean get_key_state (RetroCoreView *self,
@@ -185,6 +253,7 @@ key_press_event_cb (GtkWidget     *source,
                     GdkEventKey   *event,
                     RetroCoreView *self)
 {
+  RetroKeyboardKey keyboard_key;
   gboolean changed;
 
   if (event->keyval == GDK_KEY_Escape &&
@@ -193,12 +262,18 @@ key_press_event_cb (GtkWidget     *source,
     ungrab (self);
 
   changed = !get_key_state (self, event->hardware_keycode);
+  keyboard_key = retro_keyboard_key_converter (event->keyval);
+
+  if (event->hardware_keycode < N_HARDWARE_KEYCODES)
+    self->pressed_keyboard_keys[event->hardware_keycode] = keyboard_key;
 
-  set_input_pressed (self->key_state, event->hardware_keycode);
-  set_input_pressed (self->keyval_state, event->keyval);
+  set_input_pressed (self->key_state, N_HARDWARE_KEYCODES,
+                     event->hardware_keycode);
+  set_input_pressed (self->keyboard_key_state, RETRO_KEYBOARD_KEY_LAST,
+                     keyboard_key);
 
   if (changed)
-    g_signal_emit (self, signals[SIGNAL_CONTROLLER_STATE_CHANGED], 0);
+    emit_controller_state_changed (self);
 
   return FALSE;
 }
@@ -208,10 +283,21 @@ key_release_event_cb (GtkWidget     *source,
                       GdkEventKey   *event,
                       RetroCoreView *self)
 {
-  set_input_released (self->key_state, event->hardware_keycode);
-  set_input_released (self->keyval_state, event->keyval);
+  RetroKeyboardKey keyboard_key;
 
-  g_signal_emit (self, signals[SIGNAL_CONTROLLER_STATE_CHANGED], 0);
+  /* Release the key that was pressed, e.g. releasing Shift before 1 must
+   * still release '!'. */
+  if (get_key_state (self, event->hardware_keycode))
+    keyboard_key = self->pressed_keyboard_keys[event->hardware_keycode];
+  else
+    keyboard_key = retro_keyboard_key_converter (event->keyval);
+
+  set_input_released (self->key_state, N_HARDWARE_KEYCODES,
+                      event->hardware_keycode);
+  set_input_released (self->keyboard_key_state, RETRO_KEYBOARD_KEY_LAST,
+                      keyboard_key);
+
+  emit_controller_state_changed (self);
 
   return FALSE;
 }
@@ -225,12 +311,12 @@ button_press_event_cb (GtkWidget      *source,
 
   if (retro_core_view_get_can_grab_pointer (self)) {
     if (get_is_pointer_grabbed (self))
-      set_input_pressed (self->mouse_button_state, event->button);
+      set_input_pressed (self->mouse_button_state, N_MOUSE_BUTTONS, event->button);
     else
       grab (self, event->device, event->window, (GdkEvent *) event);
   }
   else {
-    set_input_pressed (self->mouse_button_state, event->button);
+    set_input_pressed (self->mouse_button_state, N_MOUSE_BUTTONS, event->button);
     self->pointer_is_on_display =
       retro_gl_display_get_coordinates_on_display (self->display,
                                                    event->x,
@@ -239,7 +325,7 @@ button_press_event_cb (GtkWidget      *source,
                                                    &self->pointer_y);
   }
 
-  g_signal_emit (self, signals[SIGNAL_CONTROLLER_STATE_CHANGED], 0);
+  emit_controller_state_changed (self);
 
   return FALSE;
 }
@@ -249,9 +335,9 @@ button_release_event_cb (GtkWidget      *source,
                          GdkEventButton *event,
                          RetroCoreView  *self)
 {
-  set_input_released (self->mouse_button_state, event->button);
+  set_input_released (self->mouse_button_state, N_MOUSE_BUTTONS, event->button);
 
-  g_signal_emit (self, signals[SIGNAL_CONTROLLER_STATE_CHANGED], 0);
+  emit_controller_state_changed (self);
 
   return FALSE;
 }
@@ -264,10 +350,11 @@ focus_out_event_cb (GtkWidget     *source,
   if (get_is_pointer_grabbed (self))
     ungrab (self);
 
-  reset_input (self->key_state);
-  reset_input (self->mouse_button_state);
+  reset_input (self->key_state, N_HARDWARE_KEYCODES);
+  reset_input (self->keyboard_key_state, RETRO_KEYBOARD_KEY_LAST);
+  reset_input (self->mouse_button_state, N_MOUSE_BUTTONS);
 
-  g_signal_emit (self, signals[SIGNAL_CONTROLLER_STATE_CHANGED], 0);
+  emit_controller_state_changed (self);
 
   return FALSE;
 }
@@ -296,7 +383,9 @@ motion_notify_event_cb (GtkWidget      *source,
 
   }
 
-  g_signal_emit (self, signals[SIGNAL_CONTROLLER_STATE_CHANGED], 0);
+  /* Motion events can come at a much higher rate than the core polls the
+   * input, the mouse motion is accumulated meanwhile so nothing is lost. */
+  queue_controller_state_changed (self);
 
   return FALSE;
 }
@@ -305,7 +394,7 @@ static gboolean
 get_key_state (RetroCoreView *self,
                guint16        hardware_keycode)
 {
-  return get_input_state (self->key_state, hardware_keycode);
+  return get_input_state (self->key_state, N_HARDWARE_KEYCODES, hardware_keycode);
 }
 
 static gboolean
@@ -326,21 +415,14 @@ static gboolean
 get_mouse_button_state (RetroCoreView *self,
                         guint16        button)
 {
-  return get_input_state (self->mouse_button_state, button);
+  return get_input_state (self->mouse_button_state, N_MOUSE_BUTTONS, button);
 }
 
 static gboolean
 get_keyboard_key_state (RetroCoreView *self,
                         guint16        key)
 {
-  guint16 keyval;
-
-  if (key >= RETRO_KEYBOARD_KEY_LAST)
-    return FALSE;
-
-  keyval = retro_keyboard_key_to_val_converter (key);
-
-  return get_input_state (self->keyval_state, keyval);
+  return get_input_state (self->keyboard_key_state, RETRO_KEYBOARD_KEY_LAST, key);
 }
 
 static void
@@ -348,12 +430,12 @@ retro_core_view_finalize (GObject *object)
 {
   RetroCoreView *self = RETRO_CORE_VIEW (object);
 
+  if (self->state_changed_source_id != 0)
+    g_source_remove (self->state_changed_source_id);
+
   g_clear_object (&self->core);
   g_object_unref (self->display);
-  g_hash_table_unref (self->key_state);
-  g_hash_table_unref (self->keyval_state);
   g_object_unref (self->key_joypad_mapping);
-  g_hash_table_unref (self->mouse_button_state);
   g_clear_object (&self->grabbed_screen);
   g_clear_object (&self->grabbed_device);
 
@@ -487,10 +569,7 @@ retro_core_view_init (RetroCoreView *self)
                           G_BINDING_BIDIRECTIONAL |
                           G_BINDING_SYNC_CREATE);
 
-  self->key_state = g_hash_table_new_full (g_int_hash, g_int_equal, g_free, g_free);
-  self->keyval_state = g_hash_table_new_full (g_int_hash, g_int_equal, g_free, g_free);
   self->key_joypad_mapping = retro_key_joypad_mapping_new_default ();
-  self->mouse_button_state = g_hash_table_new_full (g_int_hash, g_int_equal, g_free, g_free);
 
   g_signal_connect_object (self, "key-press-event", (GCallback) key_press_event_cb, self, 0);
   g_signal_connect_object (self, "key-release-event", (GCallback) key_release_event_cb, self, 0);
@@ -745,6 +824,49 @@ retro_core_view_get_input_state (RetroCoreView *self,
   }
 }
 
+/**
+ * retro_core_view_get_input_states:
+ * @self: a #RetroCoreView
+ * @controller_type: a #RetroControllerType
+ * @states: (array length=n_states) (out caller-allocates): the return location
+ *   for the states
+ * @n_states: the length of @states
+ *
+ * Gets the states of all the inputs of @self for the given controller type.
+ * See retro_controller_get_input_states() for the layout of @states.
+ */
+void
+retro_core_view_get_input_states (RetroCoreView       *self,
+                                  RetroControllerType  controller_type,
+                                  gint16              *states,
+                                  gsize                n_states)
+{
+  RetroInput input;
+  gint max_id, max_index;
+  gsize next;
+
+  g_return_if_fail (RETRO_IS_CORE_VIEW (self));
+  g_return_if_fail (states != NULL || n_states == 0);
+
+  if (controller_type == RETRO_CONTROLLER_TYPE_KEYBOARD) {
+    for (next = 0; next < n_states && next < RETRO_KEYBOARD_KEY_LAST; next++)
+      states[next] = get_keyboard_key_state (self, next) ? G_MAXINT16 : 0;
+
+    return;
+  }
+
+  max_id = retro_controller_type_get_id_count (controller_type);
+  max_index = retro_controller_type_get_index_count (controller_type);
+  next = 0;
+
+  for (gint index = 0; index < max_index; index++) {
+    for (gint id = 0; id < max_id && next < n_states; id++) {
+      retro_input_init (&input, controller_type, id, index);
+      states[next++] = retro_core_view_get_input_state (self, &input);
+    }
+  }
+}
+
 /**
  * retro_core_view_get_controller_capabilities:
  * @self: a #RetroCoreView
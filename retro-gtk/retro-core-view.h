@@ -37,6 +37,10 @@ void retro_core_view_set_as_default_controller (RetroCoreView *self,
                                                 RetroCore     *core);
 gint16 retro_core_view_get_input_state (RetroCoreView *self,
                                         RetroInput    *input);
+void retro_core_view_get_input_states (RetroCoreView       *self,
+                                       RetroControllerType  controller_type,
+                                       gint16              *states,
+                                       gsize                n_states);
 guint64 retro_core_view_get_controller_capabilities (RetroCoreView *self);
 gboolean retro_core_view_get_can_grab_pointer (RetroCoreView *self);
 void retro_core_view_set_can_grab_pointer (RetroCoreView *self,
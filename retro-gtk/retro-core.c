@@ -10,15 +10,20 @@
 #include "retro-core.h"
 
 #include <errno.h>
+#include <glib-unix.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <gio/gunixfdlist.h>
 #include <string.h>
+#include <unistd.h>
 #include "retro-controller-codes.h"
 #include "retro-controller-iterator-private.h"
 #include "retro-controller-state-private.h"
 #include "retro-controller-type.h"
+#include "retro-audio-queue-private.h"
 #include "retro-framebuffer-private.h"
 #include "retro-input-private.h"
+#include "retro-ipc-enum-private.h"
 #include "retro-keyboard-private.h"
 #include "retro-memfd-private.h"
 #include "retro-option-iterator-private.h"
@@ -45,17 +50,17 @@ enum {
 G_DEFINE_QUARK (retro-core-error, retro_core_error)
 
 typedef struct {
+  RetroCore *core;
   RetroController *controller;
   guint port;
   gulong state_changed_id;
-  RetroControllerState *state;
 } RetroCoreControllerInfo;
 
 typedef struct {
+  RetroCore *core;
   RetroController *controller;
   RetroControllerType type;
   gulong state_changed_id;
-  RetroControllerState *state;
 } RetroCoreDefaultControllerInfo;
 
 struct _RetroCore
@@ -77,18 +82,29 @@ struct _RetroCore
   GHashTable *options;
   GHashTable *option_overrides;
 
-  RetroControllerState *default_controller_state;
+  RetroControllerState *controller_state;
   RetroCoreDefaultControllerInfo *default_controllers[RETRO_CONTROLLER_TYPE_COUNT];
   GHashTable *controllers;
+  /* Scratch space to gather a controller's input states, keyboards have the
+   * most inputs. */
+  gint16 input_states[RETRO_KEYBOARD_KEY_LAST];
 
   gdouble runahead;
   gdouble speed_rate;
+  gboolean detect_duplicate_frames;
+  RetroResamplerQuality resampler_quality;
+  gboolean dynamic_rate_control;
+  RetroAudioSinkType audio_sink;
+  gchar *audio_sink_path;
 
   GtkWidget *keyboard_widget;
   gulong key_press_event_id;
   gulong key_release_event_id;
 
   RetroFramebuffer *framebuffer;
+  RetroAudioQueue *audio_queue;
+  gint video_output_fd;
+  guint video_output_source_id;
 };
 
 G_DEFINE_TYPE (RetroCore, retro_core, G_TYPE_OBJECT)
@@ -106,6 +122,11 @@ enum {
   PROP_FRAMES_PER_SECOND,
   PROP_RUNAHEAD,
   PROP_SPEED_RATE,
+  PROP_DETECT_DUPLICATE_FRAMES,
+  PROP_RESAMPLER_QUALITY,
+  PROP_DYNAMIC_RATE_CONTROL,
+  PROP_AUDIO_SINK,
+  PROP_AUDIO_SINK_PATH,
   N_PROPS,
 };
 
@@ -113,6 +134,7 @@ static GParamSpec *properties [N_PROPS];
 
 enum {
   SIGNAL_VIDEO_OUTPUT,
+  SIGNAL_AUDIO_OUTPUT,
   SIGNAL_LOG,
   SIGNAL_SHUTDOWN,
   SIGNAL_MESSAGE,
@@ -137,7 +159,6 @@ free_controller_info (RetroCoreControllerInfo *info)
 {
   g_signal_handler_disconnect(info->controller, info->state_changed_id);
   g_object_unref (info->controller);
-  g_object_unref (info->state);
   g_free (info);
 }
 
@@ -169,7 +190,13 @@ retro_core_finalize (GObject *object)
   RetroCore *self = RETRO_CORE (object);
 
   retro_core_set_keyboard (self, NULL);
-  g_object_unref (self->framebuffer);
+  g_clear_object (&self->framebuffer);
+  g_clear_object (&self->audio_queue);
+
+  if (self->video_output_source_id)
+    g_source_remove (self->video_output_source_id);
+  if (self->video_output_fd >= 0)
+    close (self->video_output_fd);
 
   if (self->media_uris != NULL)
     g_strfreev (self->media_uris);
@@ -177,7 +204,7 @@ retro_core_finalize (GObject *object)
   for (gsize i = 0; i < RETRO_CONTROLLER_TYPE_COUNT; i++)
     if (self->default_controllers[i])
       free_default_controller_info (self->default_controllers[i]);
-  g_object_unref (self->default_controller_state);
+  g_object_unref (self->controller_state);
 
   g_hash_table_unref (self->controllers);
   g_hash_table_unref (self->options);
@@ -188,6 +215,7 @@ retro_core_finalize (GObject *object)
   g_free (self->system_directory);
   g_free (self->content_directory);
   g_free (self->save_directory);
+  g_free (self->audio_sink_path);
   g_clear_object (&self->keyboard_widget);
 
   G_OBJECT_CLASS (retro_core_parent_class)->finalize (object);
@@ -245,6 +273,26 @@ retro_core_get_property (GObject    *object,
   case PROP_SPEED_RATE:
     g_value_set_double (value, retro_core_get_speed_rate (self));
 
+    break;
+  case PROP_DETECT_DUPLICATE_FRAMES:
+    g_value_set_boolean (value, retro_core_get_detect_duplicate_frames (self));
+
+    break;
+  case PROP_RESAMPLER_QUALITY:
+    g_value_set_enum (value, retro_core_get_resampler_quality (self));
+
+    break;
+  case PROP_DYNAMIC_RATE_CONTROL:
+    g_value_set_boolean (value, retro_core_get_dynamic_rate_control (self));
+
+    break;
+  case PROP_AUDIO_SINK:
+    g_value_set_enum (value, retro_core_get_audio_sink (self));
+
+    break;
+  case PROP_AUDIO_SINK_PATH:
+    g_value_set_string (value, retro_core_get_audio_sink_path (self));
+
     break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -285,6 +333,26 @@ retro_core_set_property (GObject      *object,
   case PROP_SPEED_RATE:
     retro_core_set_speed_rate (self, g_value_get_double (value));
 
+    break;
+  case PROP_DETECT_DUPLICATE_FRAMES:
+    retro_core_set_detect_duplicate_frames (self, g_value_get_boolean (value));
+
+    break;
+  case PROP_RESAMPLER_QUALITY:
+    retro_core_set_resampler_quality (self, g_value_get_enum (value));
+
+    break;
+  case PROP_DYNAMIC_RATE_CONTROL:
+    retro_core_set_dynamic_rate_control (self, g_value_get_boolean (value));
+
+    break;
+  case PROP_AUDIO_SINK:
+    retro_core_set_audio_sink (self, g_value_get_enum (value));
+
+    break;
+  case PROP_AUDIO_SINK_PATH:
+    retro_core_set_audio_sink_path (self, g_value_get_string (value));
+
     break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -483,6 +551,98 @@ retro_core_class_init (RetroCoreClass *klass)
                          G_PARAM_STATIC_NICK |
                          G_PARAM_STATIC_BLURB);
 
+  /**
+   * RetroCore:detect-duplicate-frames:
+   *
+   * Whether to compare the content of each video frame with the previous one
+   * and to skip it if they are identical. This costs a pass over each frame in
+   * the runner process, but it avoids uploading and emitting
+   * #RetroCore::video-output for cores which submit the same frame over and
+   * over instead of duping it.
+   */
+  properties[PROP_DETECT_DUPLICATE_FRAMES] =
+    g_param_spec_boolean ("detect-duplicate-frames",
+                          "Detect duplicate frames",
+                          "Whether to skip video frames identical to the previous one",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_NAME |
+                          G_PARAM_STATIC_NICK |
+                          G_PARAM_STATIC_BLURB);
+
+  /**
+   * RetroCore:resampler-quality:
+   *
+   * The quality of the resampler used to play the audio at the speed rate of
+   * the core. Lower qualities are cheaper on the CPU. The audio isn't
+   * resampled when the speed rate is 1.
+   */
+  properties[PROP_RESAMPLER_QUALITY] =
+    g_param_spec_enum ("resampler-quality",
+                       "Resampler quality",
+                       "The quality of the audio resampler",
+                       RETRO_TYPE_RESAMPLER_QUALITY,
+                       RETRO_RESAMPLER_QUALITY_BEST,
+                       G_PARAM_READWRITE |
+                       G_PARAM_STATIC_NAME |
+                       G_PARAM_STATIC_NICK |
+                       G_PARAM_STATIC_BLURB);
+
+  /**
+   * RetroCore:dynamic-rate-control:
+   *
+   * Whether to nudge the audio resampling ratio by up to 0.5% to hold the
+   * target audio latency. This compensates for the drift between the clocks
+   * of the core and of the sound card, avoiding underruns and latency creep,
+   * but the audio then always has to be resampled.
+   */
+  properties[PROP_DYNAMIC_RATE_CONTROL] =
+    g_param_spec_boolean ("dynamic-rate-control",
+                          "Dynamic rate control",
+                          "Whether to adjust the audio resampling ratio to hold the target latency",
+                          TRUE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_NAME |
+                          G_PARAM_STATIC_NICK |
+                          G_PARAM_STATIC_BLURB);
+
+  /**
+   * RetroCore:audio-sink:
+   *
+   * Where the audio of the core goes. The null and file sinks allow to run
+   * the core headless, e.g. for benchmarks or reference tests.
+   *
+   * This must be set before booting the core to be taken into account.
+   */
+  properties[PROP_AUDIO_SINK] =
+    g_param_spec_enum ("audio-sink",
+                       "Audio sink",
+                       "Where the audio goes",
+                       RETRO_TYPE_AUDIO_SINK_TYPE,
+                       RETRO_AUDIO_SINK_TYPE_PULSEAUDIO,
+                       G_PARAM_READWRITE |
+                       G_PARAM_STATIC_NAME |
+                       G_PARAM_STATIC_NICK |
+                       G_PARAM_STATIC_BLURB);
+
+  /**
+   * RetroCore:audio-sink-path:
+   *
+   * The file the audio is written to when #RetroCore:audio-sink is
+   * %RETRO_AUDIO_SINK_TYPE_FILE.
+   *
+   * This must be set before booting the core to be taken into account.
+   */
+  properties[PROP_AUDIO_SINK_PATH] =
+    g_param_spec_string ("audio-sink-path",
+                         "Audio sink path",
+                         "The file the audio is written to",
+                         NULL,
+                         G_PARAM_READWRITE |
+                         G_PARAM_STATIC_NAME |
+                         G_PARAM_STATIC_NICK |
+                         G_PARAM_STATIC_BLURB);
+
   g_object_class_install_properties (G_OBJECT_CLASS (klass), N_PROPS, properties);
 
   /**
@@ -506,6 +666,31 @@ retro_core_class_init (RetroCoreClass *klass)
                   // copy when sending the RetroPixdata.
                   G_TYPE_POINTER);
 
+  /**
+   * RetroCore::audio-output:
+   * @self: the #RetroCore
+   * @frames: (array length=n_frames) (element-type gint16): the interleaved
+   *   stereo frames
+   * @n_frames: the number of frames in @frames
+   * @sample_rate: the sample rate of @frames
+   *
+   * The ::audio-output signal is emitted for each chunk of audio produced by
+   * the core, straight from the memory shared with its process. This allows to
+   * mix the audio of several cores in the application.
+   *
+   * @frames will be invalid after the signal emission, copy it if you want to
+   * keep it.
+   */
+  signals[SIGNAL_AUDIO_OUTPUT] =
+    g_signal_new ("audio-output", RETRO_TYPE_CORE, G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  3,
+                  G_TYPE_POINTER,
+                  G_TYPE_UINT,
+                  G_TYPE_DOUBLE);
+
   /**
    * RetroCore::log:
    * @self: the #RetroCore
@@ -587,10 +772,13 @@ retro_core_init (RetroCore *self)
   self->controllers = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
                                              (GDestroyNotify) free_controller_info);
 
-  fd = retro_memfd_create ("[retro-runner default controller]");
-  self->default_controller_state = retro_controller_state_new (fd);
+  self->video_output_fd = -1;
+
+  fd = retro_memfd_create ("[retro-runner controllers]");
+  self->controller_state = retro_controller_state_new (fd);
 
   self->speed_rate = 1;
+  self->dynamic_rate_control = TRUE;
 }
 
 static void
@@ -903,8 +1091,7 @@ set_rumble_state_cb (IpcRunner         *runner,
 }
 
 static void
-video_output_cb (IpcRunner *runner,
-                 RetroCore *self)
+handle_video_output (RetroCore *self)
 {
   RetroPixdata pixdata;
   RetroPixelFormat pixel_format;
@@ -913,13 +1100,10 @@ video_output_cb (IpcRunner *runner,
   gdouble aspect_ratio;
   gconstpointer pixels;
 
-  retro_framebuffer_lock (self->framebuffer);
-
-  if (!retro_framebuffer_get_is_dirty (self->framebuffer)) {
-    retro_framebuffer_unlock (self->framebuffer);
-
+  /* The acquired frame stays untouched by the runner until the next one is
+   * acquired, so handlers can use it without blocking the runner. */
+  if (!retro_framebuffer_acquire (self->framebuffer))
     return;
-  }
 
   rowstride = retro_framebuffer_get_rowstride (self->framebuffer);
   pixel_format = retro_framebuffer_get_format (self->framebuffer);
@@ -932,8 +1116,43 @@ video_output_cb (IpcRunner *runner,
                       width, height, aspect_ratio);
 
   g_signal_emit (self, signals[SIGNAL_VIDEO_OUTPUT], 0, &pixdata);
+}
+
+static void
+audio_output_cb (const gint16 *frames,
+                 gsize         n_frames,
+                 gdouble       sample_rate,
+                 RetroCore    *self)
+{
+  g_signal_emit (self, signals[SIGNAL_AUDIO_OUTPUT], 0,
+                 frames, (guint) n_frames, sample_rate);
+}
+
+static void
+handle_audio_output (RetroCore *self)
+{
+  /* The chunks must be consumed even without handlers for the runner to not
+   * run out of room. */
+  retro_audio_queue_read (self->audio_queue,
+                          (RetroAudioQueueFunc) audio_output_cb, self);
+}
+
+static gboolean
+video_output_cb (gint          fd,
+                 GIOCondition  condition,
+                 RetroCore    *self)
+{
+  guint64 count;
+
+  /* Only the latest frame matters and the audio queue is read as a whole, so
+   * reset the doorbell at once no matter how many times it was rung. */
+  if (read (fd, &count, sizeof (count)) < 0 && errno != EAGAIN)
+    g_critical ("Couldn't read video output notification: %s", g_strerror (errno));
 
-  retro_framebuffer_unlock (self->framebuffer);
+  handle_audio_output (self);
+  handle_video_output (self);
+
+  return G_SOURCE_CONTINUE;
 }
 
 static void
@@ -1040,32 +1259,16 @@ serialize_option_overrides (RetroCore *self)
 
 // FIXME Merge this into retro_core_set_controller().
 static void
-set_controller_port_device (RetroCore               *self,
-                            guint                    port,
-                            RetroControllerType      controller_type,
-                            RetroCoreControllerInfo *info)
+set_controller_port_device (RetroCore           *self,
+                            guint                port,
+                            RetroControllerType  controller_type)
 {
   g_autoptr(GError) error = NULL;
-  g_autoptr(GUnixFDList) fd_list = NULL;
-  gint handle;
   IpcRunner *proxy;
 
-  fd_list = g_unix_fd_list_new ();
-  if (info) {
-    gint fd = retro_controller_state_get_fd (info->state);
-    handle = g_unix_fd_list_append (fd_list, fd, &error);
-    if (handle == -1) {
-      crash (self, error);
-      return;
-    }
-  }
-  else
-    handle = -1;
-
   proxy = retro_runner_process_get_proxy (self->process);
   if (!ipc_runner_call_set_controller_sync (proxy, port, controller_type,
-                                            g_variant_new ("h", handle),
-                                            fd_list, NULL, NULL, &error))
+                                            NULL, &error))
     crash (self, error);
 }
 
@@ -1125,9 +1328,10 @@ retro_core_boot (RetroCore  *self,
   IpcRunner *proxy;
   GVariant *variables;
   g_autoptr(GVariant) framebuffer_variant = NULL;
+  g_autoptr(GVariant) audio_queue_variant = NULL;
   g_autoptr(GUnixFDList) fd_list = NULL;
   g_autoptr(GUnixFDList) out_fd_list = NULL;
-  gint fd, handle;
+  gint fd, handle, video_output_handle;
 
   g_return_if_fail (RETRO_IS_CORE (self));
 
@@ -1141,7 +1345,6 @@ retro_core_boot (RetroCore  *self,
   g_signal_connect_object (proxy, "variables-set", G_CALLBACK (variables_set_cb), self, 0);
   g_signal_connect_object (proxy, "message", G_CALLBACK (message_cb), self, 0);
   g_signal_connect_object (proxy, "log", G_CALLBACK (log_cb), self, 0);
-  g_signal_connect_object (proxy, "video-output", G_CALLBACK (video_output_cb), self, 0);
   g_signal_connect_object (proxy, "set-rumble-state", G_CALLBACK (set_rumble_state_cb), self, 0);
 
   g_object_bind_property (self,  "system-directory",
@@ -1159,6 +1362,23 @@ retro_core_boot (RetroCore  *self,
   g_object_bind_property (self,  "runahead",
                           proxy, "runahead",
                           G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL);
+  g_object_bind_property (self,  "detect-duplicate-frames",
+                          proxy, "detect-duplicate-frames",
+                          G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL);
+  g_object_bind_property_full (self,  "resampler-quality",
+                               proxy, "resampler-quality",
+                               G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL,
+                               retro_ipc_enum_to_uint, retro_ipc_uint_to_enum, NULL, NULL);
+  g_object_bind_property (self,  "dynamic-rate-control",
+                          proxy, "dynamic-rate-control",
+                          G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL);
+  g_object_bind_property_full (self,  "audio-sink",
+                               proxy, "audio-sink",
+                               G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL,
+                               retro_ipc_enum_to_uint, retro_ipc_uint_to_enum, NULL, NULL);
+  g_object_bind_property (self,  "audio-sink-path",
+                          proxy, "audio-sink-path",
+                          G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL);
 
   medias_array = g_ptr_array_new ();
   if (self->media_uris) {
@@ -1169,19 +1389,34 @@ retro_core_boot (RetroCore  *self,
   g_ptr_array_add (medias_array, NULL);
 
   fd_list = g_unix_fd_list_new ();
-  fd = retro_controller_state_get_fd (self->default_controller_state);
+  fd = retro_controller_state_get_fd (self->controller_state);
   handle = g_unix_fd_list_append (fd_list, fd, &tmp_error);
   if (handle == -1) {
     crash (self, tmp_error);
     return;
   }
 
+  self->video_output_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (self->video_output_fd < 0) {
+    g_critical ("Couldn't create video output eventfd: %s", g_strerror (errno));
+    return;
+  }
+
+  video_output_handle = g_unix_fd_list_append (fd_list, self->video_output_fd, &tmp_error);
+  if (video_output_handle == -1) {
+    crash (self, tmp_error);
+    return;
+  }
+
   if (!ipc_runner_call_boot_sync (proxy,
                                   serialize_option_overrides (self),
                                   (const gchar * const *) medias_array->pdata,
-                                  g_variant_new ("h", handle), fd_list,
+                                  g_variant_new ("h", handle),
+                                  g_variant_new ("h", video_output_handle),
+                                  fd_list,
                                   &variables,
-                                  &framebuffer_variant, &out_fd_list,
+                                  &framebuffer_variant,
+                                  &audio_queue_variant, &out_fd_list,
                                   NULL, &tmp_error)) {
     crash_or_propagate_error (self, tmp_error, error);
     return;
@@ -1201,10 +1436,27 @@ retro_core_boot (RetroCore  *self,
 
   self->framebuffer = retro_framebuffer_new (fd);
 
+  g_variant_get (audio_queue_variant, "h", &handle);
+  if (G_LIKELY (handle < g_unix_fd_list_get_length (out_fd_list))) {
+    fd = g_unix_fd_list_get (out_fd_list, handle, &tmp_error);
+    if (tmp_error) {
+      crash (self, tmp_error);
+      return;
+    }
+  } else {
+    g_critical ("Invalid audio queue handle");
+    return;
+  }
+
+  self->audio_queue = retro_audio_queue_new (fd);
+  self->video_output_source_id =
+    g_unix_fd_add (self->video_output_fd, G_IO_IN,
+                   (GUnixFDSourceFunc) video_output_cb, self);
+
   g_hash_table_iter_init (&iter, self->controllers);
   while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &info)) {
     controller_type = retro_controller_get_controller_type (info->controller);
-    set_controller_port_device (self, info->port, controller_type, info);
+    set_controller_port_device (self, info->port, controller_type);
   }
 
   if (!ipc_runner_call_get_properties_sync (proxy,
@@ -1371,11 +1623,13 @@ retro_core_iteration (RetroCore *self)
   }
 
   /* Since this is sync API, we must ensure video is updated synchronously.
-   * RetroFramebuffer already contains new data by this point, but the signal
-   * emission won't arrive until later. To circumvent it, handle the video right
-   * here and runner process will know not to emit the signal this time.
-   * See usage of the block_video_signal field in retro-runner/ipc-runner-impl.c */
-  video_output_cb (proxy, self);
+   * RetroFramebuffer already contains new data by this point, but the doorbell
+   * would only be handled later by the main loop. To circumvent it, handle the
+   * video right here and runner process will know not to ring it this time.
+   * See usage of the block_video_signal field in retro-runner/ipc-runner-impl.c
+   * The same goes for the audio. */
+  handle_audio_output (self);
+  handle_video_output (self);
 }
 
 /**
@@ -1453,6 +1707,89 @@ retro_core_load_state (RetroCore    *self,
     crash_or_propagate_error (self, tmp_error, error);
 }
 
+/**
+ * retro_core_record_movie:
+ * @self: a #RetroCore
+ * @filename: the file to record the movie to
+ * @from_state: whether to start from the current state rather than power-on
+ * @error: return location for a #GError, or %NULL
+ *
+ * Records the input and keyboard events @self sees on each frame into a movie
+ * file, until retro_core_stop_movie() is called. If @from_state is %FALSE,
+ * @self is reset so the movie starts from power-on, otherwise it starts from
+ * the current state, which requires @self to support accessing its state. The
+ * state the movie starts from is stored in it whenever @self supports
+ * accessing its state, otherwise playback starts from a reset.
+ *
+ * Movies can be replayed with retro_core_play_movie(), e.g. to reproduce a
+ * session or to benchmark the core with a real workload.
+ */
+void
+retro_core_record_movie (RetroCore    *self,
+                         const gchar  *filename,
+                         gboolean      from_state,
+                         GError      **error)
+{
+  GError *tmp_error = NULL;
+  IpcRunner *proxy;
+
+  g_return_if_fail (RETRO_IS_CORE (self));
+  g_return_if_fail (filename != NULL);
+  g_return_if_fail (retro_core_get_is_initiated (self));
+
+  proxy = retro_runner_process_get_proxy (self->process);
+  if (!ipc_runner_call_record_movie_sync (proxy, filename, from_state, NULL, &tmp_error))
+    crash_or_propagate_error (self, tmp_error, error);
+}
+
+/**
+ * retro_core_play_movie:
+ * @self: a #RetroCore
+ * @filename: the file to play the movie from
+ * @error: return location for a #GError, or %NULL
+ *
+ * Restores the state a movie recorded with retro_core_record_movie() starts
+ * from, then feeds its input to @self frame by frame. The controllers and
+ * keyboard events are ignored until the movie ends or retro_core_stop_movie()
+ * is called.
+ */
+void
+retro_core_play_movie (RetroCore    *self,
+                       const gchar  *filename,
+                       GError      **error)
+{
+  GError *tmp_error = NULL;
+  IpcRunner *proxy;
+
+  g_return_if_fail (RETRO_IS_CORE (self));
+  g_return_if_fail (filename != NULL);
+  g_return_if_fail (retro_core_get_is_initiated (self));
+
+  proxy = retro_runner_process_get_proxy (self->process);
+  if (!ipc_runner_call_play_movie_sync (proxy, filename, NULL, &tmp_error))
+    crash_or_propagate_error (self, tmp_error, error);
+}
+
+/**
+ * retro_core_stop_movie:
+ * @self: a #RetroCore
+ *
+ * Stops recording or playing the current movie, if any.
+ */
+void
+retro_core_stop_movie (RetroCore *self)
+{
+  g_autoptr(GError) error = NULL;
+  IpcRunner *proxy;
+
+  g_return_if_fail (RETRO_IS_CORE (self));
+  g_return_if_fail (retro_core_get_is_initiated (self));
+
+  proxy = retro_runner_process_get_proxy (self->process);
+  if (!ipc_runner_call_stop_movie_sync (proxy, NULL, &error))
+    crash (self, error);
+}
+
 /**
  * retro_core_get_memory_size:
  * @self: a #RetroCore
@@ -1536,59 +1873,70 @@ retro_core_load_memory (RetroCore        *self,
 }
 
 static void
-sync_controller_for_type (RetroControllerState *state,
-                          RetroController      *controller,
-                          RetroControllerType   type)
+sync_controller_for_type (RetroCore           *self,
+                          guint                port,
+                          RetroController     *controller,
+                          RetroControllerType  type)
 {
-  RetroInput input;
-  g_autofree gint16 *data = NULL;
-  gint max_id, max_index, next;
+  gsize n_states;
 
   if (!retro_controller_has_capability (controller, type))
     return;
 
-  max_id = retro_controller_type_get_id_count (type);
-  max_index = retro_controller_type_get_index_count (type);
+  n_states = retro_controller_type_get_id_count (type) *
+             retro_controller_type_get_index_count (type);
 
-  data = g_new (gint16, max_index * max_id);
-  next = 0;
+  g_assert (n_states <= G_N_ELEMENTS (self->input_states));
 
-  for (gint index = 0; index < max_index; index++) {
-    for (gint id = 0; id < max_id; id++) {
-      retro_input_init (&input, type, id, index);
-      data[next++] = retro_controller_get_input_state (controller, &input);
-    }
-  }
-
-  retro_controller_state_set_for_type (state, type, data, max_index * max_id);
+  retro_controller_get_input_states (controller, type, self->input_states, n_states);
+  retro_controller_state_set_for_type (self->controller_state, port, type,
+                                       self->input_states, n_states);
 }
 
 static void
 default_controller_state_changed_cb (RetroController                *controller,
                                      RetroCoreDefaultControllerInfo *info)
 {
-  retro_controller_state_lock (info->state);
-  sync_controller_for_type (info->state, controller, info->type);
-  retro_controller_state_unlock (info->state);
+  RetroControllerState *state = info->core->controller_state;
+  guint port = RETRO_CONTROLLER_STATE_DEFAULT_PORT;
+
+  retro_controller_state_begin_write (state, port);
+  sync_controller_for_type (info->core, port, controller, info->type);
+  retro_controller_state_end_write (state, port);
 }
 
 static void
 controller_state_changed_cb (RetroController         *controller,
                              RetroCoreControllerInfo *info)
 {
+  RetroControllerState *state = info->core->controller_state;
   gboolean rumble = retro_controller_get_supports_rumble (info->controller);
 
-  retro_controller_state_lock (info->state);
+  retro_controller_state_begin_write (state, info->port);
 
-  retro_controller_state_set_supports_rumble (info->state, rumble);
+  retro_controller_state_set_supports_rumble (state, info->port, rumble);
 
   for (gsize type = 1; type < RETRO_CONTROLLER_TYPE_COUNT; type++)
     if (retro_controller_has_capability (info->controller, type))
-      sync_controller_for_type (info->state, info->controller, type);
+      sync_controller_for_type (info->core, info->port, info->controller, type);
     else
-      retro_controller_state_clear_type (info->state, type);
+      retro_controller_state_clear_type (state, info->port, type);
+
+  retro_controller_state_end_write (state, info->port);
+}
+
+static void
+clear_controller_state (RetroCore *self,
+                        guint      port)
+{
+  retro_controller_state_begin_write (self->controller_state, port);
 
-  retro_controller_state_unlock (info->state);
+  retro_controller_state_set_supports_rumble (self->controller_state, port, FALSE);
+
+  for (gsize type = 1; type < RETRO_CONTROLLER_TYPE_COUNT; type++)
+    retro_controller_state_clear_type (self->controller_state, port, type);
+
+  retro_controller_state_end_write (self->controller_state, port);
 }
 
 /**
@@ -1618,9 +1966,9 @@ retro_core_set_default_controller (RetroCore           *self,
   if (controller != NULL) {
     info = g_new0 (RetroCoreDefaultControllerInfo, 1);
 
+    info->core = self;
     info->controller = g_object_ref (controller);
     info->type = controller_type;
-    info->state = self->default_controller_state;
     info->state_changed_id =
       g_signal_connect (controller, "state-changed",
                         G_CALLBACK (default_controller_state_changed_cb), info);
@@ -1628,10 +1976,13 @@ retro_core_set_default_controller (RetroCore           *self,
   }
   else {
     info = NULL;
-    retro_controller_state_lock (self->default_controller_state);
-    retro_controller_state_clear_type (self->default_controller_state,
+    retro_controller_state_begin_write (self->controller_state,
+                                        RETRO_CONTROLLER_STATE_DEFAULT_PORT);
+    retro_controller_state_clear_type (self->controller_state,
+                                       RETRO_CONTROLLER_STATE_DEFAULT_PORT,
                                        controller_type);
-    retro_controller_state_unlock (self->default_controller_state);
+    retro_controller_state_end_write (self->controller_state,
+                                      RETRO_CONTROLLER_STATE_DEFAULT_PORT);
   }
 
   self->default_controllers[controller_type] = info;
@@ -1640,7 +1991,7 @@ retro_core_set_default_controller (RetroCore           *self,
 /**
  * retro_core_set_controller:
  * @self: a #RetroCore
- * @port: the port number
+ * @port: the port number, lower than 16
  * @controller: (nullable): a #RetroController
  *
  * Plugs @controller into the specified port number of @self.
@@ -1654,19 +2005,15 @@ retro_core_set_controller (RetroCore       *self,
   RetroCoreControllerInfo *info;
 
   g_return_if_fail (RETRO_IS_CORE (self));
+  g_return_if_fail (port < RETRO_CONTROLLER_STATE_MAX_PORTS);
   g_return_if_fail (controller == NULL || RETRO_IS_CONTROLLER (controller));
 
   if (controller != NULL) {
     info = g_new0 (RetroCoreControllerInfo, 1);
-    gint fd;
-    g_autofree gchar *name = NULL;
-
-    name = g_strdup_printf ("[retro-runner controller %u]", port);
-    fd = retro_memfd_create (name);
 
+    info->core = self;
     info->controller = g_object_ref (controller);
     info->port = port;
-    info->state = retro_controller_state_new (fd);
     info->state_changed_id =
       g_signal_connect (controller, "state-changed",
                         G_CALLBACK (controller_state_changed_cb), info);
@@ -1676,15 +2023,15 @@ retro_core_set_controller (RetroCore       *self,
     controller_type = retro_controller_get_controller_type (controller);
   }
   else {
-    info = NULL;
     g_hash_table_remove (self->controllers, GUINT_TO_POINTER (port));
+    clear_controller_state (self, port);
     controller_type = RETRO_CONTROLLER_TYPE_NONE;
   }
 
   if (!retro_core_get_is_initiated (self))
     return;
 
-  set_controller_port_device (self, port, controller_type, info);
+  set_controller_port_device (self, port, controller_type);
 }
 
 static void
@@ -1813,6 +2160,444 @@ retro_core_set_speed_rate (RetroCore *self,
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_SPEED_RATE]);
 }
 
+/**
+ * retro_core_get_detect_duplicate_frames:
+ * @self: a #RetroCore
+ *
+ * Gets whether video frames identical to the previous one are skipped.
+ *
+ * Returns: whether duplicate frames are detected
+ */
+gboolean
+retro_core_get_detect_duplicate_frames (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), FALSE);
+
+  return self->detect_duplicate_frames;
+}
+
+/**
+ * retro_core_set_detect_duplicate_frames:
+ * @self: a #RetroCore
+ * @detect_duplicate_frames: whether to detect duplicate frames
+ *
+ * Sets whether video frames identical to the previous one should be skipped
+ * as if the core duped them.
+ */
+void
+retro_core_set_detect_duplicate_frames (RetroCore *self,
+                                        gboolean   detect_duplicate_frames)
+{
+  g_return_if_fail (RETRO_IS_CORE (self));
+
+  detect_duplicate_frames = !!detect_duplicate_frames;
+
+  if (self->detect_duplicate_frames == detect_duplicate_frames)
+    return;
+
+  self->detect_duplicate_frames = detect_duplicate_frames;
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_DETECT_DUPLICATE_FRAMES]);
+}
+
+/**
+ * retro_core_get_dynamic_rate_control:
+ * @self: a #RetroCore
+ *
+ * Gets whether the audio resampling ratio is adjusted to hold the target audio
+ * latency.
+ *
+ * Returns: whether dynamic rate control is enabled
+ */
+gboolean
+retro_core_get_dynamic_rate_control (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), FALSE);
+
+  return self->dynamic_rate_control;
+}
+
+/**
+ * retro_core_set_dynamic_rate_control:
+ * @self: a #RetroCore
+ * @dynamic_rate_control: whether to enable dynamic rate control
+ *
+ * Sets whether the audio resampling ratio should be adjusted to hold the
+ * target audio latency, compensating for clock drift.
+ */
+void
+retro_core_set_dynamic_rate_control (RetroCore *self,
+                                     gboolean   dynamic_rate_control)
+{
+  g_return_if_fail (RETRO_IS_CORE (self));
+
+  dynamic_rate_control = !!dynamic_rate_control;
+
+  if (self->dynamic_rate_control == dynamic_rate_control)
+    return;
+
+  self->dynamic_rate_control = dynamic_rate_control;
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_DYNAMIC_RATE_CONTROL]);
+}
+
+/**
+ * retro_core_get_audio_sink:
+ * @self: a #RetroCore
+ *
+ * Gets where the audio of @self goes.
+ *
+ * Returns: the audio sink type
+ */
+RetroAudioSinkType
+retro_core_get_audio_sink (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), RETRO_AUDIO_SINK_TYPE_PULSEAUDIO);
+
+  return self->audio_sink;
+}
+
+/**
+ * retro_core_set_audio_sink:
+ * @self: a #RetroCore
+ * @audio_sink: the audio sink type
+ *
+ * Sets where the audio of @self goes. This must be called before booting
+ * @self to be taken into account.
+ */
+void
+retro_core_set_audio_sink (RetroCore          *self,
+                           RetroAudioSinkType  audio_sink)
+{
+  g_return_if_fail (RETRO_IS_CORE (self));
+
+  if (self->audio_sink == audio_sink)
+    return;
+
+  self->audio_sink = audio_sink;
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_AUDIO_SINK]);
+}
+
+/**
+ * retro_core_get_audio_sink_path:
+ * @self: a #RetroCore
+ *
+ * Gets the file the audio of @self is written to when its audio sink is
+ * %RETRO_AUDIO_SINK_TYPE_FILE.
+ *
+ * Returns: (nullable): the audio file path
+ */
+const gchar *
+retro_core_get_audio_sink_path (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), NULL);
+
+  return self->audio_sink_path;
+}
+
+/**
+ * retro_core_set_audio_sink_path:
+ * @self: a #RetroCore
+ * @audio_sink_path: (nullable): the audio file path
+ *
+ * Sets the file the audio of @self is written to when its audio sink is
+ * %RETRO_AUDIO_SINK_TYPE_FILE. It is written as a WAV file if its name ends
+ * with ".wav", and as raw samples otherwise. This must be called before
+ * booting @self to be taken into account.
+ */
+void
+retro_core_set_audio_sink_path (RetroCore   *self,
+                                const gchar *audio_sink_path)
+{
+  g_return_if_fail (RETRO_IS_CORE (self));
+
+  if (g_strcmp0 (audio_sink_path, self->audio_sink_path) == 0)
+    return;
+
+  g_free (self->audio_sink_path);
+  self->audio_sink_path = g_strdup (audio_sink_path);
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_AUDIO_SINK_PATH]);
+}
+
+/**
+ * retro_core_get_resampler_quality:
+ * @self: a #RetroCore
+ *
+ * Gets the quality of the resampler used to play the audio of @self.
+ *
+ * Returns: the resampler quality
+ */
+RetroResamplerQuality
+retro_core_get_resampler_quality (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), RETRO_RESAMPLER_QUALITY_BEST);
+
+  return self->resampler_quality;
+}
+
+/**
+ * retro_core_set_resampler_quality:
+ * @self: a #RetroCore
+ * @resampler_quality: the resampler quality
+ *
+ * Sets the quality of the resampler used to play the audio of @self at its
+ * speed rate. Lower qualities are cheaper on the CPU.
+ */
+void
+retro_core_set_resampler_quality (RetroCore             *self,
+                                  RetroResamplerQuality  resampler_quality)
+{
+  g_return_if_fail (RETRO_IS_CORE (self));
+
+  if (self->resampler_quality == resampler_quality)
+    return;
+
+  self->resampler_quality = resampler_quality;
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_RESAMPLER_QUALITY]);
+}
+
+/**
+ * retro_core_get_frame_number:
+ * @self: a #RetroCore
+ *
+ * Gets the number of the last video frame output by @self, as counted by the
+ * runner process. Gaps between the numbers of consecutive frames mean frames
+ * were dropped.
+ *
+ * Returns: the number of the last video frame, or 0 if there was none
+ */
+guint64
+retro_core_get_frame_number (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0);
+
+  if (!self->framebuffer)
+    return 0;
+
+  return retro_framebuffer_get_sequence (self->framebuffer);
+}
+
+/**
+ * retro_core_get_frame_timestamp:
+ * @self: a #RetroCore
+ *
+ * Gets the time at which the last video frame output by @self was produced,
+ * in the same timebase as g_get_monotonic_time().
+ *
+ * Returns: the monotonic time of the last video frame in microseconds
+ */
+gint64
+retro_core_get_frame_timestamp (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0);
+
+  if (!self->framebuffer || retro_framebuffer_get_sequence (self->framebuffer) == 0)
+    return 0;
+
+  return retro_framebuffer_get_timestamp (self->framebuffer);
+}
+
+/**
+ * retro_core_get_frame_run_duration:
+ * @self: a #RetroCore
+ *
+ * Gets the time it took @self to run the iteration producing the last video
+ * frame, including the runahead frames.
+ *
+ * Returns: the run duration of the last video frame in microseconds
+ */
+gint64
+retro_core_get_frame_run_duration (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0);
+
+  if (!self->framebuffer || retro_framebuffer_get_sequence (self->framebuffer) == 0)
+    return 0;
+
+  return retro_framebuffer_get_run_duration (self->framebuffer);
+}
+
+/**
+ * retro_core_get_dropped_frames:
+ * @self: a #RetroCore
+ *
+ * Gets the number of video frames produced by @self which were replaced by a
+ * newer one before #RetroCore::video-output could be emitted for them.
+ *
+ * Returns: the number of dropped frames
+ */
+guint64
+retro_core_get_dropped_frames (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0);
+
+  if (!self->framebuffer)
+    return 0;
+
+  return retro_framebuffer_get_n_dropped (self->framebuffer);
+}
+
+/**
+ * retro_core_get_duplicated_frames:
+ * @self: a #RetroCore
+ *
+ * Gets the number of iterations of @self which didn't produce a new video
+ * frame, meaning the previous one was displayed once more, up to the last
+ * video frame.
+ *
+ * Returns: the number of duplicated frames
+ */
+guint64
+retro_core_get_duplicated_frames (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0);
+
+  if (!self->framebuffer || retro_framebuffer_get_sequence (self->framebuffer) == 0)
+    return 0;
+
+  return retro_framebuffer_get_n_duplicated (self->framebuffer);
+}
+
+static void
+get_audio_stats (RetroCore       *self,
+                 RetroAudioStats *stats)
+{
+  if (self->audio_queue && retro_audio_queue_get_stats (self->audio_queue, stats))
+    return;
+
+  memset (stats, 0, sizeof (RetroAudioStats));
+  stats->resampling_ratio = 1.0;
+}
+
+/**
+ * retro_core_get_audio_frames_per_iteration:
+ * @self: a #RetroCore
+ *
+ * Gets the number of audio frames @self produces per iteration, smoothed over
+ * the last iterations.
+ *
+ * Returns: the number of audio frames per iteration
+ */
+gdouble
+retro_core_get_audio_frames_per_iteration (RetroCore *self)
+{
+  RetroAudioStats stats;
+
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0.0);
+
+  get_audio_stats (self, &stats);
+
+  return stats.frames_per_iteration;
+}
+
+/**
+ * retro_core_get_audio_resampling_ratio:
+ * @self: a #RetroCore
+ *
+ * Gets the ratio the audio of @self is currently resampled at to play it,
+ * accounting for the speed rate and for dynamic rate control.
+ *
+ * Returns: the resampling ratio
+ */
+gdouble
+retro_core_get_audio_resampling_ratio (RetroCore *self)
+{
+  RetroAudioStats stats;
+
+  g_return_val_if_fail (RETRO_IS_CORE (self), 1.0);
+
+  get_audio_stats (self, &stats);
+
+  return stats.resampling_ratio;
+}
+
+/**
+ * retro_core_get_audio_latency:
+ * @self: a #RetroCore
+ *
+ * Gets the amount of audio of @self queued for playback, including the audio
+ * buffered by the sound server.
+ *
+ * Returns: the queued audio latency in milliseconds
+ */
+gdouble
+retro_core_get_audio_latency (RetroCore *self)
+{
+  RetroAudioStats stats;
+
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0.0);
+
+  get_audio_stats (self, &stats);
+
+  return stats.latency;
+}
+
+/**
+ * retro_core_get_audio_underruns:
+ * @self: a #RetroCore
+ *
+ * Gets how many times the playback of the audio of @self ran out of audio and
+ * had to be filled with silence.
+ *
+ * Returns: the number of audio underruns
+ */
+guint
+retro_core_get_audio_underruns (RetroCore *self)
+{
+  RetroAudioStats stats;
+
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0);
+
+  get_audio_stats (self, &stats);
+
+  return stats.n_underruns;
+}
+
+/**
+ * retro_core_get_dropped_audio_frames:
+ * @self: a #RetroCore
+ *
+ * Gets the number of audio frames produced by @self which were dropped because
+ * the playback buffer was full.
+ *
+ * Returns: the number of dropped audio frames
+ */
+guint
+retro_core_get_dropped_audio_frames (RetroCore *self)
+{
+  RetroAudioStats stats;
+
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0);
+
+  get_audio_stats (self, &stats);
+
+  return stats.n_dropped_frames;
+}
+
+/**
+ * retro_core_get_audio_blocked_time:
+ * @self: a #RetroCore
+ *
+ * Gets the total time the runner process spent handing the audio of @self
+ * over for playback, during which it couldn't run @self.
+ *
+ * Returns: the time spent blocked on audio in microseconds
+ */
+gint64
+retro_core_get_audio_blocked_time (RetroCore *self)
+{
+  RetroAudioStats stats;
+
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0);
+
+  get_audio_stats (self, &stats);
+
+  return stats.blocked_time;
+}
+
 /**
  * retro_core_has_option:
  * @self: a #RetroCore
@@ -7,9 +7,11 @@
 #endif
 
 #include <gtk/gtk.h>
+#include "retro-audio-sink-type.h"
 #include "retro-controller-iterator.h"
 #include "retro-memory-type.h"
 #include "retro-option-iterator.h"
+#include "retro-resampler-quality.h"
 
 G_BEGIN_DECLS
 
@@ -51,6 +53,14 @@ void retro_core_save_state (RetroCore    *self,
 void retro_core_load_state (RetroCore    *self,
                             const gchar  *filename,
                             GError      **error);
+void retro_core_record_movie (RetroCore    *self,
+                              const gchar  *filename,
+                              gboolean      from_state,
+                              GError      **error);
+void retro_core_play_movie (RetroCore    *self,
+                            const gchar  *filename,
+                            GError      **error);
+void retro_core_stop_movie (RetroCore *self);
 gsize retro_core_get_memory_size (RetroCore       *self,
                                   RetroMemoryType  memory_type);
 void retro_core_save_memory (RetroCore        *self,
@@ -76,6 +86,32 @@ void retro_core_set_runahead (RetroCore *self,
 gdouble retro_core_get_speed_rate (RetroCore *self);
 void retro_core_set_speed_rate (RetroCore *self,
                                 gdouble    speed_rate);
+gboolean retro_core_get_detect_duplicate_frames (RetroCore *self);
+void retro_core_set_detect_duplicate_frames (RetroCore *self,
+                                             gboolean   detect_duplicate_frames);
+gboolean retro_core_get_dynamic_rate_control (RetroCore *self);
+void retro_core_set_dynamic_rate_control (RetroCore *self,
+                                          gboolean   dynamic_rate_control);
+RetroAudioSinkType retro_core_get_audio_sink (RetroCore *self);
+void retro_core_set_audio_sink (RetroCore          *self,
+                                RetroAudioSinkType  audio_sink);
+const gchar *retro_core_get_audio_sink_path (RetroCore *self);
+void retro_core_set_audio_sink_path (RetroCore   *self,
+                                     const gchar *audio_sink_path);
+RetroResamplerQuality retro_core_get_resampler_quality (RetroCore *self);
+void retro_core_set_resampler_quality (RetroCore             *self,
+                                       RetroResamplerQuality  resampler_quality);
+guint64 retro_core_get_frame_number (RetroCore *self);
+gint64 retro_core_get_frame_timestamp (RetroCore *self);
+gint64 retro_core_get_frame_run_duration (RetroCore *self);
+guint64 retro_core_get_dropped_frames (RetroCore *self);
+guint64 retro_core_get_duplicated_frames (RetroCore *self);
+gdouble retro_core_get_audio_frames_per_iteration (RetroCore *self);
+gdouble retro_core_get_audio_resampling_ratio (RetroCore *self);
+gdouble retro_core_get_audio_latency (RetroCore *self);
+guint retro_core_get_audio_underruns (RetroCore *self);
+guint retro_core_get_dropped_audio_frames (RetroCore *self);
+gint64 retro_core_get_audio_blocked_time (RetroCore *self);
 gboolean retro_core_has_option (RetroCore   *self,
                                 const gchar *key);
 RetroOption *retro_core_get_option (RetroCore   *self,
@@ -12,10 +12,18 @@
 #include <epoxy/gl.h>
 #include "retro-glsl-filter-private.h"
 #include "retro-pixbuf.h"
-#include "retro-pixdata.h"
+#include "retro-pixdata-private.h"
 
 #define RETRO_VIDEO_FILTER_COUNT (RETRO_VIDEO_FILTER_CRT + 1)
 
+typedef enum {
+  RETRO_UNIFORM_RELATIVE_ASPECT_RATIO,
+  RETRO_UNIFORM_SOURCE_SIZE,
+  RETRO_UNIFORM_TARGET_SIZE,
+  RETRO_UNIFORM_OUTPUT_SIZE,
+  RETRO_UNIFORM_COUNT,
+} RetroUniform;
+
 struct _RetroGLDisplay
 {
   GtkGLArea parent_instance;
@@ -27,7 +35,14 @@ struct _RetroGLDisplay
   gulong video_output_cb_id;
 
   RetroGLSLFilter *glsl_filter[RETRO_VIDEO_FILTER_COUNT];
+  gint uniforms[RETRO_VIDEO_FILTER_COUNT][RETRO_UNIFORM_COUNT];
   GLuint texture;
+  gboolean texture_dirty;
+  gint texture_width;
+  gint texture_height;
+  gboolean has_texture_storage;
+
+  GLuint pixel_buffer;
 };
 
 G_DEFINE_TYPE (RetroGLDisplay, retro_gl_display, GTK_TYPE_GL_AREA)
@@ -53,6 +68,13 @@ static GLuint elements[] = {
     2, 3, 0,
 };
 
+static const gchar *uniform_names[] = {
+  "relative_aspect_ratio",
+  "sourceSize[0]",
+  "targetSize",
+  "outputSize",
+};
+
 static const gchar *filter_uris[] = {
   "resource:///org/gnome/Retro/glsl-filters/bicubic.filter",
   "resource:///org/gnome/Retro/glsl-filters/sharp.filter",
@@ -83,6 +105,8 @@ set_pixdata (RetroGLDisplay *self,
   if (pixdata != NULL)
     self->pixdata = retro_pixdata_copy (pixdata);
 
+  self->texture_dirty = TRUE;
+
   gtk_widget_queue_draw (GTK_WIDGET (self));
 }
 
@@ -128,54 +152,86 @@ get_video_box (RetroGLDisplay *self,
   *y = (h - *height) / 2;
 }
 
-static gboolean
-load_texture (RetroGLDisplay *self,
-              gint           *texture_width,
-              gint           *texture_height)
+/*
+ * Immutable texture storage can't be resized, so the texture is recreated
+ * when the video geometry changes, and only then.
+ */
+static void
+allocate_texture (RetroGLDisplay *self,
+                  gint            width,
+                  gint            height)
 {
+  if (self->texture != 0 &&
+      self->texture_width == width &&
+      self->texture_height == height) {
+    glBindTexture (GL_TEXTURE_2D, self->texture);
+
+    return;
+  }
+
+  glDeleteTextures (1, &self->texture);
+  glGenTextures (1, &self->texture);
   glBindTexture (GL_TEXTURE_2D, self->texture);
 
+  if (self->has_texture_storage)
+    glTexStorage2D (GL_TEXTURE_2D, 1, GL_RGB8, width, height);
+  else
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, width, height, 0,
+                  GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+  self->texture_width = width;
+  self->texture_height = height;
+}
+
+static gboolean
+load_texture (RetroGLDisplay *self)
+{
   if (self->pixdata != NULL) {
-    *texture_width = retro_pixdata_get_width (self->pixdata);
-    *texture_height = retro_pixdata_get_height (self->pixdata);
+    allocate_texture (self,
+                      retro_pixdata_get_width (self->pixdata),
+                      retro_pixdata_get_height (self->pixdata));
 
-    return retro_pixdata_load_gl_texture (self->pixdata);
+    return retro_pixdata_upload_gl_texture (self->pixdata, self->pixel_buffer);
   }
 
   if (retro_gl_display_get_pixbuf (self) == NULL)
     return FALSE;
 
-  *texture_width = gdk_pixbuf_get_width (self->pixbuf),
-  *texture_height = gdk_pixbuf_get_height (self->pixbuf),
+  allocate_texture (self,
+                    gdk_pixbuf_get_width (self->pixbuf),
+                    gdk_pixbuf_get_height (self->pixbuf));
 
-  glTexImage2D (GL_TEXTURE_2D,
-                0,
-                GL_RGB,
-                *texture_width,
-                *texture_height,
-                0,
-                GL_RGBA, GL_UNSIGNED_BYTE,
-                gdk_pixbuf_get_pixels (self->pixbuf));
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, gdk_pixbuf_get_rowstride (self->pixbuf) / 4);
+  glTexSubImage2D (GL_TEXTURE_2D,
+                   0,
+                   0, 0,
+                   self->texture_width,
+                   self->texture_height,
+                   GL_RGBA, GL_UNSIGNED_BYTE,
+                   gdk_pixbuf_get_pixels (self->pixbuf));
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
 
   return TRUE;
 }
 
 static void
-draw_texture (RetroGLDisplay  *self,
-              RetroGLSLFilter *filter,
+draw_texture (RetroGLDisplay   *self,
+              RetroVideoFilter filter,
               gint             texture_width,
               gint             texture_height)
 {
   GLfloat source_width, source_height;
   GLfloat target_width, target_height;
   GLfloat output_width, output_height;
-  RetroGLSLShader *shader = retro_glsl_filter_get_shader (filter);
+  RetroGLSLShader *shader = retro_glsl_filter_get_shader (self->glsl_filter[filter]);
+  gint *uniforms = self->uniforms[filter];
 
   retro_glsl_shader_use_program (shader);
 
   retro_glsl_shader_apply_texture_params (shader);
 
-  retro_glsl_shader_set_uniform_1f (shader, "relative_aspect_ratio",
+  retro_glsl_shader_set_uniform_1f_by_handle (shader,
+    uniforms[RETRO_UNIFORM_RELATIVE_ASPECT_RATIO],
     (gfloat) gtk_widget_get_allocated_width (GTK_WIDGET (self)) /
     (gfloat) gtk_widget_get_allocated_height (GTK_WIDGET (self)) /
     self->aspect_ratio);
@@ -187,17 +243,20 @@ draw_texture (RetroGLDisplay  *self,
   output_width = (GLfloat) gtk_widget_get_allocated_width (GTK_WIDGET (self));
   output_height = (GLfloat) gtk_widget_get_allocated_height (GTK_WIDGET (self));
 
-  retro_glsl_shader_set_uniform_4f (shader, "sourceSize[0]",
-                                    source_width, source_height,
-                                    1.0f / source_width, 1.0f / source_height);
+  retro_glsl_shader_set_uniform_4f_by_handle (shader,
+                                              uniforms[RETRO_UNIFORM_SOURCE_SIZE],
+                                              source_width, source_height,
+                                              1.0f / source_width, 1.0f / source_height);
 
-  retro_glsl_shader_set_uniform_4f (shader, "targetSize",
-                                    target_width, target_height,
-                                    1.0f / target_width, 1.0f / target_height);
+  retro_glsl_shader_set_uniform_4f_by_handle (shader,
+                                              uniforms[RETRO_UNIFORM_TARGET_SIZE],
+                                              target_width, target_height,
+                                              1.0f / target_width, 1.0f / target_height);
 
-  retro_glsl_shader_set_uniform_4f (shader, "outputSize",
-                                    output_width, output_height,
-                                    1.0f / output_width, 1.0f / output_height);
+  retro_glsl_shader_set_uniform_4f_by_handle (shader,
+                                              uniforms[RETRO_UNIFORM_OUTPUT_SIZE],
+                                              output_width, output_height,
+                                              1.0f / output_width, 1.0f / output_height);
 
   glDrawElements (GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 }
@@ -240,6 +299,10 @@ realize (RetroGLDisplay *self)
 
     shader = retro_glsl_filter_get_shader (self->glsl_filter[filter]);
 
+    for (RetroUniform uniform = 0; uniform < RETRO_UNIFORM_COUNT; uniform++)
+      self->uniforms[filter][uniform] =
+        retro_glsl_shader_get_uniform_handle (shader, uniform_names[uniform]);
+
     retro_glsl_shader_set_attribute_pointer (shader,
                                              "position",
                                              sizeof (((RetroVertex *) NULL)->position) / sizeof (float),
@@ -259,8 +322,19 @@ realize (RetroGLDisplay *self)
 
   glDeleteTextures (1, &self->texture);
   self->texture = 0;
-  glGenTextures (1, &self->texture);
-  glBindTexture (GL_TEXTURE_2D, self->texture);
+  self->texture_dirty = TRUE;
+
+  /* OpenGL ES only accepts uploads matching a sized internal format exactly,
+   * which would rule out uploading RGB565 frames to an RGB8 texture. */
+  self->has_texture_storage = epoxy_is_desktop_gl () &&
+                              (epoxy_gl_version () >= 42 ||
+                               epoxy_has_gl_extension ("GL_ARB_texture_storage"));
+
+  /* Mapping pixel buffers requires OpenGL (ES) 3.0, without them the pixels
+   * are uploaded straight from client memory. A single buffer is enough as
+   * each upload orphans its previous storage. */
+  if (epoxy_gl_version () >= 30)
+    glGenBuffers (1, &self->pixel_buffer);
 
   current_filter = self->filter >= RETRO_VIDEO_FILTER_COUNT ?
     RETRO_VIDEO_FILTER_SMOOTH :
@@ -281,6 +355,8 @@ unrealize (RetroGLDisplay *self)
 
   glDeleteTextures (1, &self->texture);
   self->texture = 0;
+  glDeleteBuffers (1, &self->pixel_buffer);
+  self->pixel_buffer = 0;
   for (RetroVideoFilter filter = 0; filter < RETRO_VIDEO_FILTER_COUNT; filter++)
     g_clear_object (&self->glsl_filter[filter]);
 }
@@ -289,8 +365,6 @@ static gboolean
 render (RetroGLDisplay *self)
 {
   RetroVideoFilter filter;
-  gint texture_width;
-  gint texture_height;
 
   glClear (GL_COLOR_BUFFER_BIT);
 
@@ -300,10 +374,18 @@ render (RetroGLDisplay *self)
 
   g_assert (self->glsl_filter[filter] != NULL);
 
-  if (!load_texture (self, &texture_width, &texture_height))
-    return FALSE;
+  /* Redraws caused by anything but a new frame, like resizing or changing the
+   * filter, reuse the texture as is. */
+  if (self->texture_dirty) {
+    if (!load_texture (self))
+      return FALSE;
+
+    self->texture_dirty = FALSE;
+  }
+  else
+    glBindTexture (GL_TEXTURE_2D, self->texture);
 
-  draw_texture (self, self->glsl_filter[filter], texture_width, texture_height);
+  draw_texture (self, filter, self->texture_width, self->texture_height);
 
   return FALSE;
 }
@@ -453,6 +535,8 @@ retro_gl_display_set_pixbuf (RetroGLDisplay *self,
   if (pixbuf != NULL)
     self->pixbuf = g_object_ref (pixbuf);
 
+  self->texture_dirty = TRUE;
+
   aspect_ratio = retro_pixbuf_get_aspect_ratio (pixbuf);
   if (aspect_ratio != 0.f)
     self->aspect_ratio = aspect_ratio;
@@ -19,6 +19,26 @@ RetroGLSLShader *retro_glsl_shader_new (GBytes  *vertex,
                                         GError **error);
 void retro_glsl_shader_use_program (RetroGLSLShader *self);
 void retro_glsl_shader_apply_texture_params (RetroGLSLShader *self);
+gint retro_glsl_shader_get_attribute_handle (RetroGLSLShader *self,
+                                             const gchar     *name);
+gint retro_glsl_shader_get_uniform_handle (RetroGLSLShader *self,
+                                           const gchar     *name);
+void retro_glsl_shader_set_attribute_pointer_by_handle (RetroGLSLShader *self,
+                                                        gint             handle,
+                                                        GLint            size,
+                                                        GLenum           type,
+                                                        GLboolean        normalized,
+                                                        GLsizei          stride,
+                                                        const GLvoid    *pointer);
+void retro_glsl_shader_set_uniform_1f_by_handle (RetroGLSLShader *self,
+                                                 gint             handle,
+                                                 gfloat           v0);
+void retro_glsl_shader_set_uniform_4f_by_handle (RetroGLSLShader *self,
+                                                 gint             handle,
+                                                 gfloat           v0,
+                                                 gfloat           v1,
+                                                 gfloat           v2,
+                                                 gfloat           v3);
 void retro_glsl_shader_set_attribute_pointer (RetroGLSLShader *self,
                                               const gchar     *name,
                                               GLint            size,
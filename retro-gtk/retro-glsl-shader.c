@@ -2,6 +2,14 @@
 
 #include "retro-glsl-shader-private.h"
 
+#include <string.h>
+
+typedef struct {
+  GLint location;
+  gboolean has_value;
+  gfloat value[4];
+} RetroGLSLUniform;
+
 struct _RetroGLSLShader
 {
   GObject parent_instance;
@@ -10,6 +18,12 @@ struct _RetroGLSLShader
   GLenum wrap;
   GLenum filter;
   GLuint program;
+
+  /* Maps names to handles, which are indices in the arrays. */
+  GHashTable *uniform_handles;
+  GArray *uniforms;
+  GHashTable *attribute_handles;
+  GArray *attribute_locations;
 };
 
 G_DEFINE_TYPE (RetroGLSLShader, retro_glsl_shader, G_TYPE_OBJECT)
@@ -61,11 +75,81 @@ create_shader (GBytes  *source_bytes,
   return shader;
 }
 
+/*
+ * Resolves the locations of all the active uniforms and attributes once, so
+ * they don't have to be looked up by name each time they are set.
+ */
+static void
+resolve_locations (RetroGLSLShader *self)
+{
+  g_autofree gchar *name = NULL;
+  gint count = 0, max_length = 0, length;
+  GLint size;
+  GLenum type;
+
+  glGetProgramiv (self->program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+  glGetProgramiv (self->program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &length);
+  max_length = MAX (max_length, length);
+  name = g_malloc (max_length + 1);
+
+  glGetProgramiv (self->program, GL_ACTIVE_UNIFORMS, &count);
+  for (gint i = 0; i < count; i++) {
+    RetroGLSLUniform uniform = { 0 };
+
+    glGetActiveUniform (self->program, i, max_length + 1, NULL, &size, &type, name);
+    uniform.location = glGetUniformLocation (self->program, name);
+    if (uniform.location < 0)
+      continue;
+
+    g_array_append_val (self->uniforms, uniform);
+    g_hash_table_insert (self->uniform_handles, g_strdup (name),
+                         GINT_TO_POINTER (self->uniforms->len));
+
+    /* Drivers may report arrays with or without the index of their first
+     * element, make them reachable by both names. */
+    if (g_str_has_suffix (name, "[0]")) {
+      name[strlen (name) - 3] = '\0';
+      g_hash_table_insert (self->uniform_handles, g_strdup (name),
+                           GINT_TO_POINTER (self->uniforms->len));
+    }
+    else if (size > 1)
+      g_hash_table_insert (self->uniform_handles, g_strdup_printf ("%s[0]", name),
+                           GINT_TO_POINTER (self->uniforms->len));
+  }
+
+  glGetProgramiv (self->program, GL_ACTIVE_ATTRIBUTES, &count);
+  for (gint i = 0; i < count; i++) {
+    GLint location;
+
+    glGetActiveAttrib (self->program, i, max_length + 1, NULL, &size, &type, name);
+    location = glGetAttribLocation (self->program, name);
+    if (location < 0)
+      continue;
+
+    g_array_append_val (self->attribute_locations, location);
+    g_hash_table_insert (self->attribute_handles, g_strdup (name),
+                         GINT_TO_POINTER (self->attribute_locations->len));
+  }
+}
+
+/* The hash tables store handles plus one, so that NULL means not found. */
+static gint
+lookup_handle (GHashTable  *handles,
+               const gchar *name)
+{
+  return GPOINTER_TO_INT (g_hash_table_lookup (handles, name)) - 1;
+}
+
 static void
 retro_glsl_shader_finalize (GObject *object)
 {
   RetroGLSLShader *self = (RetroGLSLShader *) object;
 
+  g_hash_table_unref (self->uniform_handles);
+  g_array_unref (self->uniforms);
+  g_hash_table_unref (self->attribute_handles);
+  g_array_unref (self->attribute_locations);
+
   if (self->program != 0) {
     glDeleteProgram (self->program);
     self->program = 0;
@@ -85,6 +169,10 @@ retro_glsl_shader_class_init (RetroGLSLShaderClass *klass)
 static void
 retro_glsl_shader_init (RetroGLSLShader *self)
 {
+  self->uniform_handles = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->uniforms = g_array_new (FALSE, FALSE, sizeof (RetroGLSLUniform));
+  self->attribute_handles = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->attribute_locations = g_array_new (FALSE, FALSE, sizeof (GLint));
 }
 
 RetroGLSLShader *
@@ -153,6 +241,8 @@ retro_glsl_shader_new (GBytes  *vertex,
   glDetachShader (self->program, vertex_shader);
   glDetachShader (self->program, fragment_shader);
 
+  resolve_locations (self);
+
   return g_steal_pointer (&self);
 }
 
@@ -176,6 +266,113 @@ retro_glsl_shader_apply_texture_params (RetroGLSLShader *self)
   glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, self->filter);
 }
 
+gint
+retro_glsl_shader_get_attribute_handle (RetroGLSLShader *self,
+                                        const gchar     *name)
+{
+  g_return_val_if_fail (RETRO_IS_GLSL_SHADER (self), -1);
+  g_return_val_if_fail (name != NULL, -1);
+
+  return lookup_handle (self->attribute_handles, name);
+}
+
+gint
+retro_glsl_shader_get_uniform_handle (RetroGLSLShader *self,
+                                      const gchar     *name)
+{
+  g_return_val_if_fail (RETRO_IS_GLSL_SHADER (self), -1);
+  g_return_val_if_fail (name != NULL, -1);
+
+  return lookup_handle (self->uniform_handles, name);
+}
+
+void
+retro_glsl_shader_set_attribute_pointer_by_handle (RetroGLSLShader *self,
+                                                   gint             handle,
+                                                   GLint            size,
+                                                   GLenum           type,
+                                                   GLboolean        normalized,
+                                                   GLsizei          stride,
+                                                   const GLvoid    *pointer)
+{
+  GLint location;
+
+  g_return_if_fail (RETRO_IS_GLSL_SHADER (self));
+  g_return_if_fail (self->program != 0);
+  g_return_if_fail (handle < (gint) self->attribute_locations->len);
+
+  /* Like OpenGL, silently ignore inactive attributes. */
+  if (handle < 0)
+    return;
+
+  location = g_array_index (self->attribute_locations, GLint, handle);
+  glVertexAttribPointer (location, size, type, normalized, stride, pointer);
+  glEnableVertexAttribArray (location);
+}
+
+/* Uniforms keep their values across program switches, so there is no need to
+ * upload a value the uniform already has. */
+static void
+set_uniform (RetroGLSLShader *self,
+             gint             handle,
+             gint             n_values,
+             const gfloat    *values)
+{
+  RetroGLSLUniform *uniform;
+
+  if (handle < 0)
+    return;
+
+  uniform = &g_array_index (self->uniforms, RetroGLSLUniform, handle);
+
+  if (uniform->has_value &&
+      memcmp (uniform->value, values, n_values * sizeof (gfloat)) == 0)
+    return;
+
+  memcpy (uniform->value, values, n_values * sizeof (gfloat));
+  uniform->has_value = TRUE;
+
+  switch (n_values) {
+  case 1:
+    glUniform1f (uniform->location, values[0]);
+
+    break;
+  case 4:
+    glUniform4f (uniform->location, values[0], values[1], values[2], values[3]);
+
+    break;
+  default:
+    g_assert_not_reached ();
+  }
+}
+
+void
+retro_glsl_shader_set_uniform_1f_by_handle (RetroGLSLShader *self,
+                                            gint             handle,
+                                            gfloat           v0)
+{
+  g_return_if_fail (RETRO_IS_GLSL_SHADER (self));
+  g_return_if_fail (self->program != 0);
+  g_return_if_fail (handle < (gint) self->uniforms->len);
+
+  set_uniform (self, handle, 1, (gfloat []) { v0 });
+}
+
+void
+retro_glsl_shader_set_uniform_4f_by_handle (RetroGLSLShader *self,
+                                            gint             handle,
+                                            gfloat           v0,
+                                            gfloat           v1,
+                                            gfloat           v2,
+                                            gfloat           v3)
+{
+  g_return_if_fail (RETRO_IS_GLSL_SHADER (self));
+  g_return_if_fail (self->program != 0);
+  g_return_if_fail (handle < (gint) self->uniforms->len);
+
+  set_uniform (self, handle, 4, (gfloat []) { v0, v1, v2, v3 });
+}
+
 void
 retro_glsl_shader_set_attribute_pointer (RetroGLSLShader *self,
                                          const gchar     *name,
@@ -185,14 +382,12 @@ retro_glsl_shader_set_attribute_pointer (RetroGLSLShader *self,
                                          GLsizei          stride,
                                          const GLvoid    *pointer)
 {
-  GLint location;
-
   g_return_if_fail (RETRO_IS_GLSL_SHADER (self));
-  g_return_if_fail (self->program != 0);
 
-  location = glGetAttribLocation (self->program, name);
-  glVertexAttribPointer (location, size, type, normalized, stride, pointer);
-  glEnableVertexAttribArray (location);
+  retro_glsl_shader_set_attribute_pointer_by_handle (self,
+                                                     retro_glsl_shader_get_attribute_handle (self, name),
+                                                     size, type, normalized,
+                                                     stride, pointer);
 }
 
 void
@@ -200,13 +395,11 @@ retro_glsl_shader_set_uniform_1f (RetroGLSLShader *self,
                                   const gchar     *name,
                                   gfloat           v0)
 {
-  GLint location;
-
   g_return_if_fail (RETRO_IS_GLSL_SHADER (self));
-  g_return_if_fail (self->program != 0);
 
-  location = glGetUniformLocation (self->program, name);
-  glUniform1f (location, v0);
+  retro_glsl_shader_set_uniform_1f_by_handle (self,
+                                              retro_glsl_shader_get_uniform_handle (self, name),
+                                              v0);
 }
 
 void
@@ -217,11 +410,9 @@ retro_glsl_shader_set_uniform_4f (RetroGLSLShader *self,
                                   gfloat           v2,
                                   gfloat           v3)
 {
-  GLint location;
-
   g_return_if_fail (RETRO_IS_GLSL_SHADER (self));
-  g_return_if_fail (self->program != 0);
 
-  location = glGetUniformLocation (self->program, name);
-  glUniform4f (location, v0, v1, v2, v3);
+  retro_glsl_shader_set_uniform_4f_by_handle (self,
+                                              retro_glsl_shader_get_uniform_handle (self, name),
+                                              v0, v1, v2, v3);
 }
@@ -8,6 +8,7 @@
 #error    retro-gtk is unstable API. You must define RETRO_GTK_USE_UNSTABLE_API before including retro-gtk.h
 #endif
 
+#include "retro-audio-sink-type.h"
 #include "retro-controller.h"
 #include "retro-controller-codes.h"
 #include "retro-controller-iterator.h"
@@ -26,6 +27,7 @@
 #include "retro-option-iterator.h"
 #include "retro-pixbuf.h"
 #include "retro-pixdata.h"
+#include "retro-resampler-quality.h"
 #include "retro-rumble-effect.h"
 #include "retro-video-filter.h"
 
@@ -12,6 +12,13 @@
 
 G_BEGIN_DECLS
 
+typedef enum
+{
+  RETRO_PIXDATA_SIMD_NONE,
+  RETRO_PIXDATA_SIMD_SSE2,
+  RETRO_PIXDATA_SIMD_AVX2,
+} RetroPixdataSimd;
+
 struct _RetroPixdata
 {
   guint8 *data;
@@ -29,5 +36,12 @@ void retro_pixdata_init (RetroPixdata     *self,
                          gsize             width,
                          gsize             height,
                          gfloat            aspect_ratio);
+gboolean retro_pixdata_upload_gl_texture (RetroPixdata *self,
+                                          guint         pixel_buffer);
+gboolean retro_pixdata_convert_row (RetroPixdataSimd  simd,
+                                    RetroPixelFormat  pixel_format,
+                                    gconstpointer     src,
+                                    guint8           *dst,
+                                    gsize             width);
 
 G_END_DECLS
@@ -18,8 +18,14 @@
 #include "retro-pixdata-private.h"
 
 #include <epoxy/gl.h>
+#include <string.h>
 #include "retro-pixbuf.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RETRO_PIXDATA_X86_SIMD
+#include <immintrin.h>
+#endif
+
 G_DEFINE_BOXED_TYPE (RetroPixdata, retro_pixdata, retro_pixdata_copy, retro_pixdata_free)
 
 /*
@@ -30,123 +36,399 @@ G_DEFINE_BOXED_TYPE (RetroPixdata, retro_pixdata, retro_pixdata_copy, retro_pixd
 
 /* Private */
 
-typedef struct {
-  guint16 b: 5;
-  guint16 g: 5;
-  guint16 r: 5;
-  guint16 x: 1;
-} xrgb1555;
+/*
+ * Converters write a row of @width pixels in the RGBA8888 byte order expected
+ * by GdkPixbuf from a row of pixels in the given Libretro pixel format.
+ */
+typedef void (*ConvertRow) (const guint8 *src,
+                            guint8       *dst,
+                            gsize         width);
+
+static inline void
+store_rgba (guint8 *dst,
+            guint8  r,
+            guint8  g,
+            guint8  b)
+{
+  dst[0] = r;
+  dst[1] = g;
+  dst[2] = b;
+  dst[3] = 0xff;
+}
 
-typedef struct {
-  guint32 b: 8;
-  guint32 g: 8;
-  guint32 r: 8;
-  guint32 x: 8;
-} xrgb8888;
+static void
+convert_row_xrgb1555 (const guint8 *src,
+                      guint8       *dst,
+                      gsize         width)
+{
+  for (gsize i = 0; i < width; i++) {
+    guint16 pixel;
+    guint8 r, g, b;
 
-typedef struct {
-  guint16 b: 5;
-  guint16 g: 6;
-  guint16 r: 5;
-} rgb565;
+    memcpy (&pixel, src + i * sizeof (guint16), sizeof (guint16));
+    r = (pixel >> 10) & 0x1f;
+    g = (pixel >> 5) & 0x1f;
+    b = pixel & 0x1f;
 
-typedef struct {
-  guint32 a: 8;
-  guint32 b: 8;
-  guint32 g: 8;
-  guint32 r: 8;
-} rgba8888;
+    store_rgba (dst + i * 4, r << 3 | r >> 2, g << 3 | g >> 2, b << 3 | b >> 2);
+  }
+}
+
+static void
+convert_row_xrgb8888 (const guint8 *src,
+                      guint8       *dst,
+                      gsize         width)
+{
+  for (gsize i = 0; i < width; i++) {
+    guint32 pixel;
+
+    memcpy (&pixel, src + i * sizeof (guint32), sizeof (guint32));
+
+    store_rgba (dst + i * 4, pixel >> 16, pixel >> 8, pixel);
+  }
+}
 
-typedef rgba8888 (*GetRGBA8888) (gconstpointer pixel);
+static void
+convert_row_rgb565 (const guint8 *src,
+                    guint8       *dst,
+                    gsize         width)
+{
+  for (gsize i = 0; i < width; i++) {
+    guint16 pixel;
+    guint8 r, g, b;
+
+    memcpy (&pixel, src + i * sizeof (guint16), sizeof (guint16));
+    r = (pixel >> 11) & 0x1f;
+    g = (pixel >> 5) & 0x3f;
+    b = pixel & 0x1f;
+
+    store_rgba (dst + i * 4, r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2);
+  }
+}
+
+#ifdef RETRO_PIXDATA_X86_SIMD
+
+/*
+ * The 16 bits formats are expanded to 8 bits per channel in 16 bits lanes, red
+ * and green are then packed as the low half of each output pixel, and blue
+ * and alpha as the high half.
+ */
 
-static rgba8888
-rgba8888_from_xrgb1555 (gconstpointer data)
+__attribute__ ((target ("sse2")))
+static inline void
+store_rg_ba_sse2 (guint8  *dst,
+                  __m128i  r,
+                  __m128i  g,
+                  __m128i  b)
 {
-  xrgb1555 pixel = *(const xrgb1555 *) data;
-
-  return (rgba8888) {
-    pixel.r << 3 | pixel.r >> 2,
-    pixel.g << 3 | pixel.g >> 2,
-    pixel.b << 3 | pixel.b >> 2,
-    0xff,
-  };
+  __m128i rg = _mm_or_si128 (r, _mm_slli_epi16 (g, 8));
+  __m128i ba = _mm_or_si128 (b, _mm_set1_epi16 ((gint16) 0xff00));
+
+  _mm_storeu_si128 ((__m128i *) dst, _mm_unpacklo_epi16 (rg, ba));
+  _mm_storeu_si128 ((__m128i *) (dst + 16), _mm_unpackhi_epi16 (rg, ba));
 }
 
-static rgba8888
-rgba8888_from_xrgb8888 (gconstpointer data)
+__attribute__ ((target ("sse2")))
+static void
+convert_row_xrgb1555_sse2 (const guint8 *src,
+                           guint8       *dst,
+                           gsize         width)
 {
-  xrgb8888 pixel = *(const xrgb8888 *) data;
-
-  return (rgba8888) {
-    pixel.r,
-    pixel.g,
-    pixel.b,
-    0xff,
-  };
+  const __m128i mask5 = _mm_set1_epi16 (0x1f);
+  gsize i = 0;
+
+  for (; i + 8 <= width; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i * 2));
+    __m128i r = _mm_and_si128 (_mm_srli_epi16 (v, 10), mask5);
+    __m128i g = _mm_and_si128 (_mm_srli_epi16 (v, 5), mask5);
+    __m128i b = _mm_and_si128 (v, mask5);
+
+    r = _mm_or_si128 (_mm_slli_epi16 (r, 3), _mm_srli_epi16 (r, 2));
+    g = _mm_or_si128 (_mm_slli_epi16 (g, 3), _mm_srli_epi16 (g, 2));
+    b = _mm_or_si128 (_mm_slli_epi16 (b, 3), _mm_srli_epi16 (b, 2));
+
+    store_rg_ba_sse2 (dst + i * 4, r, g, b);
+  }
+
+  convert_row_xrgb1555 (src + i * 2, dst + i * 4, width - i);
 }
 
-static rgba8888
-rgba8888_from_rgb565 (gconstpointer data)
+__attribute__ ((target ("sse2")))
+static void
+convert_row_xrgb8888_sse2 (const guint8 *src,
+                           guint8       *dst,
+                           gsize         width)
 {
-  rgb565 pixel = *(const rgb565 *) data;
-
-  return (rgba8888) {
-    pixel.r << 3 | pixel.r >> 2,
-    pixel.g << 2 | pixel.g >> 4,
-    pixel.b << 3 | pixel.b >> 2,
-    0xff,
-  };
+  const __m128i mask_r = _mm_set1_epi32 (0xff);
+  const __m128i mask_g = _mm_set1_epi32 (0xff00);
+  const __m128i mask_b = _mm_set1_epi32 (0xff0000);
+  const __m128i alpha = _mm_set1_epi32 ((gint32) 0xff000000);
+  gsize i = 0;
+
+  for (; i + 4 <= width; i += 4) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i * 4));
+    __m128i r = _mm_and_si128 (_mm_srli_epi32 (v, 16), mask_r);
+    __m128i g = _mm_and_si128 (v, mask_g);
+    __m128i b = _mm_and_si128 (_mm_slli_epi32 (v, 16), mask_b);
+
+    v = _mm_or_si128 (_mm_or_si128 (r, g), _mm_or_si128 (b, alpha));
+    _mm_storeu_si128 ((__m128i *) (dst + i * 4), v);
+  }
+
+  convert_row_xrgb8888 (src + i * 4, dst + i * 4, width - i);
 }
 
+__attribute__ ((target ("sse2")))
+static void
+convert_row_rgb565_sse2 (const guint8 *src,
+                         guint8       *dst,
+                         gsize         width)
+{
+  const __m128i mask5 = _mm_set1_epi16 (0x1f);
+  const __m128i mask6 = _mm_set1_epi16 (0x3f);
+  gsize i = 0;
+
+  for (; i + 8 <= width; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i * 2));
+    __m128i r = _mm_srli_epi16 (v, 11);
+    __m128i g = _mm_and_si128 (_mm_srli_epi16 (v, 5), mask6);
+    __m128i b = _mm_and_si128 (v, mask5);
+
+    r = _mm_or_si128 (_mm_slli_epi16 (r, 3), _mm_srli_epi16 (r, 2));
+    g = _mm_or_si128 (_mm_slli_epi16 (g, 2), _mm_srli_epi16 (g, 4));
+    b = _mm_or_si128 (_mm_slli_epi16 (b, 3), _mm_srli_epi16 (b, 2));
+
+    store_rg_ba_sse2 (dst + i * 4, r, g, b);
+  }
+
+  convert_row_rgb565 (src + i * 2, dst + i * 4, width - i);
+}
+
+/* Unpacking works within 128 bits lanes, so the two halves of the output are
+ * put back in order before being stored. */
+__attribute__ ((target ("avx2")))
+static inline void
+store_rg_ba_avx2 (guint8  *dst,
+                  __m256i  r,
+                  __m256i  g,
+                  __m256i  b)
+{
+  __m256i rg = _mm256_or_si256 (r, _mm256_slli_epi16 (g, 8));
+  __m256i ba = _mm256_or_si256 (b, _mm256_set1_epi16 ((gint16) 0xff00));
+  __m256i lo = _mm256_unpacklo_epi16 (rg, ba);
+  __m256i hi = _mm256_unpackhi_epi16 (rg, ba);
+
+  _mm256_storeu_si256 ((__m256i *) dst, _mm256_permute2x128_si256 (lo, hi, 0x20));
+  _mm256_storeu_si256 ((__m256i *) (dst + 32), _mm256_permute2x128_si256 (lo, hi, 0x31));
+}
+
+__attribute__ ((target ("avx2")))
+static void
+convert_row_xrgb1555_avx2 (const guint8 *src,
+                           guint8       *dst,
+                           gsize         width)
+{
+  const __m256i mask5 = _mm256_set1_epi16 (0x1f);
+  gsize i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i * 2));
+    __m256i r = _mm256_and_si256 (_mm256_srli_epi16 (v, 10), mask5);
+    __m256i g = _mm256_and_si256 (_mm256_srli_epi16 (v, 5), mask5);
+    __m256i b = _mm256_and_si256 (v, mask5);
+
+    r = _mm256_or_si256 (_mm256_slli_epi16 (r, 3), _mm256_srli_epi16 (r, 2));
+    g = _mm256_or_si256 (_mm256_slli_epi16 (g, 3), _mm256_srli_epi16 (g, 2));
+    b = _mm256_or_si256 (_mm256_slli_epi16 (b, 3), _mm256_srli_epi16 (b, 2));
+
+    store_rg_ba_avx2 (dst + i * 4, r, g, b);
+  }
+
+  convert_row_xrgb1555_sse2 (src + i * 2, dst + i * 4, width - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+convert_row_xrgb8888_avx2 (const guint8 *src,
+                           guint8       *dst,
+                           gsize         width)
+{
+  const __m256i mask_r = _mm256_set1_epi32 (0xff);
+  const __m256i mask_g = _mm256_set1_epi32 (0xff00);
+  const __m256i mask_b = _mm256_set1_epi32 (0xff0000);
+  const __m256i alpha = _mm256_set1_epi32 ((gint32) 0xff000000);
+  gsize i = 0;
+
+  for (; i + 8 <= width; i += 8) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i * 4));
+    __m256i r = _mm256_and_si256 (_mm256_srli_epi32 (v, 16), mask_r);
+    __m256i g = _mm256_and_si256 (v, mask_g);
+    __m256i b = _mm256_and_si256 (_mm256_slli_epi32 (v, 16), mask_b);
+
+    v = _mm256_or_si256 (_mm256_or_si256 (r, g), _mm256_or_si256 (b, alpha));
+    _mm256_storeu_si256 ((__m256i *) (dst + i * 4), v);
+  }
+
+  convert_row_xrgb8888_sse2 (src + i * 4, dst + i * 4, width - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+convert_row_rgb565_avx2 (const guint8 *src,
+                         guint8       *dst,
+                         gsize         width)
+{
+  const __m256i mask5 = _mm256_set1_epi16 (0x1f);
+  const __m256i mask6 = _mm256_set1_epi16 (0x3f);
+  gsize i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i * 2));
+    __m256i r = _mm256_srli_epi16 (v, 11);
+    __m256i g = _mm256_and_si256 (_mm256_srli_epi16 (v, 5), mask6);
+    __m256i b = _mm256_and_si256 (v, mask5);
+
+    r = _mm256_or_si256 (_mm256_slli_epi16 (r, 3), _mm256_srli_epi16 (r, 2));
+    g = _mm256_or_si256 (_mm256_slli_epi16 (g, 2), _mm256_srli_epi16 (g, 4));
+    b = _mm256_or_si256 (_mm256_slli_epi16 (b, 3), _mm256_srli_epi16 (b, 2));
+
+    store_rg_ba_avx2 (dst + i * 4, r, g, b);
+  }
+
+  convert_row_rgb565_sse2 (src + i * 2, dst + i * 4, width - i);
+}
+
+#endif
+
+typedef struct {
+  ConvertRow xrgb1555;
+  ConvertRow xrgb8888;
+  ConvertRow rgb565;
+} Converters;
+
+/* Returns whether the converters are supported by the build and the CPU. */
 static gboolean
-get_interface_for_pixel_format (gint         pixel_format,
-                                GetRGBA8888 *get_pixel,
-                                gsize       *pixel_size)
+init_converters (Converters       *converters,
+                 RetroPixdataSimd  simd)
 {
-  switch (pixel_format) {
-  case RETRO_PIXEL_FORMAT_XRGB1555:
-    *get_pixel = rgba8888_from_xrgb1555;
-    *pixel_size = sizeof (xrgb1555);
+#ifdef RETRO_PIXDATA_X86_SIMD
+  __builtin_cpu_init ();
+#endif
+
+  switch (simd) {
+  case RETRO_PIXDATA_SIMD_NONE:
+    converters->xrgb1555 = convert_row_xrgb1555;
+    converters->xrgb8888 = convert_row_xrgb8888;
+    converters->rgb565 = convert_row_rgb565;
 
     return TRUE;
-  case RETRO_PIXEL_FORMAT_XRGB8888:
-    *get_pixel = rgba8888_from_xrgb8888;
-    *pixel_size = sizeof (rgba8888);
+#ifdef RETRO_PIXDATA_X86_SIMD
+  case RETRO_PIXDATA_SIMD_SSE2:
+    if (!__builtin_cpu_supports ("sse2"))
+      return FALSE;
+
+    converters->xrgb1555 = convert_row_xrgb1555_sse2;
+    converters->xrgb8888 = convert_row_xrgb8888_sse2;
+    converters->rgb565 = convert_row_rgb565_sse2;
 
     return TRUE;
-  case RETRO_PIXEL_FORMAT_RGB565:
-    *get_pixel = rgba8888_from_rgb565;
-    *pixel_size = sizeof (rgb565);
+  case RETRO_PIXDATA_SIMD_AVX2:
+    if (!__builtin_cpu_supports ("avx2"))
+      return FALSE;
+
+    converters->xrgb1555 = convert_row_xrgb1555_avx2;
+    converters->xrgb8888 = convert_row_xrgb8888_avx2;
+    converters->rgb565 = convert_row_rgb565_avx2;
 
     return TRUE;
+#endif
   default:
     return FALSE;
   }
 }
 
+/* Picks the fastest converters supported by the CPU, once. */
+static const Converters *
+get_converters (void)
+{
+  static Converters converters;
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    if (!init_converters (&converters, RETRO_PIXDATA_SIMD_AVX2) &&
+        !init_converters (&converters, RETRO_PIXDATA_SIMD_SSE2))
+      init_converters (&converters, RETRO_PIXDATA_SIMD_NONE);
+
+    g_once_init_leave (&initialized, 1);
+  }
+
+  return &converters;
+}
+
+static ConvertRow
+get_convert_row (const Converters *converters,
+                 RetroPixelFormat  pixel_format)
+{
+  switch (pixel_format) {
+  case RETRO_PIXEL_FORMAT_XRGB1555:
+    return converters->xrgb1555;
+  case RETRO_PIXEL_FORMAT_XRGB8888:
+    return converters->xrgb8888;
+  case RETRO_PIXEL_FORMAT_RGB565:
+    return converters->rgb565;
+  default:
+    return NULL;
+  }
+}
+
 /*
- * The destination buffer must be at least `height * width * sizeof (rgba8888)`
- * bytes long.
+ * The destination buffer must be at least `height * width * 4` bytes long.
  */
-static void
-rgba8888_from_video (gconstpointer  src,
-                     rgba8888      *dst,
-                     size_t         pixel_size,
-                     guint          width,
-                     guint          height,
-                     gsize          pitch,
-                     GetRGBA8888    get_pixel)
+static gboolean
+rgba8888_from_video (gconstpointer     src,
+                     guint8           *dst,
+                     RetroPixelFormat  pixel_format,
+                     guint             width,
+                     guint             height,
+                     gsize             pitch)
 {
-  for (gsize row = 0 ; row < height ; row++) {
-    gsize src_row = row * pitch;
-    gsize dst_row = row * width;
+  ConvertRow convert_row = get_convert_row (get_converters (), pixel_format);
 
-    for (gsize col = 0 ; col < width ; col++) {
-      gsize src_col = col * pixel_size;
+  if (convert_row == NULL)
+    return FALSE;
 
-      dst[dst_row + col] = get_pixel (src_row + src_col + src);
-    }
-  }
+  for (gsize row = 0 ; row < height ; row++)
+    convert_row ((const guint8 *) src + row * pitch, dst + row * width * 4, width);
+
+  return TRUE;
+}
+
+/*
+ * Converts a row of @width pixels to RGBA8888 with the given converters rather
+ * than the fastest ones, so they can be checked against each other.
+ *
+ * Returns: whether the converters are supported and could convert the row
+ */
+gboolean
+retro_pixdata_convert_row (RetroPixdataSimd  simd,
+                           RetroPixelFormat  pixel_format,
+                           gconstpointer     src,
+                           guint8           *dst,
+                           gsize             width)
+{
+  Converters converters;
+  ConvertRow convert_row;
+
+  if (!init_converters (&converters, simd))
+    return FALSE;
+
+  convert_row = get_convert_row (&converters, pixel_format);
+  if (convert_row == NULL)
+    return FALSE;
+
+  convert_row (src, dst, width);
+
+  return TRUE;
 }
 
 /**
@@ -324,9 +606,7 @@ retro_pixdata_get_aspect_ratio (RetroPixdata *self)
 GdkPixbuf *
 retro_pixdata_to_pixbuf (RetroPixdata *self)
 {
-  GetRGBA8888 get_pixel;
-  gsize pixel_size;
-  rgba8888 *rgba8888_data;
+  guint8 *rgba8888_data;
   GdkPixbuf *pixbuf;
   gfloat x_dpi;
   g_autofree gchar *x_dpi_string = NULL;
@@ -334,23 +614,18 @@ retro_pixdata_to_pixbuf (RetroPixdata *self)
 
   g_return_val_if_fail (self != NULL, NULL);
 
-  if (!get_interface_for_pixel_format (self->pixel_format,
-                                       &get_pixel,
-                                       &pixel_size))
-    return NULL;
-
-  rgba8888_data = g_new (rgba8888, self->width * self->height);
-  rgba8888_from_video (self->data, rgba8888_data, pixel_size,
-                       self->width, self->height, self->rowstride,
-                       get_pixel);
+  rgba8888_data = g_new (guint8, self->width * self->height * 4);
+  if (!rgba8888_from_video (self->data, rgba8888_data, self->pixel_format,
+                            self->width, self->height, self->rowstride)) {
+    g_free (rgba8888_data);
 
-  if (rgba8888_data == NULL)
     return NULL;
+  }
 
-  pixbuf = gdk_pixbuf_new_from_data ((guchar *) rgba8888_data,
+  pixbuf = gdk_pixbuf_new_from_data (rgba8888_data,
                                      GDK_COLORSPACE_RGB, TRUE, 8,
                                      self->width, self->height,
-                                     self->width * sizeof (rgba8888),
+                                     self->width * 4,
                                      (GdkPixbufDestroyNotify) g_free, NULL);
 
   /* x-dpi and y-dpi are deprecated, retro_pixbuf_get_aspect_ratio() and
@@ -399,3 +674,68 @@ retro_pixdata_load_gl_texture (RetroPixdata *self)
 
   return TRUE;
 }
+
+/**
+ * retro_pixdata_upload_gl_texture:
+ * @self: the #RetroPixdata
+ * @pixel_buffer: an OpenGL pixel buffer object to stage the pixels in, or 0
+ *
+ * Uploads @self into the currently bound texture, which must already have
+ * storage for at least the size of @self. If @pixel_buffer isn't 0, the pixels
+ * are staged in it so the driver can transfer them asynchronously.
+ *
+ * Returns: whether the upload was successful
+ */
+gboolean
+retro_pixdata_upload_gl_texture (RetroPixdata *self,
+                                 guint         pixel_buffer)
+{
+  GLenum format;
+  GLenum type;
+  gint pixel_size;
+  gsize size;
+  gconstpointer pixels;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  pixels = self->data;
+
+  if (!retro_pixel_format_to_gl (self->pixel_format, &format, &type, &pixel_size))
+    return FALSE;
+
+  size = self->rowstride * self->height;
+
+  if (pixel_buffer != 0) {
+    gpointer mapped;
+
+    glBindBuffer (GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+    /* Orphan the previous storage rather than waiting for its transfer. */
+    glBufferData (GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    mapped = glMapBufferRange (GL_PIXEL_UNPACK_BUFFER, 0, size,
+                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+    if (mapped != NULL) {
+      memcpy (mapped, self->data, size);
+      glUnmapBuffer (GL_PIXEL_UNPACK_BUFFER);
+      /* The pixels are now read from the start of the buffer. */
+      pixels = NULL;
+    }
+    else
+      glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, self->rowstride / pixel_size);
+  glTexSubImage2D (GL_TEXTURE_2D,
+                   0,
+                   0, 0,
+                   self->width,
+                   self->height,
+                   format, type,
+                   pixels);
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+
+  if (pixel_buffer != 0)
+    glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+
+  return TRUE;
+}
@@ -4,9 +4,14 @@
 
 #include <errno.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <gio/gunixfdlist.h>
+#include "retro-audio-sink-type.h"
 #include "retro-core-private.h"
+#include "retro-file-audio-sink-private.h"
+#include "retro-ipc-enum-private.h"
 #include "retro-keyboard-key-private.h"
+#include "retro-null-audio-sink-private.h"
 #ifdef PULSEAUDIO_ENABLED
 #include "retro-pa-player-private.h"
 #endif
@@ -16,11 +21,11 @@ struct _IpcRunnerImpl
   IpcRunnerSkeleton parent_instance;
 
   RetroCore *core;
-#ifdef PULSEAUDIO_ENABLED
-  RetroPaPlayer *audio_player;
-#endif
+  RetroAudioSink *audio_sink;
 
   GVariant *variables;
+  gint video_output_fd;
+  gboolean rang_video_output;
 };
 
 static void ipc_runner_iface_init (IpcRunnerIface *iface);
@@ -36,20 +41,88 @@ enum {
 
 static GParamSpec *properties [N_PROPS];
 
+static gint
+get_fd_from_handle (GUnixFDList  *fd_list,
+                    GVariant     *handle_variant,
+                    GError      **error)
+{
+  gint handle;
+
+  g_variant_get (handle_variant, "h", &handle);
+  if (G_UNLIKELY (handle >= g_unix_fd_list_get_length (fd_list))) {
+    g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                 "Invalid FD handle value");
+
+    return -1;
+  }
+
+  return g_unix_fd_list_get (fd_list, handle, error);
+}
+
+#ifdef PULSEAUDIO_ENABLED
+static RetroPaPlayer *
+create_pa_player (IpcRunnerImpl *self)
+{
+  RetroPaPlayer *player = retro_pa_player_new ();
+
+  g_object_bind_property_full (self,   "resampler-quality",
+                               player, "resampler-quality",
+                               G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL,
+                               retro_ipc_uint_to_enum, retro_ipc_enum_to_uint, NULL, NULL);
+  g_object_bind_property (self,   "dynamic-rate-control",
+                          player, "dynamic-rate-control",
+                          G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL);
+
+  return player;
+}
+#endif
+
+static RetroAudioSink *
+create_audio_sink (IpcRunnerImpl  *self,
+                   GError        **error)
+{
+  const gchar *path;
+
+  switch (ipc_runner_get_audio_sink (IPC_RUNNER (self))) {
+  case RETRO_AUDIO_SINK_TYPE_NULL:
+    return RETRO_AUDIO_SINK (retro_null_audio_sink_new ());
+  case RETRO_AUDIO_SINK_TYPE_FILE:
+    path = ipc_runner_get_audio_sink_path (IPC_RUNNER (self));
+    if (path == NULL || *path == '\0') {
+      g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                           "No path to write the audio to");
+
+      return NULL;
+    }
+
+    return RETRO_AUDIO_SINK (retro_file_audio_sink_new (path, error));
+  case RETRO_AUDIO_SINK_TYPE_PULSEAUDIO:
+  default:
+#ifdef PULSEAUDIO_ENABLED
+    return RETRO_AUDIO_SINK (create_pa_player (self));
+#else
+    g_debug ("PulseAudio isn't available, the audio will be discarded.");
+
+    return RETRO_AUDIO_SINK (retro_null_audio_sink_new ());
+#endif
+  }
+}
+
 static gboolean
 ipc_runner_impl_handle_boot (IpcRunner             *runner,
                              GDBusMethodInvocation *invocation,
                              GUnixFDList           *fd_list,
                              GVariant              *defaults,
                              const gchar * const   *medias,
-                             GVariant              *default_controller)
+                             GVariant              *controller_state,
+                             GVariant              *video_output)
 {
   IpcRunnerImpl *self = IPC_RUNNER_IMPL (runner);
   g_autoptr(GError) error = NULL;
   g_autoptr(GUnixFDList) out_fd_list = NULL;
   g_autoptr (GVariantIter) iter = NULL;
   gchar *key, *value;
-  gint handle, fd;
+  gint handle, audio_queue_handle, fd;
 
   g_variant_get (defaults, "a(ss)", &iter);
 
@@ -58,24 +131,40 @@ ipc_runner_impl_handle_boot (IpcRunner             *runner,
 
   retro_core_set_medias (self->core, medias);
 
-  g_variant_get (default_controller, "h", &handle);
-  if (G_LIKELY (handle < g_unix_fd_list_get_length (fd_list))) {
-    fd = g_unix_fd_list_get (fd_list, handle, &error);
-    if (error) {
-      g_dbus_method_invocation_return_gerror (g_steal_pointer (&invocation), error);
+  /* The sink is picked once and for all when booting. */
+  if (self->audio_sink != NULL) {
+    retro_audio_sink_set_core (self->audio_sink, NULL);
+    g_clear_object (&self->audio_sink);
+  }
 
-      return TRUE;
-    }
-  } else {
-    g_dbus_method_invocation_return_error (g_steal_pointer (&invocation),
-                                           G_DBUS_ERROR,
-                                           G_DBUS_ERROR_INVALID_ARGS,
-                                           "Invalid FD handle value");
+  self->audio_sink = create_audio_sink (self, &error);
+  if (error) {
+    g_dbus_method_invocation_return_gerror (g_steal_pointer (&invocation), error);
+
+    return TRUE;
+  }
+
+  retro_audio_sink_set_core (self->audio_sink, self->core);
+
+  fd = get_fd_from_handle (fd_list, controller_state, &error);
+  if (error) {
+    g_dbus_method_invocation_return_gerror (g_steal_pointer (&invocation), error);
+
+    return TRUE;
+  }
+
+  if (self->video_output_fd >= 0)
+    close (self->video_output_fd);
+
+  self->video_output_fd = get_fd_from_handle (fd_list, video_output, &error);
+  if (error) {
+    close (fd);
+    g_dbus_method_invocation_return_gerror (g_steal_pointer (&invocation), error);
 
     return TRUE;
   }
 
-  retro_core_set_default_controller (self->core, fd);
+  retro_core_set_controller_state (self->core, fd);
   retro_core_boot (self->core, &error);
   if (error) {
     g_dbus_method_invocation_return_gerror (g_steal_pointer (&invocation), error);
@@ -103,8 +192,18 @@ ipc_runner_impl_handle_boot (IpcRunner             *runner,
     return TRUE;
   }
 
+  fd = retro_core_get_audio_queue_fd (self->core);
+  audio_queue_handle = g_unix_fd_list_append (out_fd_list, fd, &error);
+  if (error) {
+    g_dbus_method_invocation_return_gerror (g_steal_pointer (&invocation), error);
+    g_variant_unref (self->variables);
+
+    return TRUE;
+  }
+
   ipc_runner_complete_boot (runner, invocation, out_fd_list,
-                            self->variables, g_variant_new ("h", handle));
+                            self->variables, g_variant_new ("h", handle),
+                            g_variant_new ("h", audio_queue_handle));
 
   g_variant_unref (self->variables);
 
@@ -243,6 +342,62 @@ ipc_runner_impl_handle_load_state (IpcRunner             *runner,
   return TRUE;
 }
 
+static gboolean
+ipc_runner_impl_handle_record_movie (IpcRunner             *runner,
+                                     GDBusMethodInvocation *invocation,
+                                     const gchar           *filename,
+                                     gboolean               from_state)
+{
+  IpcRunnerImpl *self = IPC_RUNNER_IMPL (runner);
+  g_autoptr(GError) error = NULL;
+
+  retro_core_record_movie (self->core, filename, from_state, &error);
+
+  if (error) {
+    g_dbus_method_invocation_return_gerror (g_steal_pointer (&invocation), error);
+
+    return TRUE;
+  }
+
+  ipc_runner_complete_record_movie (runner, invocation);
+
+  return TRUE;
+}
+
+static gboolean
+ipc_runner_impl_handle_play_movie (IpcRunner             *runner,
+                                   GDBusMethodInvocation *invocation,
+                                   const gchar           *filename)
+{
+  IpcRunnerImpl *self = IPC_RUNNER_IMPL (runner);
+  g_autoptr(GError) error = NULL;
+
+  retro_core_play_movie (self->core, filename, &error);
+
+  if (error) {
+    g_dbus_method_invocation_return_gerror (g_steal_pointer (&invocation), error);
+
+    return TRUE;
+  }
+
+  ipc_runner_complete_play_movie (runner, invocation);
+
+  return TRUE;
+}
+
+static gboolean
+ipc_runner_impl_handle_stop_movie (IpcRunner             *runner,
+                                   GDBusMethodInvocation *invocation)
+{
+  IpcRunnerImpl *self = IPC_RUNNER_IMPL (runner);
+
+  retro_core_stop_movie (self->core);
+
+  ipc_runner_complete_stop_movie (runner, invocation);
+
+  return TRUE;
+}
+
 static gboolean
 ipc_runner_impl_handle_get_memory_size (IpcRunner             *runner,
                                         GDBusMethodInvocation *invocation,
@@ -320,41 +475,14 @@ ipc_runner_impl_handle_update_variable (IpcRunner             *runner,
 static gboolean
 ipc_runner_handle_set_controller (IpcRunner             *runner,
                                   GDBusMethodInvocation *invocation,
-                                  GUnixFDList           *fd_list,
                                   guint                  port,
-                                  RetroControllerType    type,
-                                  GVariant              *data_handle)
+                                  RetroControllerType    type)
 {
   IpcRunnerImpl *self = IPC_RUNNER_IMPL (runner);
-  gint fd;
-
-  if (type != RETRO_CONTROLLER_TYPE_NONE) {
-    g_autoptr(GError) error = NULL;
-    gint handle;
-
-    g_variant_get (data_handle, "h", &handle);
-    if (G_LIKELY (handle < g_unix_fd_list_get_length (fd_list))) {
-      fd = g_unix_fd_list_get (fd_list, handle, &error);
-      if (error) {
-        g_dbus_method_invocation_return_gerror (g_steal_pointer (&invocation), error);
-
-        return TRUE;
-      }
-    } else {
-      g_dbus_method_invocation_return_error (g_steal_pointer (&invocation),
-                                             G_DBUS_ERROR,
-                                             G_DBUS_ERROR_INVALID_ARGS,
-                                             "Invalid FD handle value");
-
-      return TRUE;
-    }
-  }
-  else
-    fd = -1;
 
-  retro_core_set_controller (self->core, port, type, fd);
+  retro_core_set_controller (self->core, port, type);
 
-  ipc_runner_complete_set_controller (runner, invocation, NULL);
+  ipc_runner_complete_set_controller (runner, invocation);
 
   return TRUE;
 }
@@ -435,11 +563,40 @@ message_cb (RetroCore     *core,
   ipc_runner_emit_message (IPC_RUNNER (self), message, frames);
 }
 
+/* Ring the doorbell rather than emitting a D-Bus signal for every frame, the
+ * UI will fetch the latest frame from the shared framebuffer. */
+static void
+ring_doorbell (IpcRunnerImpl *self)
+{
+  guint64 count = 1;
+
+  if (G_UNLIKELY (self->video_output_fd < 0))
+    return;
+
+  /* EAGAIN means the counter is saturated, the UI will be notified anyway. */
+  if (write (self->video_output_fd, &count, sizeof (count)) < 0 && errno != EAGAIN)
+    g_critical ("Couldn't notify video output: %s", g_strerror (errno));
+}
+
 static void
 video_output_cb (RetroCore     *core,
                  IpcRunnerImpl *self)
 {
-  ipc_runner_emit_video_output (IPC_RUNNER (self));
+  ring_doorbell (self);
+  self->rang_video_output = TRUE;
+}
+
+/* The UI reads the shared audio queue when woken up by the doorbell, so only
+ * ring it for audio if no frame did already during the iteration. */
+static void
+iterated_cb (RetroCore     *core,
+             IpcRunnerImpl *self)
+{
+  if (!self->rang_video_output && !core->block_video_signal &&
+      retro_core_has_pending_audio (core))
+    ring_doorbell (self);
+
+  self->rang_video_output = FALSE;
 }
 
 static void
@@ -486,10 +643,7 @@ ipc_runner_impl_constructed (GObject *object)
 {
   IpcRunnerImpl *self = (IpcRunnerImpl *)object;
 
-#ifdef PULSEAUDIO_ENABLED
-  self->audio_player = retro_pa_player_new ();
-  retro_pa_player_set_core (self->audio_player, self->core);
-#endif
+  ipc_runner_set_dynamic_rate_control (IPC_RUNNER (self), TRUE);
 
   g_object_bind_property (self->core, "api-version",
                           self,       "api-version",
@@ -518,11 +672,16 @@ ipc_runner_impl_constructed (GObject *object)
   g_object_bind_property (self->core, "runahead",
                           self,       "runahead",
                           G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL);
+  g_object_bind_property (self->core, "detect-duplicate-frames",
+                          self,       "detect-duplicate-frames",
+                          G_BINDING_SYNC_CREATE | G_BINDING_BIDIRECTIONAL);
 
   g_signal_connect (self->core, "message",
                     G_CALLBACK (message_cb), self);
   g_signal_connect (self->core, "video-output",
                     G_CALLBACK (video_output_cb), self);
+  g_signal_connect (self->core, "iterated",
+                    G_CALLBACK (iterated_cb), self);
   g_signal_connect (self->core, "log",
                     G_CALLBACK (log_cb), self);
   g_signal_connect (self->core, "variables-set",
@@ -540,10 +699,15 @@ ipc_runner_impl_finalize (GObject *object)
 
   g_signal_handlers_disconnect_by_data (self->core, self);
 
+  if (self->audio_sink != NULL) {
+    retro_audio_sink_set_core (self->audio_sink, NULL);
+    g_object_unref (self->audio_sink);
+  }
+
   g_object_unref (self->core);
-#ifdef PULSEAUDIO_ENABLED
-  g_object_unref (self->audio_player);
-#endif
+
+  if (self->video_output_fd >= 0)
+    close (self->video_output_fd);
 
   G_OBJECT_CLASS (ipc_runner_impl_parent_class)->finalize (object);
 }
@@ -562,6 +726,9 @@ ipc_runner_iface_init (IpcRunnerIface *iface)
   iface->handle_get_can_access_state = ipc_runner_impl_handle_get_can_access_state;
   iface->handle_save_state = ipc_runner_impl_handle_save_state;
   iface->handle_load_state = ipc_runner_impl_handle_load_state;
+  iface->handle_record_movie = ipc_runner_impl_handle_record_movie;
+  iface->handle_play_movie = ipc_runner_impl_handle_play_movie;
+  iface->handle_stop_movie = ipc_runner_impl_handle_stop_movie;
   iface->handle_get_memory_size = ipc_runner_impl_handle_get_memory_size;
   iface->handle_save_memory = ipc_runner_impl_handle_save_memory;
   iface->handle_load_memory = ipc_runner_impl_handle_load_memory;
@@ -599,6 +766,7 @@ ipc_runner_impl_class_init (IpcRunnerImplClass *klass)
 static void
 ipc_runner_impl_init (IpcRunnerImpl *self)
 {
+  self->video_output_fd = -1;
 }
 
 IpcRunnerImpl *
@@ -0,0 +1,22 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _RetroAudioRing RetroAudioRing;
+
+RetroAudioRing *retro_audio_ring_new (gsize n_frames);
+void retro_audio_ring_free (RetroAudioRing *self);
+gsize retro_audio_ring_get_n_readable (RetroAudioRing *self);
+gint16 *retro_audio_ring_begin_write (RetroAudioRing *self,
+                                      gsize          *n_frames);
+void retro_audio_ring_end_write (RetroAudioRing *self,
+                                 gsize           n_frames);
+gsize retro_audio_ring_read (RetroAudioRing *self,
+                             gint16         *frames,
+                             gsize           n_frames);
+
+G_END_DECLS
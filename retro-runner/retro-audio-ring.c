@@ -0,0 +1,128 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#include "retro-audio-ring-private.h"
+
+#include <string.h>
+
+/* A lock-free ring of interleaved stereo frames, for a single producer and a
+ * single consumer running on different threads.
+ *
+ * The read and write counters only ever increase, wrapping around, and their
+ * difference is the number of readable frames. The capacity being a power of
+ * two, they are turned into positions in the ring by masking them. */
+struct _RetroAudioRing
+{
+  gint16 *data;
+  guint mask;
+  volatile guint read_count;
+  volatile guint write_count;
+};
+
+RetroAudioRing *
+retro_audio_ring_new (gsize n_frames)
+{
+  RetroAudioRing *self;
+  guint capacity = 1;
+
+  g_return_val_if_fail (n_frames > 0 && n_frames <= G_MAXINT / 2, NULL);
+
+  while (capacity < n_frames)
+    capacity <<= 1;
+
+  self = g_new0 (RetroAudioRing, 1);
+  self->data = g_new0 (gint16, capacity * 2);
+  self->mask = capacity - 1;
+
+  return self;
+}
+
+void
+retro_audio_ring_free (RetroAudioRing *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_free (self->data);
+  g_free (self);
+}
+
+gsize
+retro_audio_ring_get_n_readable (RetroAudioRing *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return (guint) g_atomic_int_get (&self->write_count) -
+         (guint) g_atomic_int_get (&self->read_count);
+}
+
+/* Copies n_frames frames from the ring to a linear buffer, starting at the
+ * frame counted as count and wrapping around the end of the ring. */
+static void
+copy_frames (RetroAudioRing *self,
+             guint           count,
+             gint16         *frames,
+             gsize           n_frames)
+{
+  gsize position = count & self->mask;
+  gsize n_first = MIN (n_frames, self->mask + 1 - position);
+  gint16 *ring_first = self->data + position * 2;
+
+  memcpy (frames, ring_first, n_first * 2 * sizeof (gint16));
+  memcpy (frames + n_first * 2, self->data, (n_frames - n_first) * 2 * sizeof (gint16));
+}
+
+/* To be called by the producer only, to write frames in place. Returns where
+ * to write the frames, and sets n_frames to the number of frames which can be
+ * written contiguously there. */
+gint16 *
+retro_audio_ring_begin_write (RetroAudioRing *self,
+                              gsize          *n_frames)
+{
+  guint write_count;
+  gsize position, n_writable;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (n_frames != NULL, NULL);
+
+  write_count = self->write_count;
+  position = write_count & self->mask;
+  n_writable = self->mask + 1 - (write_count - (guint) g_atomic_int_get (&self->read_count));
+
+  *n_frames = MIN (n_writable, self->mask + 1 - position);
+
+  return self->data + position * 2;
+}
+
+/* Publishes n_frames frames written in place since
+ * retro_audio_ring_begin_write(). */
+void
+retro_audio_ring_end_write (RetroAudioRing *self,
+                            gsize           n_frames)
+{
+  g_return_if_fail (self != NULL);
+
+  g_atomic_int_set (&self->write_count, self->write_count + n_frames);
+}
+
+/* To be called by the consumer only. Returns the number of frames read. */
+gsize
+retro_audio_ring_read (RetroAudioRing *self,
+                       gint16         *frames,
+                       gsize           n_frames)
+{
+  guint read_count;
+  gsize n_readable;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (frames != NULL || n_frames == 0, 0);
+
+  read_count = self->read_count;
+  n_readable = (guint) g_atomic_int_get (&self->write_count) - read_count;
+  n_frames = MIN (n_frames, n_readable);
+
+  copy_frames (self, read_count, frames, n_frames);
+
+  /* Release the room only once the frames are read. */
+  g_atomic_int_set (&self->read_count, read_count + n_frames);
+
+  return n_frames;
+}
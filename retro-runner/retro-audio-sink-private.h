@@ -0,0 +1,48 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#pragma once
+
+#if !defined(__RETRO_GTK_INSIDE__) && !defined(RETRO_GTK_COMPILATION)
+# error "Only <retro-gtk.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+#include "retro-audio-queue-private.h"
+
+G_BEGIN_DECLS
+
+// FIXME Remove as soon as possible.
+typedef struct _RetroCore RetroCore;
+
+#define RETRO_TYPE_AUDIO_SINK (retro_audio_sink_get_type())
+
+G_DECLARE_INTERFACE (RetroAudioSink, retro_audio_sink, RETRO, AUDIO_SINK, GObject)
+
+struct _RetroAudioSinkInterface
+{
+  GTypeInterface parent_iface;
+
+  /* Plugs the sink to a core, or unplugs it if core is NULL. */
+  void (*set_core) (RetroAudioSink *self,
+                    RetroCore      *core);
+  /* Receives the interleaved stereo frames a core produced during an
+   * iteration, at once. */
+  void (*audio_output) (RetroAudioSink *self,
+                        const gint16   *frames,
+                        gsize           n_frames,
+                        gdouble         sample_rate);
+  /* Optional, fills in the statistics the sink knows about. */
+  void (*get_stats) (RetroAudioSink  *self,
+                     RetroAudioStats *stats);
+};
+
+void retro_audio_sink_set_core (RetroAudioSink *self,
+                                RetroCore      *core);
+void retro_audio_sink_audio_output (RetroAudioSink *self,
+                                    const gint16   *frames,
+                                    gsize           n_frames,
+                                    gdouble         sample_rate);
+void retro_audio_sink_get_stats (RetroAudioSink  *self,
+                                 RetroAudioStats *stats);
+
+G_END_DECLS
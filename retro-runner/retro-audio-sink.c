@@ -0,0 +1,73 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#include "retro-audio-sink-private.h"
+
+G_DEFINE_INTERFACE (RetroAudioSink, retro_audio_sink, G_TYPE_OBJECT);
+
+static void
+retro_audio_sink_default_init (RetroAudioSinkInterface *iface)
+{
+}
+
+/**
+ * retro_audio_sink_set_core:
+ * @self: a #RetroAudioSink
+ * @core: (nullable): a #RetroCore, or %NULL
+ *
+ * Sets @core as the #RetroCore whose audio @self receives.
+ */
+void
+retro_audio_sink_set_core (RetroAudioSink *self,
+                           RetroCore      *core)
+{
+  RetroAudioSinkInterface *iface;
+
+  g_return_if_fail (RETRO_IS_AUDIO_SINK (self));
+
+  iface = RETRO_AUDIO_SINK_GET_IFACE (self);
+
+  g_return_if_fail (iface->set_core != NULL);
+
+  iface->set_core (self, core);
+}
+
+void
+retro_audio_sink_audio_output (RetroAudioSink *self,
+                               const gint16   *frames,
+                               gsize           n_frames,
+                               gdouble         sample_rate)
+{
+  RetroAudioSinkInterface *iface;
+
+  g_return_if_fail (RETRO_IS_AUDIO_SINK (self));
+  g_return_if_fail (frames != NULL || n_frames == 0);
+
+  iface = RETRO_AUDIO_SINK_GET_IFACE (self);
+
+  g_return_if_fail (iface->audio_output != NULL);
+
+  iface->audio_output (self, frames, n_frames, sample_rate);
+}
+
+/**
+ * retro_audio_sink_get_stats:
+ * @self: a #RetroAudioSink
+ * @stats: the statistics to fill in
+ *
+ * Fills in the statistics of the audio path @self knows about, leaving the
+ * other ones untouched.
+ */
+void
+retro_audio_sink_get_stats (RetroAudioSink  *self,
+                            RetroAudioStats *stats)
+{
+  RetroAudioSinkInterface *iface;
+
+  g_return_if_fail (RETRO_IS_AUDIO_SINK (self));
+  g_return_if_fail (stats != NULL);
+
+  iface = RETRO_AUDIO_SINK_GET_IFACE (self);
+
+  if (iface->get_stats != NULL)
+    iface->get_stats (self, stats);
+}
@@ -6,6 +6,8 @@
 # error "Only <retro-gtk.h> can be included directly."
 #endif
 
+#include "retro-audio-sink-private.h"
+#include "retro-audio-queue-private.h"
 #include "retro-controller-state-private.h"
 #include "retro-core.h"
 #include "retro-disk-control-callback-private.h"
@@ -13,10 +15,12 @@
 #include "retro-input.h"
 #include "retro-input-descriptor-private.h"
 #include "retro-module-private.h"
+#include "retro-movie-private.h"
 #include "retro-pixel-format-private.h"
 #include "retro-renderer-private.h"
 #include "retro-rotation-private.h"
 #include "retro-variable-private.h"
+#include <stdbool.h>
 
 G_BEGIN_DECLS
 
@@ -24,6 +28,15 @@ typedef struct {
   void (*callback) (guchar down, guint keycode, guint32 character, guint16 key_modifiers);
 } RetroKeyboardCallback;
 
+typedef struct {
+  void (*callback) (void);
+  void (*set_state) (bool enabled);
+} RetroAudioCallback;
+
+typedef void (*RetroAudioPullFunc) (const gint16 *frames,
+                                    gsize         n_frames,
+                                    gpointer      user_data);
+
 struct _RetroCore
 {
   GObject parent_instance;
@@ -47,16 +60,38 @@ struct _RetroCore
   RetroRotation rotation;
   gdouble sample_rate;
 
+  /* Interleaved stereo frames, collected during an iteration and handed to the
+   * audio sink at its end. */
+  RetroAudioSink *audio_sink;
+  gint16 *audio_buffer;
+  gsize audio_buffer_length;
+  gsize audio_buffer_capacity;
+
+  /* Set by cores producing their audio asynchronously, when asked to by the
+   * audio sink's thread rather than during iterations. */
+  RetroAudioCallback audio_callback;
+  volatile gint audio_callback_enabled;
+  /* Held while the audio callback is being pulled, so disabling it can wait
+   * for the pull in flight to finish. */
+  GMutex audio_pull_lock;
+
+  /* The audio of each iteration is also shared with the UI process, along
+   * with statistics about the audio path. */
+  RetroAudioQueue *audio_queue;
+  gdouble audio_frames_per_iteration;
+  gint64 audio_blocked_time;
+
   RetroFramebuffer *framebuffer;
   RetroRenderer *renderer;
   RetroKeyboardCallback keyboard_callback;
-  RetroControllerState *default_controller;
-  GHashTable *controllers;
+  RetroControllerState *controller_state;
+  RetroMovie *movie;
   GHashTable *variables;
   GHashTable *variable_overrides;
   gboolean variable_updated;
   guint runahead;
   gssize run_remaining;
+  gboolean is_speculating;
   gdouble speed_rate;
   glong main_loop;
 
@@ -86,7 +121,21 @@ void retro_core_insert_variable (RetroCore           *self,
                                  const RetroVariable *variable);
 gboolean retro_core_get_variable_update (RetroCore *self);
 gdouble retro_core_get_sample_rate (RetroCore *self);
+void retro_core_set_audio_sink (RetroCore      *self,
+                                RetroAudioSink *audio_sink);
+void retro_core_push_audio_frames (RetroCore    *self,
+                                   const gint16 *frames,
+                                   gsize         n_frames);
+gboolean retro_core_push_pulled_audio_frames (RetroCore    *self,
+                                              const gint16 *frames,
+                                              gsize         n_frames);
+gboolean retro_core_has_audio_callback (RetroCore *self);
+gsize retro_core_pull_audio (RetroCore          *self,
+                             RetroAudioPullFunc  func,
+                             gpointer            user_data);
 
 gint retro_core_get_framebuffer_fd (RetroCore *self);
+gint retro_core_get_audio_queue_fd (RetroCore *self);
+gboolean retro_core_has_pending_audio (RetroCore *self);
 
 G_END_DECLS
@@ -3,14 +3,19 @@
 #include "retro-core-private.h"
 
 #include <gio/gio.h>
+#include <math.h>
 #include <string.h>
 #include "retro-input-private.h"
 #include "retro-main-loop-source-private.h"
 #include "retro-memfd-private.h"
+#include "retro-movie-private.h"
 #include "retro-rumble-effect.h"
 
 #define RETRO_CORE_ERROR (retro_core_error_quark ())
 
+/* How much the latest iteration weighs in the smoothed audio statistics. */
+#define AUDIO_STATS_SMOOTHING (1.0 / 16.0)
+
 enum {
   RETRO_CORE_ERROR_COULDNT_ACCESS_FILE,
   RETRO_CORE_ERROR_COULDNT_SERIALIZE,
@@ -39,6 +44,7 @@ enum {
   PROP_FRAMES_PER_SECOND,
   PROP_RUNAHEAD,
   PROP_SPEED_RATE,
+  PROP_DETECT_DUPLICATE_FRAMES,
   N_PROPS,
 };
 
@@ -46,7 +52,6 @@ static GParamSpec *properties [N_PROPS];
 
 enum {
   SIGNAL_VIDEO_OUTPUT,
-  SIGNAL_AUDIO_OUTPUT,
   SIGNAL_ITERATED,
   SIGNAL_LOG,
   SIGNAL_SHUTDOWN,
@@ -60,8 +65,19 @@ static guint signals[N_SIGNALS];
 
 static RetroCore *retro_core_instance = NULL;
 
+typedef struct {
+  RetroAudioPullFunc func;
+  gpointer user_data;
+  gsize n_frames;
+} RetroAudioPull;
+
+/* Set while the audio callback is called on the current thread, so the audio
+ * it produces is routed to the puller rather than to the iteration's buffer. */
+static GPrivate audio_pull;
+
 static void set_filename (RetroCore   *self,
                           const gchar *filename);
+static gboolean stop_main_loop (RetroCore *self);
 
 /* Private */
 
@@ -97,6 +113,9 @@ retro_core_constructed (GObject *object)
   memfd = retro_memfd_create ("[retro-runner framebuffer]");
   self->framebuffer = retro_framebuffer_new (memfd);
 
+  memfd = retro_memfd_create ("[retro-runner audio queue]");
+  self->audio_queue = retro_audio_queue_new (memfd);
+
   G_OBJECT_CLASS (retro_core_parent_class)->constructed (object);
 }
 
@@ -107,7 +126,7 @@ retro_core_finalize (GObject *object)
   RetroUnloadGame unload_game;
   RetroDeinit deinit;
 
-  retro_core_stop (self);
+  stop_main_loop (self);
 
   if (retro_core_get_game_loaded (self)) {
     unload_game = retro_module_get_unload_game (self->module);
@@ -120,8 +139,9 @@ retro_core_finalize (GObject *object)
 
   g_object_unref (self->module);
   g_object_unref (self->framebuffer);
-  g_clear_object (&self->default_controller);
-  g_hash_table_unref (self->controllers);
+  g_object_unref (self->audio_queue);
+  g_clear_object (&self->controller_state);
+  g_clear_object (&self->movie);
   g_hash_table_unref (self->variables);
   g_hash_table_unref (self->variable_overrides);
 
@@ -130,6 +150,8 @@ retro_core_finalize (GObject *object)
   g_free (self->libretro_path);
   g_free (self->content_directory);
   g_free (self->save_directory);
+  g_free (self->audio_buffer);
+  g_mutex_clear (&self->audio_pull_lock);
   g_clear_object (&self->renderer);
 
   G_OBJECT_CLASS (retro_core_parent_class)->finalize (object);
@@ -183,6 +205,10 @@ retro_core_get_property (GObject    *object,
   case PROP_SPEED_RATE:
     g_value_set_double (value, retro_core_get_speed_rate (self));
 
+    break;
+  case PROP_DETECT_DUPLICATE_FRAMES:
+    g_value_set_boolean (value, retro_core_get_detect_duplicate_frames (self));
+
     break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -223,6 +249,10 @@ retro_core_set_property (GObject      *object,
   case PROP_SPEED_RATE:
     retro_core_set_speed_rate (self, g_value_get_double (value));
 
+    break;
+  case PROP_DETECT_DUPLICATE_FRAMES:
+    retro_core_set_detect_duplicate_frames (self, g_value_get_boolean (value));
+
     break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -421,6 +451,22 @@ retro_core_class_init (RetroCoreClass *klass)
                          G_PARAM_STATIC_NICK |
                          G_PARAM_STATIC_BLURB);
 
+  /**
+   * RetroCore:detect-duplicate-frames:
+   *
+   * Whether to compare the content of each video frame with the previous one
+   * and to drop it if they are identical, as if the core duped the frame.
+   */
+  properties[PROP_DETECT_DUPLICATE_FRAMES] =
+    g_param_spec_boolean ("detect-duplicate-frames",
+                          "Detect duplicate frames",
+                          "Whether to drop video frames identical to the previous one",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_NAME |
+                          G_PARAM_STATIC_NICK |
+                          G_PARAM_STATIC_BLURB);
+
   g_object_class_install_properties (G_OBJECT_CLASS (klass), N_PROPS, properties);
 
   /**
@@ -436,26 +482,6 @@ retro_core_class_init (RetroCoreClass *klass)
                   G_TYPE_NONE,
                   0);
 
-  /**
-   * RetroCore::audio-output:
-   * @self: the #RetroCore
-   * @data: (array length=length) (element-type guint8): the audio frame data
-   * @length: the lentgh of @data
-   * @sample_rate: the sample rate to play the frame
-   *
-   * The ::audio-output signal is emitted each time a new audio frame is emitted
-   * by the core.
-   */
-  signals[SIGNAL_AUDIO_OUTPUT] =
-    g_signal_new ("audio-output", RETRO_TYPE_CORE, G_SIGNAL_RUN_LAST,
-                  0, NULL, NULL,
-                  NULL,
-                  G_TYPE_NONE,
-                  3,
-                  G_TYPE_POINTER,
-                  G_TYPE_ULONG,
-                  G_TYPE_DOUBLE);
-
   /**
    * RetroCore::iterated:
    * @self: the #RetroCore
@@ -573,11 +599,10 @@ retro_core_init (RetroCore *self)
   self->variable_overrides = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                     g_free, g_free);
 
-  self->controllers = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-                                             NULL, g_object_unref);
-
   self->main_loop = -1;
   self->speed_rate = 1;
+
+  g_mutex_init (&self->audio_pull_lock);
 }
 
 static void
@@ -649,10 +674,21 @@ restart (RetroCore *self)
   if (self->main_loop < 0)
     return;
 
-  retro_core_stop (self);
+  stop_main_loop (self);
   retro_core_run (self);
 }
 
+static void
+reserve_audio_buffer (RetroCore *self,
+                      gsize      n_frames)
+{
+  if (n_frames <= self->audio_buffer_capacity)
+    return;
+
+  self->audio_buffer = g_renew (gint16, self->audio_buffer, n_frames * 2);
+  self->audio_buffer_capacity = n_frames;
+}
+
 void
 retro_core_set_system_av_info (RetroCore         *self,
                                RetroSystemAvInfo *system_av_info)
@@ -664,6 +700,20 @@ retro_core_set_system_av_info (RetroCore         *self,
   }
   retro_core_set_geometry (self, &system_av_info->geometry);
   self->sample_rate = system_av_info->timing.sample_rate;
+
+  /* Reserve room for twice the audio of a frame, so the audio callbacks don't
+   * have to allocate unless a core produces uneven amounts of audio. */
+  if (self->frames_per_second > 0.0)
+    reserve_audio_buffer (self, 2 * (gsize) ceil (self->sample_rate /
+                                                  self->frames_per_second));
+
+  /* Reserve room for the biggest frames the core can output, using the widest
+   * pixel format as cores are free to pick any pitch. Geometry changes within
+   * these bounds then only update the frame metadata. */
+  retro_framebuffer_reserve (self->framebuffer,
+                             (gsize) system_av_info->geometry.max_width *
+                             system_av_info->geometry.max_height *
+                             sizeof (guint32));
 }
 
 void
@@ -1030,6 +1080,30 @@ retro_core_get_framebuffer_fd (RetroCore *self)
   return retro_framebuffer_get_fd (self->framebuffer);
 }
 
+gint
+retro_core_get_audio_queue_fd (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), 0);
+
+  return retro_audio_queue_get_fd (self->audio_queue);
+}
+
+/**
+ * retro_core_has_pending_audio:
+ * @self: a #RetroCore
+ *
+ * Gets whether the UI process didn't read all the audio shared with it yet.
+ *
+ * Returns: whether there is pending audio
+ */
+gboolean
+retro_core_has_pending_audio (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), FALSE);
+
+  return retro_audio_queue_has_pending (self->audio_queue);
+}
+
 /* Public */
 
 /**
@@ -1373,30 +1447,24 @@ retro_core_set_current_media (RetroCore  *self,
 }
 
 void
-retro_core_set_default_controller (RetroCore *self,
-                                   gint       fd)
+retro_core_set_controller_state (RetroCore *self,
+                                 gint       fd)
 {
   g_return_if_fail (RETRO_IS_CORE (self));
 
-  g_set_object (&self->default_controller, retro_controller_state_new (fd));
+  g_clear_object (&self->controller_state);
+  self->controller_state = retro_controller_state_new (fd);
 }
 
 void
 retro_core_set_controller (RetroCore           *self,
                            guint                port,
-                           RetroControllerType  controller_type,
-                           gint                 fd)
+                           RetroControllerType  controller_type)
 {
   RetroSetControllerPortDevice set_controller_port_device;
 
   g_return_if_fail (RETRO_IS_CORE (self));
 
-  if (controller_type == RETRO_CONTROLLER_TYPE_NONE)
-    g_hash_table_remove (self->controllers, GUINT_TO_POINTER (port));
-  else
-    g_hash_table_insert (self->controllers, GUINT_TO_POINTER (port),
-                         retro_controller_state_new (fd));
-
   set_controller_port_device = retro_module_get_set_controller_port_device (self->module);
   set_controller_port_device (port, controller_type);
 }
@@ -1405,17 +1473,12 @@ gboolean
 retro_core_get_controller_supports_rumble (RetroCore *self,
                                            guint      port)
 {
-  RetroControllerState *controller;
-
   g_return_val_if_fail (RETRO_IS_CORE (self), FALSE);
 
-  if (!g_hash_table_contains (self->controllers, GUINT_TO_POINTER (port)))
+  if (self->controller_state == NULL)
     return FALSE;
 
-  controller = g_hash_table_lookup (self->controllers, GUINT_TO_POINTER (port));
-  g_return_val_if_fail (controller != NULL, FALSE);
-
-  return retro_controller_state_get_supports_rumble (controller);
+  return retro_controller_state_get_supports_rumble (self->controller_state, port);
 }
 
 void
@@ -1430,6 +1493,16 @@ retro_core_send_input_key_event (RetroCore                *self,
   if (self->keyboard_callback.callback == NULL)
     return;
 
+  /* A movie being played back drives the core alone. */
+  if (self->movie != NULL && !retro_movie_get_is_recording (self->movie))
+    return;
+
+  if (self->movie != NULL) {
+    RetroMovieKeyEvent event = { down, keycode, character, key_modifiers };
+
+    retro_movie_record_key_event (self->movie, &event);
+  }
+
   self->keyboard_callback.callback (down, keycode, character, key_modifiers);
 }
 
@@ -1444,6 +1517,26 @@ run_main_loop (RetroCore *self)
   return TRUE;
 }
 
+static void
+set_audio_callback_state (RetroCore *self,
+                          gboolean   enabled)
+{
+  if (self->audio_callback.callback == NULL)
+    return;
+
+  if (g_atomic_int_get (&self->audio_callback_enabled) == enabled)
+    return;
+
+  /* When disabling, wait for the audio sink to be done with any pull in
+   * flight, so the core isn't running its audio callback once stopped. */
+  g_mutex_lock (&self->audio_pull_lock);
+  g_atomic_int_set (&self->audio_callback_enabled, enabled);
+  g_mutex_unlock (&self->audio_pull_lock);
+
+  if (self->audio_callback.set_state != NULL)
+    self->audio_callback.set_state (enabled);
+}
+
 /**
  * retro_core_run:
  * @self: a #RetroCore
@@ -1471,6 +1564,22 @@ retro_core_run (RetroCore *self)
   source = retro_main_loop_source_new (fps * self->speed_rate);
   g_source_set_callback (source, (GSourceFunc) run_main_loop, self, NULL);
   self->main_loop = g_source_attach (source, g_main_context_default ());
+
+  set_audio_callback_state (self, TRUE);
+}
+
+static gboolean
+stop_main_loop (RetroCore *self)
+{
+  if (self->main_loop < 0)
+    return FALSE;
+
+  g_source_remove (self->main_loop);
+  self->main_loop = -1;
+
+  set_audio_callback_state (self, FALSE);
+
+  return TRUE;
 }
 
 /**
@@ -1484,11 +1593,17 @@ retro_core_stop (RetroCore *self)
 {
   g_return_if_fail (RETRO_IS_CORE (self));
 
-  if (self->main_loop < 0)
+  if (!stop_main_loop (self))
     return;
 
-  g_source_remove (self->main_loop);
-  self->main_loop = -1;
+  /* The last frames may still be read back asynchronously, publish the most
+   * recent one so the paused core doesn't show a stale frame. */
+  if (self->renderer == NULL ||
+      !retro_renderer_flush (self->renderer, self->framebuffer))
+    return;
+
+  retro_framebuffer_publish (self->framebuffer);
+  g_signal_emit (self, signals[SIGNAL_VIDEO_OUTPUT], 0);
 }
 
 /**
@@ -1508,11 +1623,110 @@ retro_core_reset (RetroCore *self)
   reset ();
 }
 
+static void
+publish_audio_stats (RetroCore *self)
+{
+  RetroAudioStats stats = { 0 };
+
+  stats.frames_per_iteration = self->audio_frames_per_iteration;
+  stats.resampling_ratio = 1.0;
+  stats.blocked_time = self->audio_blocked_time;
+
+  if (self->audio_sink != NULL)
+    retro_audio_sink_get_stats (self->audio_sink, &stats);
+
+  retro_audio_queue_set_stats (self->audio_queue, &stats);
+}
+
+static void
+flush_audio (RetroCore *self)
+{
+  gint64 start_time;
+
+  /* Cores often alternate between slightly different amounts of audio per
+   * iteration to match their sample rate, so smooth it out. */
+  self->audio_frames_per_iteration +=
+    (self->audio_buffer_length - self->audio_frames_per_iteration) * AUDIO_STATS_SMOOTHING;
+
+  /* Cores with an audio callback may not produce any audio during
+   * iterations, but the sink still needs to know about the sample rate to
+   * pull their audio. */
+  if (self->audio_buffer_length > 0 || retro_core_has_audio_callback (self)) {
+    start_time = g_get_monotonic_time ();
+
+    if (self->audio_sink != NULL)
+      retro_audio_sink_audio_output (self->audio_sink,
+                                     self->audio_buffer,
+                                     self->audio_buffer_length,
+                                     self->sample_rate);
+
+    self->audio_blocked_time += g_get_monotonic_time () - start_time;
+
+    /* The audio queue has a single producer, and the audio sink's thread
+     * writes the frames it pulls to it too. */
+    g_mutex_lock (&self->audio_pull_lock);
+    retro_audio_queue_write (self->audio_queue,
+                             self->audio_buffer,
+                             self->audio_buffer_length,
+                             self->sample_rate);
+    g_mutex_unlock (&self->audio_pull_lock);
+
+    self->audio_buffer_length = 0;
+  }
+
+  publish_audio_stats (self);
+}
+
+static void
+replay_key_events (RetroCore *self)
+{
+  const RetroMovieKeyEvent *events;
+  gsize n_events;
+
+  if (self->keyboard_callback.callback == NULL)
+    return;
+
+  events = retro_movie_get_key_events (self->movie, &n_events);
+  for (gsize i = 0; i < n_events; i++)
+    self->keyboard_callback.callback (events[i].down,
+                                      events[i].keycode,
+                                      events[i].character,
+                                      events[i].key_modifiers);
+}
+
+static void
+advance_movie (RetroCore *self)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (self->movie == NULL)
+    return;
+
+  if (retro_movie_next_frame (self->movie, &error)) {
+    if (!retro_movie_get_is_recording (self->movie))
+      replay_key_events (self);
+
+    return;
+  }
+
+  if (error != NULL)
+    g_critical ("Couldn't advance the movie: %s", error->message);
+  else
+    g_debug ("The movie ended after %" G_GUINT64_FORMAT " frames.",
+             retro_movie_get_frame (self->movie));
+
+  g_clear_object (&self->movie);
+}
+
 static inline void
-emit_iterated (RetroCore **self)
+end_iteration (RetroCore **self)
 {
-  if (*self)
-    g_signal_emit (*self, signals[SIGNAL_ITERATED], 0);
+  if (*self == NULL)
+    return;
+
+  advance_movie (*self);
+  flush_audio (*self);
+  g_signal_emit (*self, signals[SIGNAL_ITERATED], 0);
 }
 
 /**
@@ -1532,7 +1746,7 @@ retro_core_iteration (RetroCore *self)
   gsize size;
   gsize new_size;
   gboolean success;
-  RetroCore *iterated __attribute__((cleanup(emit_iterated))) = NULL;
+  RetroCore *iterated __attribute__((cleanup(end_iteration))) = NULL;
 
   g_return_if_fail (RETRO_IS_CORE (self));
 
@@ -1541,6 +1755,8 @@ retro_core_iteration (RetroCore *self)
   iterated = self;
   run = retro_module_get_run (self->module);
 
+  retro_framebuffer_start_run (self->framebuffer);
+
   if (self->runahead == 0) {
     self->run_remaining = 0;
     run ();
@@ -1587,8 +1803,10 @@ retro_core_iteration (RetroCore *self)
     return;
   }
 
+  self->is_speculating = TRUE;
   for (; self->run_remaining >= 0; self->run_remaining--)
     run ();
+  self->is_speculating = FALSE;
 
   new_size = serialize_size ();
 
@@ -1632,28 +1850,15 @@ retro_core_get_can_access_state (RetroCore *self)
   return size > 0;
 }
 
-/**
- * retro_core_save_state:
- * @self: a #RetroCore
- * @filename: the file to save the state to
- * @error: return location for a #GError, or %NULL
- *
- * Saves the state of @self.
- */
-void
-retro_core_save_state (RetroCore    *self,
-                       const gchar  *filename,
-                       GError      **error)
+static GBytes *
+serialize_state (RetroCore  *self,
+                 GError    **error)
 {
   RetroSerializeSize serialize_size = NULL;
   RetroSerialize serialize = NULL;
   g_autofree guint8 *data = NULL;
   gsize size;
   gboolean success;
-  g_autoptr (GError) tmp_error = NULL;
-
-  g_return_if_fail (RETRO_IS_CORE (self));
-  g_return_if_fail (filename != NULL);
 
   serialize_size = retro_module_get_serialize_size (self->module);
   size = serialize_size ();
@@ -1664,7 +1869,7 @@ retro_core_save_state (RetroCore    *self,
                  RETRO_CORE_ERROR_SERIALIZATION_NOT_SUPPORTED,
                  "Couldn't serialize the internal state: serialization not supported.");
 
-    return;
+    return NULL;
   }
 
   serialize = retro_module_get_serialize (self->module);
@@ -1678,49 +1883,22 @@ retro_core_save_state (RetroCore    *self,
                  RETRO_CORE_ERROR_COULDNT_SERIALIZE,
                  "Couldn't serialize the internal state: serialization failed.");
 
-    return;
+    return NULL;
   }
 
-  g_file_set_contents (filename, (gchar *) data, size, &tmp_error);
-  if (G_UNLIKELY (tmp_error != NULL))
-    g_set_error (error,
-                 RETRO_CORE_ERROR,
-                 RETRO_CORE_ERROR_COULDNT_ACCESS_FILE,
-                 "Couldn't serialize the internal state: %s", tmp_error->message);
+  return g_bytes_new_take (g_steal_pointer (&data), size);
 }
 
-/**
- * retro_core_load_state:
- * @self: a #RetroCore
- * @filename: the file to load the state from
- * @error: return location for a #GError, or %NULL
- *
- * Loads the state of the @self.
- */
-void
-retro_core_load_state (RetroCore    *self,
-                       const gchar  *filename,
-                       GError      **error)
+static void
+unserialize_state (RetroCore  *self,
+                   GBytes     *state,
+                   GError    **error)
 {
   RetroSerializeSize serialize_size = NULL;
   RetroUnserialize unserialize = NULL;
   gsize expected_size, data_size;
-  g_autofree gchar *data = NULL;
+  const guint8 *data;
   gboolean success;
-  g_autoptr (GError) tmp_error = NULL;
-
-  g_return_if_fail (RETRO_IS_CORE (self));
-  g_return_if_fail (filename != NULL);
-
-  g_file_get_contents (filename, &data, &data_size, &tmp_error);
-  if (G_UNLIKELY (tmp_error != NULL)) {
-    g_set_error (error,
-                 RETRO_CORE_ERROR,
-                 RETRO_CORE_ERROR_COULDNT_ACCESS_FILE,
-                 "Couldn't deserialize the internal state: %s", tmp_error->message);
-
-    return;
-  }
 
   /* Some cores, such as MAME and ParaLLEl N64, can only properly restore the
    * state after at least one frame has been run. */
@@ -1748,6 +1926,8 @@ retro_core_load_state (RetroCore    *self,
     return;
   }
 
+  data = g_bytes_get_data (state, &data_size);
+
   if (data_size != expected_size)
     g_critical ("%s expects %"G_GSIZE_FORMAT" bytes for its internal state, but %"
                 G_GSIZE_FORMAT" bytes were passed.",
@@ -1766,6 +1946,77 @@ retro_core_load_state (RetroCore    *self,
   }
 }
 
+/**
+ * retro_core_save_state:
+ * @self: a #RetroCore
+ * @filename: the file to save the state to
+ * @error: return location for a #GError, or %NULL
+ *
+ * Saves the state of @self.
+ */
+void
+retro_core_save_state (RetroCore    *self,
+                       const gchar  *filename,
+                       GError      **error)
+{
+  g_autoptr (GBytes) state = NULL;
+  gconstpointer data;
+  gsize size;
+  g_autoptr (GError) tmp_error = NULL;
+
+  g_return_if_fail (RETRO_IS_CORE (self));
+  g_return_if_fail (filename != NULL);
+
+  state = serialize_state (self, error);
+  if (state == NULL)
+    return;
+
+  data = g_bytes_get_data (state, &size);
+
+  g_file_set_contents (filename, data, size, &tmp_error);
+  if (G_UNLIKELY (tmp_error != NULL))
+    g_set_error (error,
+                 RETRO_CORE_ERROR,
+                 RETRO_CORE_ERROR_COULDNT_ACCESS_FILE,
+                 "Couldn't serialize the internal state: %s", tmp_error->message);
+}
+
+/**
+ * retro_core_load_state:
+ * @self: a #RetroCore
+ * @filename: the file to load the state from
+ * @error: return location for a #GError, or %NULL
+ *
+ * Loads the state of the @self.
+ */
+void
+retro_core_load_state (RetroCore    *self,
+                       const gchar  *filename,
+                       GError      **error)
+{
+  g_autoptr (GBytes) state = NULL;
+  gchar *data;
+  gsize data_size;
+  g_autoptr (GError) tmp_error = NULL;
+
+  g_return_if_fail (RETRO_IS_CORE (self));
+  g_return_if_fail (filename != NULL);
+
+  g_file_get_contents (filename, &data, &data_size, &tmp_error);
+  if (G_UNLIKELY (tmp_error != NULL)) {
+    g_set_error (error,
+                 RETRO_CORE_ERROR,
+                 RETRO_CORE_ERROR_COULDNT_ACCESS_FILE,
+                 "Couldn't deserialize the internal state: %s", tmp_error->message);
+
+    return;
+  }
+
+  state = g_bytes_new_take (data, data_size);
+
+  unserialize_state (self, state, error);
+}
+
 /**
  * retro_core_get_memory_size:
  * @self: a #RetroCore
@@ -1916,6 +2167,110 @@ retro_core_load_memory (RetroCore        *self,
   memset (memory_region + data_size, 0, memory_region_size - data_size);
 }
 
+/**
+ * retro_core_record_movie:
+ * @self: a #RetroCore
+ * @filename: the file to record the movie to
+ * @from_state: whether to start from the current state rather than power-on
+ * @error: return location for a #GError, or %NULL
+ *
+ * Records the input and keyboard events @self sees on each frame into a movie,
+ * which can later be replayed with retro_core_play_movie(). If @from_state is
+ * %FALSE, @self is reset so the movie starts from power-on. The state the movie
+ * starts from is stored in it, unless @self can't serialize its state, in which
+ * case the movie is played back from a reset.
+ */
+void
+retro_core_record_movie (RetroCore    *self,
+                         const gchar  *filename,
+                         gboolean      from_state,
+                         GError      **error)
+{
+  g_autoptr (GBytes) state = NULL;
+  RetroMovie *movie;
+
+  g_return_if_fail (RETRO_IS_CORE (self));
+  g_return_if_fail (filename != NULL);
+
+  if (!from_state)
+    retro_core_reset (self);
+
+  /* Storing the power-on state too makes playback independent of how well
+   * the core resets, only cores which can't serialize rely on it. */
+  if (from_state || retro_core_get_can_access_state (self)) {
+    state = serialize_state (self, error);
+    if (state == NULL)
+      return;
+  }
+
+  movie = retro_movie_new_recorder (filename, state, error);
+  if (movie == NULL)
+    return;
+
+  g_clear_object (&self->movie);
+  self->movie = movie;
+}
+
+/**
+ * retro_core_play_movie:
+ * @self: a #RetroCore
+ * @filename: the file to play the movie from
+ * @error: return location for a #GError, or %NULL
+ *
+ * Restores the state a movie starts from and feeds its input and keyboard
+ * events to @self frame by frame, ignoring the controllers and the keyboard,
+ * until it ends or retro_core_stop_movie() is called.
+ */
+void
+retro_core_play_movie (RetroCore    *self,
+                       const gchar  *filename,
+                       GError      **error)
+{
+  g_autoptr (RetroMovie) movie = NULL;
+  g_autoptr (GError) tmp_error = NULL;
+  GBytes *state;
+
+  g_return_if_fail (RETRO_IS_CORE (self));
+  g_return_if_fail (filename != NULL);
+
+  movie = retro_movie_new_player (filename, error);
+  if (movie == NULL)
+    return;
+
+  g_clear_object (&self->movie);
+
+  state = retro_movie_get_state (movie);
+  if (state == NULL) {
+    retro_core_reset (self);
+  }
+  else {
+    unserialize_state (self, state, &tmp_error);
+    if (G_UNLIKELY (tmp_error != NULL)) {
+      g_propagate_error (error, g_steal_pointer (&tmp_error));
+
+      return;
+    }
+  }
+
+  self->movie = g_steal_pointer (&movie);
+
+  replay_key_events (self);
+}
+
+/**
+ * retro_core_stop_movie:
+ * @self: a #RetroCore
+ *
+ * Stops recording or playing the current movie, if any.
+ */
+void
+retro_core_stop_movie (RetroCore *self)
+{
+  g_return_if_fail (RETRO_IS_CORE (self));
+
+  g_clear_object (&self->movie);
+}
+
 /**
  * retro_core_poll_controllers:
  * @self: a #RetroCore
@@ -1925,23 +2280,35 @@ retro_core_load_memory (RetroCore        *self,
 void
 retro_core_poll_controllers (RetroCore *self)
 {
-  GHashTableIter iter;
-  gpointer port;
-  RetroControllerState *controller;
-
   g_return_if_fail (RETRO_IS_CORE (self));
 
-  retro_controller_state_lock (self->default_controller);
-  retro_controller_state_snapshot (self->default_controller);
-  retro_controller_state_unlock (self->default_controller);
+  if (self->controller_state == NULL)
+    return;
+
+  retro_controller_state_snapshot (self->controller_state);
+}
+
+static gint16
+get_controller_input_state (RetroCore  *self,
+                            guint       port,
+                            RetroInput *input)
+{
+  RetroControllerType type;
+  RetroControllerState *state;
 
-  g_hash_table_iter_init (&iter, self->controllers);
+  state = self->controller_state;
+  if (state == NULL)
+    return 0;
 
-  while (g_hash_table_iter_next (&iter, &port, (gpointer *) &controller)) {
-    retro_controller_state_lock (controller);
-    retro_controller_state_snapshot (controller);
-    retro_controller_state_unlock (controller);
-  }
+  type = retro_input_get_controller_type (input) & RETRO_CONTROLLER_TYPE_TYPE_MASK;
+
+  if (retro_controller_state_has_type (state, port, type))
+    return retro_controller_state_get_input (state, port, input);
+
+  if (retro_controller_state_has_type (state, RETRO_CONTROLLER_STATE_DEFAULT_PORT, type))
+    return retro_controller_state_get_input (state, RETRO_CONTROLLER_STATE_DEFAULT_PORT, input);
+
+  return 0;
 }
 
 /**
@@ -1960,21 +2327,21 @@ retro_core_get_controller_input_state (RetroCore  *self,
                                        guint       port,
                                        RetroInput *input)
 {
-  RetroControllerType type;
-  RetroControllerState *controller;
+  gint16 value;
 
   g_return_val_if_fail (RETRO_IS_CORE (self), 0);
 
-  type = retro_input_get_controller_type (input) & RETRO_CONTROLLER_TYPE_TYPE_MASK;
+  if (self->movie != NULL && !retro_movie_get_is_recording (self->movie))
+    return retro_movie_get_input (self->movie, port, input);
 
-  controller = g_hash_table_lookup (self->controllers, GUINT_TO_POINTER (port));
-  if (controller && retro_controller_state_has_type (controller, type))
-    return retro_controller_state_get_input (controller, input);
+  value = get_controller_input_state (self, port, input);
 
-  if (self->default_controller && retro_controller_state_has_type (self->default_controller, type))
-    return retro_controller_state_get_input (self->default_controller, input);
+  /* When running ahead, only the first run of an iteration is the frame
+   * actually shown, the other ones are speculative. */
+  if (self->movie != NULL && !self->is_speculating)
+    retro_movie_record_input (self->movie, port, input, value);
 
-  return 0;
+  return value;
 }
 
 // FIXME documentation
@@ -2016,6 +2383,148 @@ retro_core_set_runahead (RetroCore *self,
   self->runahead = runahead;
 }
 
+gboolean
+retro_core_get_detect_duplicate_frames (RetroCore *self)
+{
+  g_return_val_if_fail (RETRO_IS_CORE (self), FALSE);
+
+  return retro_framebuffer_get_detect_duplicates (self->framebuffer);
+}
+
+void
+retro_core_set_detect_duplicate_frames (RetroCore *self,
+                                        gboolean   detect_duplicate_frames)
+{
+  g_return_if_fail (RETRO_IS_CORE (self));
+
+  retro_framebuffer_set_detect_duplicates (self->framebuffer,
+                                           detect_duplicate_frames);
+}
+
+/**
+ * retro_core_set_audio_sink:
+ * @self: a #RetroCore
+ * @audio_sink: (nullable) (transfer none): a #RetroAudioSink, or %NULL
+ *
+ * Sets the #RetroAudioSink receiving the audio produced by @self once per
+ * iteration. @self doesn't keep a reference on it, so it must be unset before
+ * being disposed.
+ */
+void
+retro_core_set_audio_sink (RetroCore      *self,
+                           RetroAudioSink *audio_sink)
+{
+  g_return_if_fail (RETRO_IS_CORE (self));
+  g_return_if_fail (audio_sink == NULL || RETRO_IS_AUDIO_SINK (audio_sink));
+
+  self->audio_sink = audio_sink;
+}
+
+/**
+ * retro_core_push_audio_frames:
+ * @self: a #RetroCore
+ * @frames: (array length=n_frames): interleaved stereo frames
+ * @n_frames: the number of frames in @frames
+ *
+ * Appends @frames to the audio produced during the current iteration.
+ */
+void
+retro_core_push_audio_frames (RetroCore    *self,
+                              const gint16 *frames,
+                              gsize         n_frames)
+{
+  if (G_UNLIKELY (self->audio_buffer_length + n_frames > self->audio_buffer_capacity))
+    reserve_audio_buffer (self, MAX (2 * self->audio_buffer_capacity,
+                                     self->audio_buffer_length + n_frames));
+
+  memcpy (self->audio_buffer + self->audio_buffer_length * 2,
+          frames, n_frames * 2 * sizeof (gint16));
+  self->audio_buffer_length += n_frames;
+}
+
+/**
+ * retro_core_push_pulled_audio_frames:
+ * @self: a #RetroCore
+ * @frames: (array length=n_frames): interleaved stereo frames
+ * @n_frames: the number of frames in @frames
+ *
+ * Passes @frames to the audio sink pulling them if they are produced by the
+ * audio callback of @self on the current thread, and to the audio queue so the
+ * UI gets them too. This must be checked before anything related to
+ * iterations, as the audio sink's thread must not touch their state.
+ *
+ * Returns: whether @frames were pulled
+ */
+gboolean
+retro_core_push_pulled_audio_frames (RetroCore    *self,
+                                     const gint16 *frames,
+                                     gsize         n_frames)
+{
+  RetroAudioPull *pull = g_private_get (&audio_pull);
+
+  if (pull == NULL)
+    return FALSE;
+
+  pull->func (frames, n_frames, pull->user_data);
+  pull->n_frames += n_frames;
+
+  /* retro_core_pull_audio() holds audio_pull_lock, which serializes this with
+   * the writes from flush_audio(). */
+  retro_audio_queue_write (self->audio_queue, frames, n_frames, self->sample_rate);
+
+  return TRUE;
+}
+
+/**
+ * retro_core_has_audio_callback:
+ * @self: a #RetroCore
+ *
+ * Gets whether @self produces its audio asynchronously, in which case its
+ * audio sink must pull it with retro_core_pull_audio().
+ *
+ * Returns: whether @self has an audio callback
+ */
+gboolean
+retro_core_has_audio_callback (RetroCore *self)
+{
+  return self->audio_callback.callback != NULL;
+}
+
+/**
+ * retro_core_pull_audio:
+ * @self: a #RetroCore
+ * @func: (scope call): the function receiving the frames
+ * @user_data: the data to pass to @func
+ *
+ * Calls the audio callback of @self on the current thread, typically the
+ * audio sink's, and passes the frames it produces to @func. Nothing is
+ * pulled while @self isn't running.
+ *
+ * Returns: the number of frames pulled
+ */
+gsize
+retro_core_pull_audio (RetroCore          *self,
+                       RetroAudioPullFunc  func,
+                       gpointer            user_data)
+{
+  RetroAudioPull pull = { func, user_data, 0 };
+
+  if (!retro_core_has_audio_callback (self))
+    return 0;
+
+  g_mutex_lock (&self->audio_pull_lock);
+
+  if (g_atomic_int_get (&self->audio_callback_enabled)) {
+    g_private_set (&audio_pull, &pull);
+    self->audio_callback.callback ();
+    g_private_set (&audio_pull, NULL);
+  }
+
+  g_mutex_unlock (&self->audio_pull_lock);
+
+  return pull.n_frames;
+}
+
 gboolean
 retro_core_is_running_ahead (RetroCore *self)
 {
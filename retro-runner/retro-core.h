@@ -50,6 +50,14 @@ void retro_core_save_state (RetroCore    *self,
 void retro_core_load_state (RetroCore    *self,
                             const gchar  *filename,
                             GError      **error);
+void retro_core_record_movie (RetroCore    *self,
+                              const gchar  *filename,
+                              gboolean      from_state,
+                              GError      **error);
+void retro_core_play_movie (RetroCore    *self,
+                            const gchar  *filename,
+                            GError      **error);
+void retro_core_stop_movie (RetroCore *self);
 gsize retro_core_get_memory_size (RetroCore       *self,
                                   RetroMemoryType  memory_type);
 void retro_core_save_memory (RetroCore        *self,
@@ -60,12 +68,11 @@ void retro_core_load_memory (RetroCore        *self,
                              RetroMemoryType   memory_type,
                              const gchar      *filename,
                              GError          **error);
-void retro_core_set_default_controller (RetroCore *self,
-                                        gint       fd);
+void retro_core_set_controller_state (RetroCore *self,
+                                      gint       fd);
 void retro_core_set_controller (RetroCore           *self,
                                 guint                port,
-                                RetroControllerType  controller_type,
-                                gint                 fd);
+                                RetroControllerType  controller_type);
 gboolean retro_core_get_controller_supports_rumble (RetroCore *self,
                                                     guint      port);
 void retro_core_send_input_key_event (RetroCore                *self,
@@ -76,6 +83,9 @@ void retro_core_send_input_key_event (RetroCore                *self,
 guint retro_core_get_runahead (RetroCore *self);
 void retro_core_set_runahead (RetroCore *self,
                               guint      runahead);
+gboolean retro_core_get_detect_duplicate_frames (RetroCore *self);
+void retro_core_set_detect_duplicate_frames (RetroCore *self,
+                                             gboolean   detect_duplicate_frames);
 gdouble retro_core_get_speed_rate (RetroCore *self);
 void retro_core_set_speed_rate (RetroCore *self,
                                 gdouble    speed_rate);
@@ -100,6 +100,20 @@ typedef struct {
   gpointer set_rumble_state;
 } RetroRumbleCallback;
 
+#define RETRO_MEMORY_ACCESS_WRITE (1 << 0)
+#define RETRO_MEMORY_ACCESS_READ (1 << 1)
+#define RETRO_MEMORY_TYPE_CACHED (1 << 0)
+
+typedef struct {
+  gpointer data;
+  guint width;
+  guint height;
+  gsize pitch;
+  RetroPixelFormat format;
+  guint access_flags;
+  guint memory_flags;
+} RetroSoftwareFramebuffer;
+
 static gboolean
 rumble_callback_set_rumble_state (guint             port,
                                   RetroRumbleEffect effect,
@@ -232,6 +246,43 @@ get_content_directory (RetroCore    *self,
   return TRUE;
 }
 
+/* Lets the core render straight into the shared memory slot the next frame
+ * will be published from, video_refresh_cb() then has nothing to copy. */
+static gboolean
+get_current_software_framebuffer (RetroCore                *self,
+                                  RetroSoftwareFramebuffer *framebuffer)
+{
+  gint pixel_size;
+
+  if (self->renderer)
+    return FALSE;
+
+  if (!retro_pixel_format_to_gl (self->pixel_format, NULL, NULL, &pixel_size))
+    return FALSE;
+
+  framebuffer->pitch = framebuffer->width * pixel_size;
+
+  /* The core may keep the pointer, so refuse frames which would remap the
+   * shared memory, the core then falls back to its own buffer. */
+  if (!retro_framebuffer_fits (self->framebuffer,
+                               (gsize) framebuffer->pitch * framebuffer->height))
+    return FALSE;
+
+  framebuffer->format = self->pixel_format;
+  framebuffer->memory_flags = RETRO_MEMORY_TYPE_CACHED;
+  framebuffer->data = retro_framebuffer_prepare (self->framebuffer,
+                                                 self->pixel_format,
+                                                 framebuffer->pitch,
+                                                 framebuffer->width,
+                                                 framebuffer->height,
+                                                 self->aspect_ratio);
+
+  retro_debug ("Get current software framebuffer: %u × %u",
+               framebuffer->width, framebuffer->height);
+
+  return framebuffer->data != NULL;
+}
+
 static gboolean
 get_input_device_capabilities (RetroCore *self,
                                guint64   *capabilities)
@@ -439,6 +490,17 @@ set_hw_render (RetroCore             *self,
   return TRUE;
 }
 
+static gboolean
+set_audio_callback (RetroCore                *self,
+                    const RetroAudioCallback *callback)
+{
+  retro_debug ("Set audio callback");
+
+  self->audio_callback = *callback;
+
+  return TRUE;
+}
+
 static gboolean
 set_disk_control_interface (RetroCore                *self,
                             RetroDiskControlCallback *callback)
@@ -628,6 +690,9 @@ environment_core_command (RetroCore *self,
   case RETRO_ENVIRONMENT_GET_CONTENT_DIRECTORY:
     return get_content_directory (self, (const gchar **) data);
 
+  case RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER:
+    return get_current_software_framebuffer (self, (RetroSoftwareFramebuffer *) data);
+
   case RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES:
     return get_input_device_capabilities (self, (guint64 *) data);
 
@@ -658,6 +723,9 @@ environment_core_command (RetroCore *self,
   case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
     return get_variable_update (self, (bool *) data);
 
+  case RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK:
+    return set_audio_callback (self, (RetroAudioCallback *) data);
+
   case RETRO_ENVIRONMENT_SET_DISK_CONTROL_INTERFACE:
     return set_disk_control_interface (self, (RetroDiskControlCallback *) data);
 
@@ -695,13 +763,11 @@ environment_core_command (RetroCore *self,
     return shutdown (self);
 
   RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_GET_CAMERA_INTERFACE);
-  RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER);
   RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_GET_HW_RENDER_INTERFACE);
   RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_GET_LOCATION_INTERFACE);
   RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_GET_PERF_INTERFACE);
   RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_GET_SENSOR_INTERFACE);
   RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_GET_USERNAME);
-  RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK);
   RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_SET_CONTROLLER_INFO);
   RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK);
   RETRO_UNIMPLEMENT_ENVIRONMENT (RETRO_ENVIRONMENT_SET_HW_RENDER_CONTEXT_NEGOTIATION_INTERFACE);
@@ -741,17 +807,15 @@ video_refresh_cb (guint8 *data,
 {
   RetroCore *self = retro_core_get_instance ();
 
+  /* The core duped the frame: the previous one is still current, so there is
+   * nothing to copy nor to notify. RetroFramebuffer counts it as duplicated. */
   if (data == NULL)
     return;
 
   if (retro_core_is_running_ahead (self))
     return;
 
-  retro_framebuffer_lock (self->framebuffer);
-
   if (self->renderer) {
-    gint pixel_size;
-
     if (G_UNLIKELY (data && data != RETRO_HW_FRAME_BUFFER_VALID)) {
       g_critical ("Video data must be NULL or RETRO_HW_FRAME_BUFFER_VALID if "
                   "rendering to hardware.");
@@ -759,23 +823,20 @@ video_refresh_cb (guint8 *data,
       return;
     }
 
-    if (!retro_pixel_format_to_gl (self->pixel_format, NULL, NULL, &pixel_size))
+    /* Unless the iteration is synchronous or the core isn't running, the
+     * readback may still be in flight, in which case an earlier frame is
+     * published, or none if no readback completed yet. */
+    if (!retro_renderer_snapshot (self->renderer, self->pixel_format, width,
+                                  height, self->aspect_ratio,
+                                  self->block_video_signal || self->main_loop < 0,
+                                  self->framebuffer))
       return;
 
-    pitch = width * pixel_size;
-
-    retro_framebuffer_set_data (self->framebuffer, self->pixel_format, pitch,
-                                width, height, self->aspect_ratio, NULL);
-
-    data = retro_framebuffer_get_pixels (self->framebuffer);
-
-    retro_renderer_snapshot (self->renderer, self->pixel_format, width, height, pitch, data);
+    retro_framebuffer_publish (self->framebuffer);
   }
-  else
-    retro_framebuffer_set_data (self->framebuffer, self->pixel_format, pitch,
-                                width, height, self->aspect_ratio, data);
-
-  retro_framebuffer_unlock (self->framebuffer);
+  else if (!retro_framebuffer_set_data (self->framebuffer, self->pixel_format, pitch,
+                                        width, height, self->aspect_ratio, data))
+    return;
 
   if (!self->block_video_signal)
     g_signal_emit_by_name (self, "video-output");
@@ -795,13 +856,16 @@ audio_sample_cb (gint16 left,
   RetroCore *self = retro_core_get_instance ();
   gint16 samples[] = { left, right };
 
+  if (retro_core_push_pulled_audio_frames (self, samples, 1))
+    return;
+
   if (retro_core_is_running_ahead (self))
     return;
 
   if (self->sample_rate <= 0.0)
     return;
 
-  g_signal_emit_by_name (self, "audio_output", samples, 2, self->sample_rate);
+  retro_core_push_audio_frames (self, samples, 1);
 }
 
 static gsize
@@ -810,13 +874,16 @@ audio_sample_batch_cb (gint16 *data,
 {
   RetroCore *self = retro_core_get_instance ();
 
+  if (retro_core_push_pulled_audio_frames (self, data, frames))
+    return frames;
+
   if (retro_core_is_running_ahead (self))
     return frames;
 
   if (self->sample_rate <= 0.0)
     return 0;
 
-  g_signal_emit_by_name (self, "audio_output", data, frames * 2, self->sample_rate);
+  retro_core_push_audio_frames (self, data, frames);
 
   return frames;
 }
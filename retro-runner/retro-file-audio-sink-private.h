@@ -0,0 +1,21 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#pragma once
+
+#if !defined(__RETRO_GTK_INSIDE__) && !defined(RETRO_GTK_COMPILATION)
+# error "Only <retro-gtk.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+#include "retro-audio-sink-private.h"
+
+G_BEGIN_DECLS
+
+#define RETRO_TYPE_FILE_AUDIO_SINK (retro_file_audio_sink_get_type())
+
+G_DECLARE_FINAL_TYPE (RetroFileAudioSink, retro_file_audio_sink, RETRO, FILE_AUDIO_SINK, GObject)
+
+RetroFileAudioSink *retro_file_audio_sink_new (const gchar  *filename,
+                                               GError      **error);
+
+G_END_DECLS
@@ -0,0 +1,298 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#include "retro-file-audio-sink-private.h"
+
+#include "retro-core-private.h"
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FRAME_SIZE (2 * sizeof (gint16))
+#define WAV_HEADER_SIZE 44
+
+typedef struct {
+  gsize n_frames;
+  gdouble sample_rate;
+  gint16 frames[];
+} RetroAudioBlock;
+
+/* Any address which can't be a block's, telling the writer thread to stop. */
+static RetroAudioBlock end_of_stream;
+
+/* Writes the audio to a file, as a WAV file or as raw samples. The blocks of
+ * frames received on the core's thread are handed over to a writer thread
+ * through an unbounded queue, so the core never waits for the disk and no
+ * frame is ever dropped. */
+struct _RetroFileAudioSink
+{
+  GObject parent_instance;
+  RetroCore *core;
+  gdouble sample_rate;
+  GAsyncQueue *blocks;
+  GThread *thread;
+
+  /* Only used by the writer thread while it runs. */
+  FILE *file;
+  gboolean is_wav;
+  gdouble wav_sample_rate;
+  guint64 data_size;
+  gboolean has_failed;
+};
+
+static void retro_audio_sink_interface_init (RetroAudioSinkInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (RetroFileAudioSink, retro_file_audio_sink, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (RETRO_TYPE_AUDIO_SINK,
+                                                retro_audio_sink_interface_init))
+
+static inline void
+set_uint16_le (guint8  *data,
+               guint16  value)
+{
+  value = GUINT16_TO_LE (value);
+  memcpy (data, &value, sizeof (value));
+}
+
+static inline void
+set_uint32_le (guint8  *data,
+               guint32  value)
+{
+  value = GUINT32_TO_LE (value);
+  memcpy (data, &value, sizeof (value));
+}
+
+static void
+write_wav_header (RetroFileAudioSink *self)
+{
+  guint8 header[WAV_HEADER_SIZE];
+  guint32 sample_rate = (guint32) self->wav_sample_rate;
+  guint32 data_size = MIN (self->data_size, G_MAXUINT32 - WAV_HEADER_SIZE);
+
+  memcpy (header, "RIFF", 4);
+  set_uint32_le (header + 4, WAV_HEADER_SIZE - 8 + data_size);
+  memcpy (header + 8, "WAVEfmt ", 8);
+  set_uint32_le (header + 16, 16);
+  set_uint16_le (header + 20, 1);
+  set_uint16_le (header + 22, 2);
+  set_uint32_le (header + 24, sample_rate);
+  set_uint32_le (header + 28, sample_rate * FRAME_SIZE);
+  set_uint16_le (header + 32, FRAME_SIZE);
+  set_uint16_le (header + 34, 16);
+  memcpy (header + 36, "data", 4);
+  set_uint32_le (header + 40, data_size);
+
+  if (fseek (self->file, 0, SEEK_SET) != 0 ||
+      fwrite (header, 1, WAV_HEADER_SIZE, self->file) != WAV_HEADER_SIZE)
+    g_critical ("Couldn't write the WAV header: %s", g_strerror (errno));
+
+  fseek (self->file, 0, SEEK_END);
+}
+
+static void
+write_block (RetroFileAudioSink *self,
+             RetroAudioBlock    *block)
+{
+  gsize size = block->n_frames * FRAME_SIZE;
+
+  if (self->has_failed)
+    return;
+
+  if (self->is_wav) {
+    /* The header is rewritten with the final size once done. */
+    if (self->wav_sample_rate == 0.0) {
+      self->wav_sample_rate = block->sample_rate;
+      write_wav_header (self);
+    }
+    else if (block->sample_rate != self->wav_sample_rate) {
+      g_warning ("The sample rate changed from %g Hz to %g Hz, the WAV file will play at the wrong speed.",
+                 self->wav_sample_rate, block->sample_rate);
+      self->wav_sample_rate = block->sample_rate;
+    }
+  }
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+  for (gsize i = 0; i < block->n_frames * 2; i++)
+    block->frames[i] = GINT16_TO_LE (block->frames[i]);
+#endif
+
+  if (fwrite (block->frames, 1, size, self->file) != size) {
+    g_critical ("Couldn't write the audio: %s", g_strerror (errno));
+    self->has_failed = TRUE;
+
+    return;
+  }
+
+  self->data_size += size;
+}
+
+static gpointer
+write_cb (RetroFileAudioSink *self)
+{
+  RetroAudioBlock *block;
+
+  while ((block = g_async_queue_pop (self->blocks)) != &end_of_stream) {
+    write_block (self, block);
+    g_free (block);
+  }
+
+  return NULL;
+}
+
+static void
+queue_frames (RetroFileAudioSink *self,
+              const gint16       *frames,
+              gsize               n_frames)
+{
+  RetroAudioBlock *block;
+
+  if (n_frames == 0)
+    return;
+
+  block = g_malloc (sizeof (RetroAudioBlock) + n_frames * FRAME_SIZE);
+  block->n_frames = n_frames;
+  block->sample_rate = self->sample_rate;
+  memcpy (block->frames, frames, n_frames * FRAME_SIZE);
+
+  g_async_queue_push (self->blocks, block);
+}
+
+static void
+retro_file_audio_sink_finalize (GObject *object)
+{
+  RetroFileAudioSink *self = (RetroFileAudioSink *)object;
+
+  if (self->core != NULL)
+    retro_core_set_audio_sink (self->core, NULL);
+
+  g_clear_object (&self->core);
+
+  /* Let the writer thread flush the pending audio before closing the file. */
+  if (self->thread != NULL) {
+    g_async_queue_push (self->blocks, &end_of_stream);
+    g_thread_join (self->thread);
+  }
+
+  if (self->file != NULL) {
+    if (self->is_wav && self->wav_sample_rate != 0.0)
+      write_wav_header (self);
+
+    if (fclose (self->file) != 0)
+      g_critical ("Couldn't close the audio file: %s", g_strerror (errno));
+  }
+
+  g_async_queue_unref (self->blocks);
+
+  G_OBJECT_CLASS (retro_file_audio_sink_parent_class)->finalize (object);
+}
+
+static void
+retro_file_audio_sink_class_init (RetroFileAudioSinkClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = retro_file_audio_sink_finalize;
+}
+
+static void
+retro_file_audio_sink_init (RetroFileAudioSink *self)
+{
+  self->blocks = g_async_queue_new_full (g_free);
+}
+
+static void
+pulled_audio_cb (const gint16 *frames,
+                 gsize         n_frames,
+                 gpointer      user_data)
+{
+  queue_frames (RETRO_FILE_AUDIO_SINK (user_data), frames, n_frames);
+}
+
+static void
+retro_file_audio_sink_set_core (RetroAudioSink *sink,
+                                RetroCore      *core)
+{
+  RetroFileAudioSink *self = RETRO_FILE_AUDIO_SINK (sink);
+
+  if (self->core == core)
+    return;
+
+  if (self->core != NULL) {
+    retro_core_set_audio_sink (self->core, NULL);
+    g_clear_object (&self->core);
+  }
+
+  if (core != NULL) {
+    self->core = g_object_ref (core);
+    retro_core_set_audio_sink (core, RETRO_AUDIO_SINK (self));
+  }
+}
+
+static void
+retro_file_audio_sink_audio_output (RetroAudioSink *sink,
+                                    const gint16   *frames,
+                                    gsize           n_frames,
+                                    gdouble         sample_rate)
+{
+  RetroFileAudioSink *self = RETRO_FILE_AUDIO_SINK (sink);
+
+  self->sample_rate = sample_rate;
+
+  queue_frames (self, frames, n_frames);
+
+  /* Without any playback thread to ask for it, pull the audio of cores with
+   * an audio callback once per iteration so it is still recorded. */
+  if (retro_core_has_audio_callback (self->core))
+    retro_core_pull_audio (self->core, pulled_audio_cb, self);
+}
+
+static void
+retro_audio_sink_interface_init (RetroAudioSinkInterface *iface)
+{
+  iface->set_core = retro_file_audio_sink_set_core;
+  iface->audio_output = retro_file_audio_sink_audio_output;
+}
+
+/**
+ * retro_file_audio_sink_new:
+ * @filename: the name of the file to write
+ * @error: return location for a #GError, or %NULL
+ *
+ * Creates a new #RetroFileAudioSink writing to @filename, which is truncated.
+ * If @filename ends with ".wav" the audio is written as a WAV file, otherwise
+ * it is written as raw signed 16 bits little endian stereo samples.
+ *
+ * Returns: (transfer full) (nullable): a new #RetroFileAudioSink, or %NULL on
+ * error
+ */
+RetroFileAudioSink *
+retro_file_audio_sink_new (const gchar  *filename,
+                           GError      **error)
+{
+  g_autoptr (RetroFileAudioSink) self = NULL;
+  g_autofree gchar *lowercase_filename = NULL;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+
+  self = g_object_new (RETRO_TYPE_FILE_AUDIO_SINK, NULL);
+  self->file = g_fopen (filename, "wb");
+  if (self->file == NULL) {
+    gint saved_errno = errno;
+
+    g_set_error (error,
+                 G_FILE_ERROR,
+                 g_file_error_from_errno (saved_errno),
+                 "Couldn't open the audio file “%s”: %s",
+                 filename, g_strerror (saved_errno));
+
+    return NULL;
+  }
+
+  lowercase_filename = g_ascii_strdown (filename, -1);
+  self->is_wav = g_str_has_suffix (lowercase_filename, ".wav");
+
+  self->thread = g_thread_new ("retro-audio-file",
+                               (GThreadFunc) write_cb, self);
+
+  return g_steal_pointer (&self);
+}
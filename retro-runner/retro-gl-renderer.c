@@ -6,6 +6,18 @@
 #include "epoxy/egl.h"
 
 #define MAX_EGL_ATTRS 30
+#define N_READBACKS 3
+
+typedef struct {
+  GLuint buffer;
+  gsize capacity;
+  GLsync fence;
+  RetroPixelFormat pixel_format;
+  gsize rowstride;
+  guint width;
+  guint height;
+  gfloat aspect_ratio;
+} RetroReadback;
 
 struct _RetroGLRenderer
 {
@@ -20,6 +32,19 @@ struct _RetroGLRenderer
   guint framebuffer;
   guint renderbuffer;
   guint texture;
+  guint width;
+  guint height;
+
+  /* Frames with a bottom left origin are flipped into this one by the GPU. */
+  guint flip_framebuffer;
+  guint flip_renderbuffer;
+
+  /* Readbacks are queued in pixel buffers, so reading frame N back completes
+   * while frame N + 1 is rendered. */
+  gboolean has_async_readback;
+  RetroReadback readbacks[N_READBACKS];
+  guint next_readback;
+  guint n_pending_readbacks;
 
   guint8 *buf_flip;
   gsize last_size;
@@ -63,6 +88,9 @@ init_framebuffer (RetroGLRenderer *self,
   width = MIN (width, MIN (max_fbo_size, max_rb_size));
   height = MIN (height, MIN (max_fbo_size, max_rb_size));
 
+  self->width = width;
+  self->height = height;
+
   glGenFramebuffers (1, &self->framebuffer);
   glBindFramebuffer (GL_FRAMEBUFFER, self->framebuffer);
 
@@ -109,6 +137,46 @@ init_framebuffer (RetroGLRenderer *self,
   glBindFramebuffer (GL_FRAMEBUFFER, 0);
 }
 
+static void
+init_async_readback (RetroGLRenderer *self)
+{
+  GLenum status;
+
+  /* Fences and framebuffer blits are needed on top of pixel buffers. */
+  if (epoxy_is_desktop_gl ())
+    self->has_async_readback = epoxy_gl_version () >= 32;
+  else
+    self->has_async_readback = epoxy_gl_version () >= 30;
+
+  if (!self->has_async_readback)
+    return;
+
+  for (gint i = 0; i < N_READBACKS; i++)
+    glGenBuffers (1, &self->readbacks[i].buffer);
+
+  if (!self->callback->bottom_left_origin)
+    return;
+
+  glGenFramebuffers (1, &self->flip_framebuffer);
+  glBindFramebuffer (GL_FRAMEBUFFER, self->flip_framebuffer);
+
+  glGenRenderbuffers (1, &self->flip_renderbuffer);
+  glBindRenderbuffer (GL_RENDERBUFFER, self->flip_renderbuffer);
+  glRenderbufferStorage (GL_RENDERBUFFER, GL_RGBA8, self->width, self->height);
+  glBindRenderbuffer (GL_RENDERBUFFER, 0);
+
+  glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                             GL_RENDERBUFFER, self->flip_renderbuffer);
+
+  check_gl_errors ("init_async_readback");
+
+  status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+     g_critical ("Flip framebuffer not complete: %d", status);
+
+  glBindFramebuffer (GL_FRAMEBUFFER, 0);
+}
+
 static void
 retro_gl_renderer_realize (RetroRenderer *renderer,
                            guint          width,
@@ -120,6 +188,7 @@ retro_gl_renderer_realize (RetroRenderer *renderer,
   check_egl_errors ("eglMakeCurrent");
 
   init_framebuffer (self, width, height);
+  init_async_readback (self);
 
   self->callback->context_reset ();
 }
@@ -139,25 +208,179 @@ retro_gl_renderer_get_current_framebuffer (RetroRenderer *renderer)
   return self->framebuffer;
 }
 
+static RetroReadback *
+get_pending_readback (RetroGLRenderer *self,
+                      guint            i)
+{
+  guint index = self->next_readback + N_READBACKS - self->n_pending_readbacks + i;
+
+  return &self->readbacks[index % N_READBACKS];
+}
+
+static gboolean
+is_readback_complete (RetroReadback *readback)
+{
+  return glClientWaitSync (readback->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) != GL_TIMEOUT_EXPIRED;
+}
+
 static void
-retro_gl_renderer_snapshot (RetroRenderer    *renderer,
-                            RetroPixelFormat  pixel_format,
-                            guint             width,
-                            guint             height,
-                            gsize             rowstride,
-                            guint8           *data)
+release_readbacks (RetroGLRenderer *self,
+                   guint            n_readbacks)
 {
-  RetroGLRenderer *self = RETRO_GL_RENDERER (renderer);
+  for (guint i = 0; i < n_readbacks; i++) {
+    RetroReadback *readback = get_pending_readback (self, 0);
+
+    glDeleteSync (readback->fence);
+    readback->fence = NULL;
+    self->n_pending_readbacks--;
+  }
+}
+
+/* Writes the most recent frame whose readback completed to the framebuffer,
+ * and releases it as well as the older ones it supersedes. If @wait is set,
+ * waits for all the readbacks to complete first. */
+static gboolean
+collect_readback (RetroGLRenderer  *self,
+                  RetroFramebuffer *framebuffer,
+                  gboolean          wait)
+{
+  RetroReadback *readback = NULL;
+  gpointer pixels, data;
   gsize size;
+  guint n_complete = 0;
+
+  if (wait && self->n_pending_readbacks > 0) {
+    glClientWaitSync (get_pending_readback (self, self->n_pending_readbacks - 1)->fence,
+                      GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    n_complete = self->n_pending_readbacks;
+  }
+
+  /* Fences are signaled in order, stop at the first pending one. */
+  while (n_complete < self->n_pending_readbacks &&
+         is_readback_complete (get_pending_readback (self, n_complete)))
+    n_complete++;
+
+  /* Make room for the next readback. */
+  if (n_complete == 0 && self->n_pending_readbacks == N_READBACKS) {
+    glClientWaitSync (get_pending_readback (self, 0)->fence,
+                      GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    n_complete = 1;
+  }
+
+  if (n_complete == 0)
+    return FALSE;
+
+  readback = get_pending_readback (self, n_complete - 1);
+  size = readback->rowstride * readback->height;
+
+  pixels = retro_framebuffer_prepare (framebuffer, readback->pixel_format,
+                                      readback->rowstride, readback->width,
+                                      readback->height, readback->aspect_ratio);
+
+  if (pixels != NULL) {
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, readback->buffer);
+    data = glMapBufferRange (GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (data != NULL) {
+      memcpy (pixels, data, size);
+      glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+    }
+    else
+      pixels = NULL;
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  release_readbacks (self, n_complete);
+
+  check_gl_errors ("collect_readback");
+
+  return pixels != NULL;
+}
+
+static void
+queue_readback (RetroGLRenderer  *self,
+                RetroPixelFormat  pixel_format,
+                guint             width,
+                guint             height,
+                gfloat            aspect_ratio)
+{
+  RetroReadback *readback = &self->readbacks[self->next_readback];
   GLenum format, type;
+  gint pixel_size;
+  GLint pack_alignment;
+  gsize size;
+
+  g_assert (self->n_pending_readbacks < N_READBACKS);
 
-  if (!retro_pixel_format_to_gl (pixel_format, &format, &type, NULL))
+  if (!retro_pixel_format_to_gl (pixel_format, &format, &type, &pixel_size))
     return;
 
+  width = MIN (width, self->width);
+  height = MIN (height, self->height);
+
+  readback->pixel_format = pixel_format;
+  readback->rowstride = width * pixel_size;
+  readback->width = width;
+  readback->height = height;
+  readback->aspect_ratio = aspect_ratio;
+  size = readback->rowstride * height;
+
+  if (self->callback->bottom_left_origin) {
+    glBindFramebuffer (GL_READ_FRAMEBUFFER, self->framebuffer);
+    glBindFramebuffer (GL_DRAW_FRAMEBUFFER, self->flip_framebuffer);
+    glBlitFramebuffer (0, 0, width, height, 0, height, width, 0,
+                       GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer (GL_READ_FRAMEBUFFER, self->flip_framebuffer);
+  }
+  else
+    glBindFramebuffer (GL_READ_FRAMEBUFFER, self->framebuffer);
+
+  glBindBuffer (GL_PIXEL_PACK_BUFFER, readback->buffer);
+
+  if (size > readback->capacity) {
+    glBufferData (GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    readback->capacity = size;
+  }
+
+  glReadBuffer (GL_COLOR_ATTACHMENT0);
+  glGetIntegerv (GL_PACK_ALIGNMENT, &pack_alignment);
+  glPixelStorei (GL_PACK_ALIGNMENT, 1);
+  glReadPixels (0, 0, width, height, format, type, NULL);
+  glPixelStorei (GL_PACK_ALIGNMENT, pack_alignment);
+  readback->fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer (GL_FRAMEBUFFER, 0);
+
+  check_gl_errors ("queue_readback");
+
+  self->next_readback = (self->next_readback + 1) % N_READBACKS;
+  self->n_pending_readbacks++;
+}
+
+static gboolean
+snapshot_sync (RetroGLRenderer  *self,
+               RetroPixelFormat  pixel_format,
+               guint             width,
+               guint             height,
+               gfloat            aspect_ratio,
+               RetroFramebuffer *framebuffer)
+{
+  guint8 *data;
+  gsize size, rowstride;
+  GLenum format, type;
+  gint pixel_size;
+  GLint pack_alignment;
+
+  if (!retro_pixel_format_to_gl (pixel_format, &format, &type, &pixel_size))
+    return FALSE;
+
+  rowstride = width * pixel_size;
   size = rowstride * height;
 
-  if (!self->framebuffer)
-    return;
+  data = retro_framebuffer_prepare (framebuffer, pixel_format, rowstride,
+                                    width, height, aspect_ratio);
+  if (data == NULL)
+    return FALSE;
 
   if (self->callback->bottom_left_origin && size != self->last_size) {
     g_clear_pointer (&self->buf_flip, g_free);
@@ -167,8 +390,11 @@ retro_gl_renderer_snapshot (RetroRenderer    *renderer,
 
   glBindFramebuffer (GL_FRAMEBUFFER, self->framebuffer);
   glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glGetIntegerv (GL_PACK_ALIGNMENT, &pack_alignment);
+  glPixelStorei (GL_PACK_ALIGNMENT, 1);
   glReadnPixels (0, 0, width, height, format, type, size,
                  self->callback->bottom_left_origin ? self->buf_flip : data);
+  glPixelStorei (GL_PACK_ALIGNMENT, pack_alignment);
   glBindFramebuffer (GL_FRAMEBUFFER, 0);
 
   check_gl_errors ("snapshot");
@@ -177,7 +403,56 @@ retro_gl_renderer_snapshot (RetroRenderer    *renderer,
     for (gsize i = 0; i < size; i += rowstride)
       memcpy (&data[i], &self->buf_flip[size - i - rowstride], rowstride);
 
+  return TRUE;
+}
+
+static gboolean
+retro_gl_renderer_snapshot (RetroRenderer    *renderer,
+                            RetroPixelFormat  pixel_format,
+                            guint             width,
+                            guint             height,
+                            gfloat            aspect_ratio,
+                            gboolean          synchronous,
+                            RetroFramebuffer *framebuffer)
+{
+  RetroGLRenderer *self = RETRO_GL_RENDERER (renderer);
+  gboolean collected;
+
+  if (!self->framebuffer)
+    return FALSE;
+
+  if (!self->has_async_readback) {
+    collected = snapshot_sync (self, pixel_format, width, height,
+                               aspect_ratio, framebuffer);
+  }
+  else if (synchronous) {
+    /* The oldest readback is superseded by this frame anyway. */
+    if (self->n_pending_readbacks == N_READBACKS)
+      release_readbacks (self, 1);
+
+    queue_readback (self, pixel_format, width, height, aspect_ratio);
+    collected = collect_readback (self, framebuffer, TRUE);
+  }
+  else {
+    collected = collect_readback (self, framebuffer, FALSE);
+    queue_readback (self, pixel_format, width, height, aspect_ratio);
+  }
+
   eglSwapBuffers (self->display, self->context);
+
+  return collected;
+}
+
+static gboolean
+retro_gl_renderer_flush (RetroRenderer    *renderer,
+                         RetroFramebuffer *framebuffer)
+{
+  RetroGLRenderer *self = RETRO_GL_RENDERER (renderer);
+
+  if (!self->has_async_readback)
+    return FALSE;
+
+  return collect_readback (self, framebuffer, TRUE);
 }
 
 static void
@@ -204,6 +479,22 @@ retro_gl_renderer_finalize (GObject *object)
     self->framebuffer = 0;
   }
 
+  if (self->flip_renderbuffer) {
+    glDeleteRenderbuffers (1, &self->flip_renderbuffer);
+    self->flip_renderbuffer = 0;
+  }
+
+  if (self->flip_framebuffer) {
+    glDeleteFramebuffers (1, &self->flip_framebuffer);
+    self->flip_framebuffer = 0;
+  }
+
+  if (self->has_async_readback) {
+    release_readbacks (self, self->n_pending_readbacks);
+    for (gint i = 0; i < N_READBACKS; i++)
+      glDeleteBuffers (1, &self->readbacks[i].buffer);
+  }
+
   eglDestroyContext (self->display, self->context);
   self->context = EGL_NO_CONTEXT;
 
@@ -242,6 +533,7 @@ retro_renderer_interface_init (RetroRendererInterface *iface)
   iface->get_proc_address = retro_gl_renderer_get_proc_address;
   iface->get_current_framebuffer = retro_gl_renderer_get_current_framebuffer;
   iface->snapshot = retro_gl_renderer_snapshot;
+  iface->flush = retro_gl_renderer_flush;
 }
 
 static EGLConfig
@@ -0,0 +1,50 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#pragma once
+
+#if !defined(__RETRO_GTK_INSIDE__) && !defined(RETRO_GTK_COMPILATION)
+# error "Only <retro-gtk.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+#include "retro-input.h"
+#include "retro-keyboard-key-private.h"
+
+G_BEGIN_DECLS
+
+#define RETRO_TYPE_MOVIE (retro_movie_get_type())
+
+typedef struct {
+  gboolean down;
+  RetroKeyboardKey keycode;
+  guint32 character;
+  RetroKeyboardModifierKey key_modifiers;
+} RetroMovieKeyEvent;
+
+G_DECLARE_FINAL_TYPE (RetroMovie, retro_movie, RETRO, MOVIE, GObject)
+
+RetroMovie *retro_movie_new_recorder (const gchar  *filename,
+                                      GBytes       *state,
+                                      GError      **error);
+RetroMovie *retro_movie_new_player (const gchar  *filename,
+                                    GError      **error);
+
+gboolean retro_movie_get_is_recording (RetroMovie *self);
+GBytes *retro_movie_get_state (RetroMovie *self);
+guint64 retro_movie_get_frame (RetroMovie *self);
+
+void retro_movie_record_input (RetroMovie *self,
+                               guint       port,
+                               RetroInput *input,
+                               gint16      value);
+gint16 retro_movie_get_input (RetroMovie *self,
+                              guint       port,
+                              RetroInput *input);
+void retro_movie_record_key_event (RetroMovie               *self,
+                                   const RetroMovieKeyEvent *event);
+const RetroMovieKeyEvent *retro_movie_get_key_events (RetroMovie *self,
+                                                      gsize      *n_events);
+gboolean retro_movie_next_frame (RetroMovie  *self,
+                                 GError     **error);
+
+G_END_DECLS
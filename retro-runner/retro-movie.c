@@ -0,0 +1,557 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#include "retro-movie-private.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include "retro-input-private.h"
+
+#define RETRO_MOVIE_ERROR (retro_movie_error_quark ())
+
+#define MAGIC "RETROMOV"
+#define MAGIC_SIZE 8
+#define VERSION 1
+#define HEADER_SIZE (MAGIC_SIZE + 2 * sizeof (guint32))
+#define INPUT_SIZE (sizeof (guint32) + sizeof (gint16))
+#define KEY_EVENT_SIZE (3 * sizeof (guint32) + sizeof (guint8))
+
+enum {
+  RETRO_MOVIE_ERROR_COULDNT_ACCESS_FILE,
+  RETRO_MOVIE_ERROR_INVALID_FORMAT,
+};
+
+G_DEFINE_QUARK (retro-movie-error, retro_movie_error)
+
+/*
+ * A movie holds the input a core saw on each frame, so it can be replayed
+ * deterministically, e.g. to reproduce a session or to benchmark a core with
+ * a real workload.
+ *
+ * The file starts with the "RETROMOV" magic, the format version and the size
+ * of the state to start from, followed by the state itself. A size of 0 means
+ * the movie starts from power-on. Then each frame lists the inputs which were
+ * queried with a non-zero value, as their count followed by each input's key
+ * and value, then the keyboard events the core received before the frame, as
+ * their count followed by each event's key, character, modifiers and whether
+ * the key was pressed. All the numbers are little-endian.
+ *
+ * An input key packs the port, the controller type, the index and the id, as
+ * 8, 8, 4 and 12 bits from the most significant ones. Inputs which don't fit
+ * aren't recorded and are replayed as 0, as are those which weren't recorded.
+ */
+struct _RetroMovie
+{
+  GObject parent_instance;
+
+  gboolean is_recording;
+  GBytes *state;
+  guint64 frame;
+  /* The inputs of the current frame, from their key to their value. */
+  GHashTable *inputs;
+  /* The keyboard events received before the current frame, in order. */
+  GArray *key_events;
+
+  /* Recording */
+  FILE *file;
+
+  /* Playback */
+  GBytes *data;
+  gsize position;
+};
+
+G_DEFINE_TYPE (RetroMovie, retro_movie, G_TYPE_OBJECT)
+
+static inline void
+set_uint16_le (guint8  *data,
+               guint16  value)
+{
+  value = GUINT16_TO_LE (value);
+  memcpy (data, &value, sizeof (value));
+}
+
+static inline void
+set_uint32_le (guint8  *data,
+               guint32  value)
+{
+  value = GUINT32_TO_LE (value);
+  memcpy (data, &value, sizeof (value));
+}
+
+static inline guint16
+get_uint16_le (const guint8 *data)
+{
+  guint16 value;
+
+  memcpy (&value, data, sizeof (value));
+
+  return GUINT16_FROM_LE (value);
+}
+
+static inline guint32
+get_uint32_le (const guint8 *data)
+{
+  guint32 value;
+
+  memcpy (&value, data, sizeof (value));
+
+  return GUINT32_FROM_LE (value);
+}
+
+static gboolean
+get_input_key (guint       port,
+               RetroInput *input,
+               guint32    *key)
+{
+  RetroControllerType type;
+  guint id, index;
+
+  type = retro_input_get_controller_type (input) & RETRO_CONTROLLER_TYPE_TYPE_MASK;
+  id = input->any.id;
+  index = input->any.index;
+
+  if (port > 0xff || type > 0xff || index > 0xf || id > 0xfff)
+    return FALSE;
+
+  *key = port << 24 | type << 16 | index << 12 | id;
+
+  return TRUE;
+}
+
+static gboolean
+write_data (RetroMovie    *self,
+            gconstpointer  data,
+            gsize          size,
+            GError       **error)
+{
+  if (fwrite (data, 1, size, self->file) == size)
+    return TRUE;
+
+  g_set_error (error,
+               RETRO_MOVIE_ERROR,
+               RETRO_MOVIE_ERROR_COULDNT_ACCESS_FILE,
+               "Couldn't write the movie: %s", g_strerror (errno));
+
+  return FALSE;
+}
+
+static gboolean
+write_frame (RetroMovie  *self,
+             GError     **error)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  guint8 buffer[MAX (INPUT_SIZE, KEY_EVENT_SIZE)];
+  guint n_inputs, n_key_events;
+
+  n_inputs = MIN (g_hash_table_size (self->inputs), G_MAXUINT16);
+
+  set_uint16_le (buffer, n_inputs);
+  if (!write_data (self, buffer, sizeof (guint16), error))
+    return FALSE;
+
+  g_hash_table_iter_init (&iter, self->inputs);
+  while (n_inputs-- > 0 && g_hash_table_iter_next (&iter, &key, &value)) {
+    set_uint32_le (buffer, GPOINTER_TO_UINT (key));
+    set_uint16_le (buffer + sizeof (guint32), (guint16) GPOINTER_TO_INT (value));
+
+    if (!write_data (self, buffer, INPUT_SIZE, error))
+      return FALSE;
+  }
+
+  n_key_events = MIN (self->key_events->len, G_MAXUINT16);
+
+  set_uint16_le (buffer, n_key_events);
+  if (!write_data (self, buffer, sizeof (guint16), error))
+    return FALSE;
+
+  for (guint i = 0; i < n_key_events; i++) {
+    RetroMovieKeyEvent *event = &g_array_index (self->key_events, RetroMovieKeyEvent, i);
+
+    set_uint32_le (buffer, event->keycode);
+    set_uint32_le (buffer + sizeof (guint32), event->character);
+    set_uint32_le (buffer + 2 * sizeof (guint32), event->key_modifiers);
+    buffer[3 * sizeof (guint32)] = event->down ? 1 : 0;
+
+    if (!write_data (self, buffer, KEY_EVENT_SIZE, error))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+read_frame (RetroMovie  *self,
+            GError     **error)
+{
+  const guint8 *data;
+  gsize size;
+  guint n_inputs, n_key_events;
+
+  data = g_bytes_get_data (self->data, &size);
+
+  if (self->position == size)
+    return FALSE;
+
+  if (size - self->position < sizeof (guint16))
+    goto truncated;
+
+  n_inputs = get_uint16_le (data + self->position);
+  self->position += sizeof (guint16);
+
+  if ((size - self->position) / INPUT_SIZE < n_inputs)
+    goto truncated;
+
+  for (guint i = 0; i < n_inputs; i++) {
+    guint32 key = get_uint32_le (data + self->position);
+    gint16 value = (gint16) get_uint16_le (data + self->position + sizeof (guint32));
+
+    g_hash_table_insert (self->inputs, GUINT_TO_POINTER (key), GINT_TO_POINTER (value));
+    self->position += INPUT_SIZE;
+  }
+
+  if (size - self->position < sizeof (guint16))
+    goto truncated;
+
+  n_key_events = get_uint16_le (data + self->position);
+  self->position += sizeof (guint16);
+
+  if ((size - self->position) / KEY_EVENT_SIZE < n_key_events)
+    goto truncated;
+
+  for (guint i = 0; i < n_key_events; i++) {
+    RetroMovieKeyEvent event;
+
+    event.keycode = get_uint32_le (data + self->position);
+    event.character = get_uint32_le (data + self->position + sizeof (guint32));
+    event.key_modifiers = get_uint32_le (data + self->position + 2 * sizeof (guint32));
+    event.down = data[self->position + 3 * sizeof (guint32)] != 0;
+
+    g_array_append_val (self->key_events, event);
+    self->position += KEY_EVENT_SIZE;
+  }
+
+  return TRUE;
+
+truncated:
+  g_set_error (error,
+               RETRO_MOVIE_ERROR,
+               RETRO_MOVIE_ERROR_INVALID_FORMAT,
+               "Couldn't read the movie: frame %" G_GUINT64_FORMAT " is truncated.",
+               self->frame);
+
+  return FALSE;
+}
+
+static void
+retro_movie_finalize (GObject *object)
+{
+  RetroMovie *self = (RetroMovie *)object;
+
+  if (self->file != NULL)
+    fclose (self->file);
+
+  g_clear_pointer (&self->state, g_bytes_unref);
+  g_clear_pointer (&self->data, g_bytes_unref);
+  g_hash_table_unref (self->inputs);
+  g_array_unref (self->key_events);
+
+  G_OBJECT_CLASS (retro_movie_parent_class)->finalize (object);
+}
+
+static void
+retro_movie_class_init (RetroMovieClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = retro_movie_finalize;
+}
+
+static void
+retro_movie_init (RetroMovie *self)
+{
+  self->inputs = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->key_events = g_array_new (FALSE, FALSE, sizeof (RetroMovieKeyEvent));
+}
+
+/**
+ * retro_movie_new_recorder:
+ * @filename: the file to record the movie to
+ * @state: (nullable): the state the movie starts from, or %NULL to start from
+ *   power-on
+ * @error: return location for a #GError, or %NULL
+ *
+ * Creates a new #RetroMovie recording the input into @filename.
+ *
+ * Returns: (transfer full) (nullable): a new #RetroMovie, or %NULL on error
+ */
+RetroMovie *
+retro_movie_new_recorder (const gchar  *filename,
+                          GBytes       *state,
+                          GError      **error)
+{
+  g_autoptr (RetroMovie) self = NULL;
+  guint8 header[HEADER_SIZE];
+  gsize state_size = state != NULL ? g_bytes_get_size (state) : 0;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+  g_return_val_if_fail (state_size <= G_MAXUINT32, NULL);
+
+  self = g_object_new (RETRO_TYPE_MOVIE, NULL);
+  self->is_recording = TRUE;
+  self->state = state != NULL ? g_bytes_ref (state) : NULL;
+
+  self->file = g_fopen (filename, "wb");
+  if (self->file == NULL) {
+    g_set_error (error,
+                 RETRO_MOVIE_ERROR,
+                 RETRO_MOVIE_ERROR_COULDNT_ACCESS_FILE,
+                 "Couldn't open %s: %s", filename, g_strerror (errno));
+
+    return NULL;
+  }
+
+  memcpy (header, MAGIC, MAGIC_SIZE);
+  set_uint32_le (header + MAGIC_SIZE, VERSION);
+  set_uint32_le (header + MAGIC_SIZE + sizeof (guint32), state_size);
+
+  if (!write_data (self, header, HEADER_SIZE, error))
+    return NULL;
+
+  if (state_size > 0 &&
+      !write_data (self, g_bytes_get_data (state, NULL), state_size, error))
+    return NULL;
+
+  return g_steal_pointer (&self);
+}
+
+/**
+ * retro_movie_new_player:
+ * @filename: the file to play the movie from
+ * @error: return location for a #GError, or %NULL
+ *
+ * Creates a new #RetroMovie playing the input back from @filename, with the
+ * input of its first frame ready.
+ *
+ * Returns: (transfer full) (nullable): a new #RetroMovie, or %NULL on error
+ */
+RetroMovie *
+retro_movie_new_player (const gchar  *filename,
+                        GError      **error)
+{
+  g_autoptr (RetroMovie) self = NULL;
+  g_autoptr (GError) tmp_error = NULL;
+  gchar *contents;
+  const guint8 *data;
+  gsize size, state_size;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+
+  if (!g_file_get_contents (filename, &contents, &size, &tmp_error)) {
+    g_set_error (error,
+                 RETRO_MOVIE_ERROR,
+                 RETRO_MOVIE_ERROR_COULDNT_ACCESS_FILE,
+                 "Couldn't read the movie: %s", tmp_error->message);
+
+    return NULL;
+  }
+
+  self = g_object_new (RETRO_TYPE_MOVIE, NULL);
+  self->data = g_bytes_new_take (contents, size);
+  data = (const guint8 *) contents;
+
+  if (size < HEADER_SIZE ||
+      memcmp (data, MAGIC, MAGIC_SIZE) != 0 ||
+      get_uint32_le (data + MAGIC_SIZE) != VERSION) {
+    g_set_error (error,
+                 RETRO_MOVIE_ERROR,
+                 RETRO_MOVIE_ERROR_INVALID_FORMAT,
+                 "Couldn't read the movie: %s isn't a supported movie file.",
+                 filename);
+
+    return NULL;
+  }
+
+  state_size = get_uint32_le (data + MAGIC_SIZE + sizeof (guint32));
+  if (size - HEADER_SIZE < state_size) {
+    g_set_error (error,
+                 RETRO_MOVIE_ERROR,
+                 RETRO_MOVIE_ERROR_INVALID_FORMAT,
+                 "Couldn't read the movie: the state is truncated.");
+
+    return NULL;
+  }
+
+  if (state_size > 0)
+    self->state = g_bytes_new_from_bytes (self->data, HEADER_SIZE, state_size);
+
+  self->position = HEADER_SIZE + state_size;
+
+  /* A movie without frames is valid, it just plays nothing. */
+  if (!read_frame (self, &tmp_error) && tmp_error != NULL) {
+    g_propagate_error (error, g_steal_pointer (&tmp_error));
+
+    return NULL;
+  }
+
+  return g_steal_pointer (&self);
+}
+
+gboolean
+retro_movie_get_is_recording (RetroMovie *self)
+{
+  g_return_val_if_fail (RETRO_IS_MOVIE (self), FALSE);
+
+  return self->is_recording;
+}
+
+/**
+ * retro_movie_get_state:
+ * @self: a #RetroMovie
+ *
+ * Gets the state the movie starts from.
+ *
+ * Returns: (transfer none) (nullable): the state, or %NULL if the movie starts
+ * from power-on
+ */
+GBytes *
+retro_movie_get_state (RetroMovie *self)
+{
+  g_return_val_if_fail (RETRO_IS_MOVIE (self), NULL);
+
+  return self->state;
+}
+
+guint64
+retro_movie_get_frame (RetroMovie *self)
+{
+  g_return_val_if_fail (RETRO_IS_MOVIE (self), 0);
+
+  return self->frame;
+}
+
+/**
+ * retro_movie_record_input:
+ * @self: a #RetroMovie
+ * @port: the port number
+ * @input: a #RetroInput
+ * @value: the input's state
+ *
+ * Records the state of an input the core saw during the current frame.
+ */
+void
+retro_movie_record_input (RetroMovie *self,
+                          guint       port,
+                          RetroInput *input,
+                          gint16      value)
+{
+  guint32 key;
+
+  g_return_if_fail (RETRO_IS_MOVIE (self));
+  g_return_if_fail (self->is_recording);
+  g_return_if_fail (input != NULL);
+
+  /* Unrecorded inputs are replayed as 0 anyway. */
+  if (value == 0 || !get_input_key (port, input, &key))
+    return;
+
+  g_hash_table_insert (self->inputs, GUINT_TO_POINTER (key), GINT_TO_POINTER (value));
+}
+
+/**
+ * retro_movie_get_input:
+ * @self: a #RetroMovie
+ * @port: the port number
+ * @input: a #RetroInput
+ *
+ * Gets the state of an input during the current frame.
+ *
+ * Returns: the input's state
+ */
+gint16
+retro_movie_get_input (RetroMovie *self,
+                       guint       port,
+                       RetroInput *input)
+{
+  guint32 key;
+
+  g_return_val_if_fail (RETRO_IS_MOVIE (self), 0);
+  g_return_val_if_fail (!self->is_recording, 0);
+  g_return_val_if_fail (input != NULL, 0);
+
+  if (!get_input_key (port, input, &key))
+    return 0;
+
+  return GPOINTER_TO_INT (g_hash_table_lookup (self->inputs, GUINT_TO_POINTER (key)));
+}
+
+/**
+ * retro_movie_record_key_event:
+ * @self: a #RetroMovie
+ * @event: a #RetroMovieKeyEvent
+ *
+ * Records a keyboard event the core received before the current frame.
+ */
+void
+retro_movie_record_key_event (RetroMovie               *self,
+                              const RetroMovieKeyEvent *event)
+{
+  g_return_if_fail (RETRO_IS_MOVIE (self));
+  g_return_if_fail (self->is_recording);
+  g_return_if_fail (event != NULL);
+
+  g_array_append_val (self->key_events, *event);
+}
+
+/**
+ * retro_movie_get_key_events:
+ * @self: a #RetroMovie
+ * @n_events: (out): return location for the number of events
+ *
+ * Gets the keyboard events to send to the core before the current frame.
+ *
+ * Returns: (array length=n_events) (transfer none): the keyboard events
+ */
+const RetroMovieKeyEvent *
+retro_movie_get_key_events (RetroMovie *self,
+                            gsize      *n_events)
+{
+  g_return_val_if_fail (RETRO_IS_MOVIE (self), NULL);
+  g_return_val_if_fail (!self->is_recording, NULL);
+  g_return_val_if_fail (n_events != NULL, NULL);
+
+  *n_events = self->key_events->len;
+
+  return (const RetroMovieKeyEvent *) self->key_events->data;
+}
+
+/**
+ * retro_movie_next_frame:
+ * @self: a #RetroMovie
+ * @error: return location for a #GError, or %NULL
+ *
+ * Ends the current frame and starts the next one. When recording, the input
+ * of the current frame is written to the movie. When playing, the input of
+ * the next frame is read from the movie.
+ *
+ * Returns: %FALSE on error or if there is no frame left to play
+ */
+gboolean
+retro_movie_next_frame (RetroMovie  *self,
+                        GError     **error)
+{
+  g_return_val_if_fail (RETRO_IS_MOVIE (self), FALSE);
+
+  if (self->is_recording && !write_frame (self, error))
+    return FALSE;
+
+  g_hash_table_remove_all (self->inputs);
+  g_array_set_size (self->key_events, 0);
+  self->frame++;
+
+  if (!self->is_recording)
+    return read_frame (self, error);
+
+  return TRUE;
+}
@@ -0,0 +1,21 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#pragma once
+
+#if !defined(__RETRO_GTK_INSIDE__) && !defined(RETRO_GTK_COMPILATION)
+# error "Only <retro-gtk.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+#include "retro-audio-sink-private.h"
+
+G_BEGIN_DECLS
+
+#define RETRO_TYPE_NULL_AUDIO_SINK (retro_null_audio_sink_get_type())
+
+G_DECLARE_FINAL_TYPE (RetroNullAudioSink, retro_null_audio_sink, RETRO, NULL_AUDIO_SINK, GObject)
+
+RetroNullAudioSink *retro_null_audio_sink_new (void);
+guint64 retro_null_audio_sink_get_n_frames (RetroNullAudioSink *self);
+
+G_END_DECLS
@@ -0,0 +1,125 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#include "retro-null-audio-sink-private.h"
+
+#include "retro-core-private.h"
+
+/* Counts and discards the audio, so the audio path can be benchmarked on
+ * machines without any sound server. */
+struct _RetroNullAudioSink
+{
+  GObject parent_instance;
+  RetroCore *core;
+  guint64 n_frames;
+};
+
+static void retro_audio_sink_interface_init (RetroAudioSinkInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (RetroNullAudioSink, retro_null_audio_sink, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (RETRO_TYPE_AUDIO_SINK,
+                                                retro_audio_sink_interface_init))
+
+static void
+retro_null_audio_sink_finalize (GObject *object)
+{
+  RetroNullAudioSink *self = (RetroNullAudioSink *)object;
+
+  if (self->core != NULL)
+    retro_core_set_audio_sink (self->core, NULL);
+
+  g_clear_object (&self->core);
+
+  G_OBJECT_CLASS (retro_null_audio_sink_parent_class)->finalize (object);
+}
+
+static void
+retro_null_audio_sink_class_init (RetroNullAudioSinkClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = retro_null_audio_sink_finalize;
+}
+
+static void
+retro_null_audio_sink_init (RetroNullAudioSink *self)
+{
+}
+
+static void
+pulled_audio_cb (const gint16 *frames,
+                 gsize         n_frames,
+                 gpointer      user_data)
+{
+}
+
+static void
+retro_null_audio_sink_set_core (RetroAudioSink *sink,
+                                RetroCore      *core)
+{
+  RetroNullAudioSink *self = RETRO_NULL_AUDIO_SINK (sink);
+
+  if (self->core == core)
+    return;
+
+  if (self->core != NULL) {
+    retro_core_set_audio_sink (self->core, NULL);
+    g_clear_object (&self->core);
+  }
+
+  if (core != NULL) {
+    self->core = g_object_ref (core);
+    retro_core_set_audio_sink (core, RETRO_AUDIO_SINK (self));
+  }
+}
+
+static void
+retro_null_audio_sink_audio_output (RetroAudioSink *sink,
+                                    const gint16   *frames,
+                                    gsize           n_frames,
+                                    gdouble         sample_rate)
+{
+  RetroNullAudioSink *self = RETRO_NULL_AUDIO_SINK (sink);
+
+  /* Without any playback thread to ask for it, pull the audio of cores with
+   * an audio callback once per iteration so it is still produced. */
+  if (retro_core_has_audio_callback (self->core))
+    n_frames += retro_core_pull_audio (self->core, pulled_audio_cb, self);
+
+  self->n_frames += n_frames;
+}
+
+static void
+retro_audio_sink_interface_init (RetroAudioSinkInterface *iface)
+{
+  iface->set_core = retro_null_audio_sink_set_core;
+  iface->audio_output = retro_null_audio_sink_audio_output;
+}
+
+/**
+ * retro_null_audio_sink_new:
+ *
+ * Creates a new #RetroNullAudioSink.
+ *
+ * Returns: (transfer full): a new #RetroNullAudioSink
+ */
+RetroNullAudioSink *
+retro_null_audio_sink_new (void)
+{
+  return g_object_new (RETRO_TYPE_NULL_AUDIO_SINK, NULL);
+}
+
+/**
+ * retro_null_audio_sink_get_n_frames:
+ * @self: a #RetroNullAudioSink
+ *
+ * Gets the number of frames @self received and discarded.
+ *
+ * Returns: the number of frames
+ */
+guint64
+retro_null_audio_sink_get_n_frames (RetroNullAudioSink *self)
+{
+  g_return_val_if_fail (RETRO_IS_NULL_AUDIO_SINK (self), 0);
+
+  return self->n_frames;
+}
@@ -7,18 +7,26 @@
 #endif
 
 #include <glib-object.h>
+#include "retro-audio-sink-private.h"
+#include "retro-resampler-quality.h"
 
 G_BEGIN_DECLS
 
-// FIXME Remove as soon as possible.
-typedef struct _RetroCore RetroCore;
-
 #define RETRO_TYPE_PA_PLAYER (retro_pa_player_get_type())
 
 G_DECLARE_FINAL_TYPE (RetroPaPlayer, retro_pa_player, RETRO, PA_PLAYER, GObject)
 
 RetroPaPlayer *retro_pa_player_new (void);
-void retro_pa_player_set_core (RetroPaPlayer *self,
-                               RetroCore     *core);
+guint retro_pa_player_get_latency (RetroPaPlayer *self);
+void retro_pa_player_set_latency (RetroPaPlayer *self,
+                                  guint          latency);
+gboolean retro_pa_player_get_dynamic_rate_control (RetroPaPlayer *self);
+void retro_pa_player_set_dynamic_rate_control (RetroPaPlayer *self,
+                                               gboolean       dynamic_rate_control);
+gdouble retro_pa_player_get_measured_latency (RetroPaPlayer *self);
+gdouble retro_pa_player_get_rate_adjustment (RetroPaPlayer *self);
+RetroResamplerQuality retro_pa_player_get_resampler_quality (RetroPaPlayer *self);
+void retro_pa_player_set_resampler_quality (RetroPaPlayer         *self,
+                                            RetroResamplerQuality  resampler_quality);
 
 G_END_DECLS
@@ -4,58 +4,446 @@
 
 #include "retro-pa-player-private.h"
 
+#include "retro-audio-ring-private.h"
 #include "retro-core-private.h"
-#include <pulse/simple.h>
 #include <pulse/pulseaudio.h>
+#include <math.h>
 #include <samplerate.h>
+#include <string.h>
 
+#ifdef __SSE2__
+#define RETRO_PA_PLAYER_SSE2
+#include <emmintrin.h>
+#endif
+
+#define FRAME_SIZE (2 * sizeof (gint16))
+#define DEFAULT_LATENCY 64
+/* How much the resampling ratio can be nudged to hold the target latency, it
+ * is small enough for the pitch shift to be inaudible. */
+#define MAX_RATE_SKEW 0.005
+
+/* The audio is played by an asynchronous stream driven by PulseAudio's own
+ * thread, which pulls the frames from a lock-free ring fed by the core's
+ * thread. Backpressure from the server then never blocks the core. */
 struct _RetroPaPlayer
 {
   GObject parent_instance;
   RetroCore *core;
-  gulong audio_output_cb_id;
-  gulong iterated_cb_id;
-  GArray *buffer;
+  /* Scratch buffers for the resampler, they only ever grow. */
+  gfloat *samples_in;
+  gsize samples_in_capacity;
+  gfloat *samples_out;
+  gsize samples_out_capacity;
   gdouble sample_rate;
-  pa_simple *simple;
+  guint latency;
+  gboolean dynamic_rate_control;
+  gdouble measured_latency;
+  gdouble rate_adjustment;
+  RetroResamplerQuality resampler_quality;
   SRC_STATE *src;
+  /* The nudges of the dynamic rate control alone are tiny, a cheap resampler
+   * is enough for them. */
+  SRC_STATE *adjustment_src;
+  /* The resampler used for the last output, or NULL if it was bypassed. */
+  SRC_STATE *active_src;
+  gdouble resampling_ratio;
+
+  /* Updated from both threads, hence atomic. */
+  volatile gint n_underruns;
+  volatile gint n_dropped_frames;
+  /* The latency of the server in microseconds, published by PulseAudio's
+   * thread so the core's thread never has to take the main loop's lock. */
+  volatile gint stream_latency;
+
+  pa_threaded_mainloop *mainloop;
+  pa_context *context;
+  pa_stream *stream;
+  RetroAudioRing *ring;
+};
+
+static void retro_audio_sink_interface_init (RetroAudioSinkInterface *iface);
+static void pull_audio (RetroPaPlayer *self,
+                        gsize          n_frames);
+
+G_DEFINE_TYPE_WITH_CODE (RetroPaPlayer, retro_pa_player, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (RETRO_TYPE_AUDIO_SINK,
+                                                retro_audio_sink_interface_init))
+
+enum {
+  PROP_0,
+  PROP_LATENCY,
+  PROP_DYNAMIC_RATE_CONTROL,
+  PROP_RESAMPLER_QUALITY,
+  N_PROPS,
 };
 
-G_DEFINE_TYPE (RetroPaPlayer, retro_pa_player, G_TYPE_OBJECT)
+static GParamSpec *properties [N_PROPS];
 
 /* Private */
 
+/* To be called with the main loop locked. */
+static void
+disconnect_stream (RetroPaPlayer *self)
+{
+  if (self->stream == NULL)
+    return;
+
+  pa_stream_set_state_callback (self->stream, NULL, NULL);
+  pa_stream_set_write_callback (self->stream, NULL, NULL);
+  pa_stream_set_latency_update_callback (self->stream, NULL, NULL);
+  pa_stream_set_underflow_callback (self->stream, NULL, NULL);
+  pa_stream_disconnect (self->stream);
+  g_clear_pointer (&self->stream, pa_stream_unref);
+}
+
+static void
+stop_playback (RetroPaPlayer *self)
+{
+  if (self->mainloop == NULL)
+    return;
+
+  pa_threaded_mainloop_lock (self->mainloop);
+  disconnect_stream (self);
+  pa_threaded_mainloop_unlock (self->mainloop);
+
+  /* Force the stream to be recreated on the next audio output. */
+  self->sample_rate = 0;
+}
+
+static void
+disconnect_context (RetroPaPlayer *self)
+{
+  if (self->mainloop == NULL)
+    return;
+
+  pa_threaded_mainloop_lock (self->mainloop);
+  disconnect_stream (self);
+  if (self->context != NULL) {
+    pa_context_set_state_callback (self->context, NULL, NULL);
+    pa_context_disconnect (self->context);
+    g_clear_pointer (&self->context, pa_context_unref);
+  }
+  pa_threaded_mainloop_unlock (self->mainloop);
+
+  pa_threaded_mainloop_stop (self->mainloop);
+  g_clear_pointer (&self->mainloop, pa_threaded_mainloop_free);
+}
+
 static void
 retro_pa_player_finalize (GObject *object)
 {
   RetroPaPlayer *self = (RetroPaPlayer *)object;
 
+  if (self->core != NULL)
+    retro_core_set_audio_sink (self->core, NULL);
+
+  disconnect_context (self);
+
   g_clear_object (&self->core);
-  g_clear_pointer (&self->simple, pa_simple_free);
   g_clear_pointer (&self->src, src_delete);
-  g_array_unref (self->buffer);
+  g_clear_pointer (&self->adjustment_src, src_delete);
+  g_clear_pointer (&self->ring, retro_audio_ring_free);
+  g_free (self->samples_in);
+  g_free (self->samples_out);
 
   G_OBJECT_CLASS (retro_pa_player_parent_class)->finalize (object);
 }
 
+static void
+retro_pa_player_get_property (GObject    *object,
+                              guint       prop_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+  RetroPaPlayer *self = RETRO_PA_PLAYER (object);
+
+  switch (prop_id) {
+  case PROP_LATENCY:
+    g_value_set_uint (value, retro_pa_player_get_latency (self));
+
+    break;
+  case PROP_DYNAMIC_RATE_CONTROL:
+    g_value_set_boolean (value, retro_pa_player_get_dynamic_rate_control (self));
+
+    break;
+  case PROP_RESAMPLER_QUALITY:
+    g_value_set_enum (value, retro_pa_player_get_resampler_quality (self));
+
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+
+    break;
+  }
+}
+
+static void
+retro_pa_player_set_property (GObject      *object,
+                              guint         prop_id,
+                              const GValue *value,
+                              GParamSpec   *pspec)
+{
+  RetroPaPlayer *self = RETRO_PA_PLAYER (object);
+
+  switch (prop_id) {
+  case PROP_LATENCY:
+    retro_pa_player_set_latency (self, g_value_get_uint (value));
+
+    break;
+  case PROP_DYNAMIC_RATE_CONTROL:
+    retro_pa_player_set_dynamic_rate_control (self, g_value_get_boolean (value));
+
+    break;
+  case PROP_RESAMPLER_QUALITY:
+    retro_pa_player_set_resampler_quality (self, g_value_get_enum (value));
+
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+
+    break;
+  }
+}
+
 static void
 retro_pa_player_class_init (RetroPaPlayerClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
   object_class->finalize = retro_pa_player_finalize;
+  object_class->get_property = retro_pa_player_get_property;
+  object_class->set_property = retro_pa_player_set_property;
+
+  /**
+   * RetroPaPlayer:latency:
+   *
+   * The audio latency to target, in milliseconds. Half of it is buffered by
+   * the server, the other half is left to absorb jitter between iterations.
+   */
+  properties[PROP_LATENCY] =
+    g_param_spec_uint ("latency",
+                       "Latency",
+                       "The target latency in milliseconds",
+                       1,
+                       1000,
+                       DEFAULT_LATENCY,
+                       G_PARAM_READWRITE |
+                       G_PARAM_EXPLICIT_NOTIFY |
+                       G_PARAM_STATIC_NAME |
+                       G_PARAM_STATIC_NICK |
+                       G_PARAM_STATIC_BLURB);
+
+  /**
+   * RetroPaPlayer:dynamic-rate-control:
+   *
+   * Whether to nudge the resampling ratio to hold the target latency. This
+   * compensates for the drift between the clocks of the core and of the sound
+   * card, but the audio then always has to be resampled. Unless the speed rate
+   * also requires resampling, a cheap linear resampler is used for that.
+   */
+  properties[PROP_DYNAMIC_RATE_CONTROL] =
+    g_param_spec_boolean ("dynamic-rate-control",
+                          "Dynamic rate control",
+                          "Whether to adjust the resampling ratio to hold the target latency",
+                          TRUE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_EXPLICIT_NOTIFY |
+                          G_PARAM_STATIC_NAME |
+                          G_PARAM_STATIC_NICK |
+                          G_PARAM_STATIC_BLURB);
+
+  /**
+   * RetroPaPlayer:resampler-quality:
+   *
+   * The quality of the resampler used to play the audio at the speed rate of
+   * the core.
+   */
+  properties[PROP_RESAMPLER_QUALITY] =
+    g_param_spec_enum ("resampler-quality",
+                       "Resampler quality",
+                       "The quality of the audio resampler",
+                       RETRO_TYPE_RESAMPLER_QUALITY,
+                       RETRO_RESAMPLER_QUALITY_BEST,
+                       G_PARAM_READWRITE |
+                       G_PARAM_EXPLICIT_NOTIFY |
+                       G_PARAM_STATIC_NAME |
+                       G_PARAM_STATIC_NICK |
+                       G_PARAM_STATIC_BLURB);
+
+  g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
-static void
-retro_pa_player_init (RetroPaPlayer *self)
+static gint
+get_converter_type (RetroResamplerQuality resampler_quality)
 {
+  switch (resampler_quality) {
+  case RETRO_RESAMPLER_QUALITY_BEST:
+    return SRC_SINC_BEST_QUALITY;
+  case RETRO_RESAMPLER_QUALITY_MEDIUM:
+    return SRC_SINC_MEDIUM_QUALITY;
+  case RETRO_RESAMPLER_QUALITY_FASTEST:
+    return SRC_SINC_FASTEST;
+  case RETRO_RESAMPLER_QUALITY_LINEAR:
+    return SRC_LINEAR;
+  case RETRO_RESAMPLER_QUALITY_ZERO_ORDER_HOLD:
+    return SRC_ZERO_ORDER_HOLD;
+  default:
+    g_assert_not_reached ();
+  }
+}
+
+static SRC_STATE *
+new_resampler (gint converter_type)
+{
+  SRC_STATE *src;
   gint error;
 
-  self->buffer = g_array_new (FALSE, FALSE, sizeof (gint16));
-  self->src = src_new (SRC_SINC_BEST_QUALITY, 2, &error);
+  src = src_new (converter_type, 2, &error);
 
-  if (!self->src)
+  if (!src)
     g_error ("Couldn't set up libsamplerate: %s", src_strerror (error));
+
+  return src;
+}
+
+static void
+create_resampler (RetroPaPlayer *self)
+{
+  if (self->active_src == self->src)
+    self->active_src = NULL;
+
+  g_clear_pointer (&self->src, src_delete);
+  self->src = new_resampler (get_converter_type (self->resampler_quality));
+}
+
+static void
+retro_pa_player_init (RetroPaPlayer *self)
+{
+  self->latency = DEFAULT_LATENCY;
+  self->dynamic_rate_control = TRUE;
+  self->rate_adjustment = 1.0;
+  self->resampling_ratio = 1.0;
+  self->resampler_quality = RETRO_RESAMPLER_QUALITY_BEST;
+
+  create_resampler (self);
+  self->adjustment_src = new_resampler (SRC_LINEAR);
+}
+
+static void
+context_state_cb (pa_context *context,
+                  gpointer    user_data)
+{
+  RetroPaPlayer *self = RETRO_PA_PLAYER (user_data);
+
+  pa_threaded_mainloop_signal (self->mainloop, 0);
+}
+
+static void
+stream_state_cb (pa_stream *stream,
+                 gpointer   user_data)
+{
+  RetroPaPlayer *self = RETRO_PA_PLAYER (user_data);
+
+  pa_threaded_mainloop_signal (self->mainloop, 0);
+}
+
+/* Called from PulseAudio's thread, with the main loop's lock held. */
+static void
+publish_stream_latency (RetroPaPlayer *self)
+{
+  pa_usec_t stream_latency = 0;
+  gint negative = 0;
+
+  if (pa_stream_get_latency (self->stream, &stream_latency, &negative) < 0 || negative)
+    stream_latency = 0;
+
+  g_atomic_int_set (&self->stream_latency, (gint) MIN (stream_latency, G_MAXINT));
+}
+
+/* Called from PulseAudio's thread on timing updates. */
+static void
+stream_latency_update_cb (pa_stream *stream,
+                          gpointer   user_data)
+{
+  publish_stream_latency (RETRO_PA_PLAYER (user_data));
+}
+
+/* Called from PulseAudio's thread when the server ran out of audio to play. */
+static void
+stream_underflow_cb (pa_stream *stream,
+                     gpointer   user_data)
+{
+  RetroPaPlayer *self = RETRO_PA_PLAYER (user_data);
+
+  g_atomic_int_inc (&self->n_underruns);
+}
+
+/* Called from PulseAudio's thread. */
+static void
+stream_write_cb (pa_stream *stream,
+                 gsize      n_bytes,
+                 gpointer   user_data)
+{
+  RetroPaPlayer *self = RETRO_PA_PLAYER (user_data);
+  gpointer data = NULL;
+  gsize n_frames, n_read;
+
+  if (pa_stream_begin_write (stream, &data, &n_bytes) < 0 || data == NULL)
+    return;
+
+  n_frames = n_bytes / FRAME_SIZE;
+
+  if (retro_core_has_audio_callback (self->core))
+    pull_audio (self, n_frames);
+
+  n_read = retro_audio_ring_read (self->ring, data, n_frames);
+
+  /* Fill short reads with silence, the stream wouldn't request more data
+   * otherwise. */
+  memset ((gint16 *) data + n_read * 2, 0, (n_frames - n_read) * FRAME_SIZE);
+
+  pa_stream_write (stream, data, n_frames * FRAME_SIZE, NULL, 0, PA_SEEK_RELATIVE);
+
+  publish_stream_latency (self);
+}
+
+static gboolean
+connect_context (RetroPaPlayer *self)
+{
+  pa_context_state_t state;
+
+  if (self->context != NULL)
+    return TRUE;
+
+  self->mainloop = pa_threaded_mainloop_new ();
+  self->context = pa_context_new (pa_threaded_mainloop_get_api (self->mainloop),
+                                  "retro-gtk");
+  pa_context_set_state_callback (self->context, context_state_cb, self);
+
+  if (pa_context_connect (self->context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0 ||
+      pa_threaded_mainloop_start (self->mainloop) < 0) {
+    g_critical ("Couldn't connect to PulseAudio: %s",
+                pa_strerror (pa_context_errno (self->context)));
+    disconnect_context (self);
+
+    return FALSE;
+  }
+
+  pa_threaded_mainloop_lock (self->mainloop);
+  while ((state = pa_context_get_state (self->context)) != PA_CONTEXT_READY &&
+         PA_CONTEXT_IS_GOOD (state))
+    pa_threaded_mainloop_wait (self->mainloop);
+  pa_threaded_mainloop_unlock (self->mainloop);
+
+  if (state != PA_CONTEXT_READY) {
+    g_critical ("Couldn't connect to PulseAudio: %s",
+                pa_strerror (pa_context_errno (self->context)));
+    disconnect_context (self);
+
+    return FALSE;
+  }
+
+  return TRUE;
 }
 
 static void
@@ -63,169 +451,511 @@ prepare_for_sample_rate (RetroPaPlayer *self,
                          gdouble        sample_rate)
 {
   pa_sample_spec sample_spec = {0};
-  gint error;
+  pa_buffer_attr buffer_attr;
+  pa_stream_state_t state;
 
-  self->sample_rate = sample_rate;
+  if (!connect_context (self))
+    return;
 
   pa_sample_spec_init (&sample_spec);
   sample_spec.format = PA_SAMPLE_S16NE;
   sample_spec.rate = (guint32) sample_rate;
   sample_spec.channels = 2;
 
-  g_clear_pointer (&self->simple, pa_simple_free);
-  self->simple = pa_simple_new (NULL, NULL, PA_STREAM_PLAYBACK, NULL, "",
-                                &sample_spec, NULL, NULL, &error);
-  if (!self->simple) {
-      g_critical ("pa_simple_new() failed: %s", pa_strerror(error));
+  buffer_attr.maxlength = (guint32) -1;
+  buffer_attr.tlength = pa_usec_to_bytes (self->latency * PA_USEC_PER_MSEC / 2, &sample_spec);
+  buffer_attr.prebuf = (guint32) -1;
+  buffer_attr.minreq = (guint32) -1;
+  buffer_attr.fragsize = (guint32) -1;
+
+  pa_threaded_mainloop_lock (self->mainloop);
+
+  disconnect_stream (self);
+
+  self->sample_rate = sample_rate;
+  g_atomic_int_set (&self->stream_latency, 0);
+
+  /* Hold up to a second of audio, far above the target latency, so frames are
+   * dropped only if the server stalls. */
+  g_clear_pointer (&self->ring, retro_audio_ring_free);
+  self->ring = retro_audio_ring_new (MAX (sample_spec.rate, 1));
+
+  self->stream = pa_stream_new (self->context, "retro-gtk", &sample_spec, NULL);
+  pa_stream_set_state_callback (self->stream, stream_state_cb, self);
+  pa_stream_set_write_callback (self->stream, stream_write_cb, self);
+  pa_stream_set_latency_update_callback (self->stream, stream_latency_update_cb, self);
+  pa_stream_set_underflow_callback (self->stream, stream_underflow_cb, self);
+
+  if (pa_stream_connect_playback (self->stream, NULL, &buffer_attr,
+                                  PA_STREAM_ADJUST_LATENCY |
+                                  PA_STREAM_INTERPOLATE_TIMING |
+                                  PA_STREAM_AUTO_TIMING_UPDATE,
+                                  NULL, NULL) < 0)
+    state = PA_STREAM_FAILED;
+  else
+    while ((state = pa_stream_get_state (self->stream)) != PA_STREAM_READY &&
+           PA_STREAM_IS_GOOD (state))
+      pa_threaded_mainloop_wait (self->mainloop);
+
+  if (state != PA_STREAM_READY) {
+    g_critical ("Couldn't create the PulseAudio stream: %s",
+                pa_strerror (pa_context_errno (self->context)));
+    disconnect_stream (self);
   }
+
+  pa_threaded_mainloop_unlock (self->mainloop);
 }
 
+/* Same scaling as libsamplerate's src_short_to_float_array(). */
 static void
-resample (RetroPaPlayer *self,
-          gdouble        ratio)
+s16_to_float (const gint16 *in,
+              gfloat       *out,
+              gsize         length)
 {
-  g_autofree gfloat *data_in = NULL;
-  g_autofree gfloat *data_out = NULL;
-  gint error;
-  gsize frames_used_in, frames_used_out, length;
+  gsize i = 0;
+
+#ifdef RETRO_PA_PLAYER_SSE2
+  const __m128 scale = _mm_set1_ps (1.0f / 0x8000);
+
+  for (; i + 8 <= length; i += 8) {
+    __m128i s = _mm_loadu_si128 ((const __m128i *) (in + i));
+    /* Sign extend by unpacking into the high halves and shifting back. */
+    __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (s, s), 16);
+    __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (s, s), 16);
+
+    _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (lo), scale));
+    _mm_storeu_ps (out + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (hi), scale));
+  }
+#endif
+
+  for (; i < length; i++)
+    out[i] = in[i] * (1.0f / 0x8000);
+}
+
+/* Same scaling and clipping as libsamplerate's src_float_to_short_array(). */
+static void
+float_to_s16 (const gfloat *in,
+              gint16       *out,
+              gsize         length)
+{
+  gsize i = 0;
+
+#ifdef RETRO_PA_PLAYER_SSE2
+  const __m128 scale = _mm_set1_ps (0x8000);
+  const __m128 max = _mm_set1_ps (0x7fff);
+  const __m128 min = _mm_set1_ps (-0x8000);
+
+  for (; i + 8 <= length; i += 8) {
+    __m128 lo = _mm_mul_ps (_mm_loadu_ps (in + i), scale);
+    __m128 hi = _mm_mul_ps (_mm_loadu_ps (in + i + 4), scale);
+
+    lo = _mm_max_ps (_mm_min_ps (lo, max), min);
+    hi = _mm_max_ps (_mm_min_ps (hi, max), min);
+
+    _mm_storeu_si128 ((__m128i *) (out + i),
+                      _mm_packs_epi32 (_mm_cvtps_epi32 (lo), _mm_cvtps_epi32 (hi)));
+  }
+#endif
+
+  for (; i < length; i++)
+    out[i] = (gint16) lrintf (CLAMP (in[i] * 0x8000, -0x8000, 0x7fff));
+}
+
+static gfloat *
+reserve_samples (gfloat **samples,
+                 gsize   *capacity,
+                 gsize    length)
+{
+  if (length > *capacity) {
+    g_free (*samples);
+    *samples = g_new (gfloat, length);
+    *capacity = length;
+  }
 
-  length = self->buffer->len;
+  return *samples;
+}
+
+/* Frames which don't fit in the ring are dropped rather than waited for. */
+static void
+write_frames (RetroPaPlayer *self,
+              const gint16  *frames,
+              const gfloat  *samples,
+              gsize          n_frames)
+{
+  while (n_frames > 0) {
+    gsize n_writable;
+    gint16 *dest = retro_audio_ring_begin_write (self->ring, &n_writable);
 
-  data_in = g_new (gfloat, length);
-  data_out = g_new (gfloat, length);
+    if (n_writable == 0) {
+      g_atomic_int_add (&self->n_dropped_frames, n_frames);
 
-  src_short_to_float_array ((gint16 *) self->buffer->data,
-                            data_in,
-                            length);
+      return;
+    }
 
-  g_array_set_size (self->buffer, 0);
+    n_writable = MIN (n_writable, n_frames);
 
-  frames_used_in = 0;
-  frames_used_out = 0;
-  while (frames_used_in < length / 2) {
-    SRC_DATA data;
+    if (samples != NULL) {
+      float_to_s16 (samples, dest, n_writable * 2);
+      samples += n_writable * 2;
+    }
+    else {
+      memcpy (dest, frames, n_writable * 2 * sizeof (gint16));
+      frames += n_writable * 2;
+    }
+
+    retro_audio_ring_end_write (self->ring, n_writable);
+    n_frames -= n_writable;
+  }
+}
+
+static void
+pulled_audio_cb (const gint16 *frames,
+                 gsize         n_frames,
+                 gpointer      user_data)
+{
+  write_frames (RETRO_PA_PLAYER (user_data), frames, NULL, n_frames);
+}
+
+/*
+ * Called from PulseAudio's thread for cores with an audio callback, which is
+ * then the only producer of the ring. Pulls audio from the core until the
+ * ring holds what the stream asks for, or until the core doesn't produce
+ * anything.
+ */
+static void
+pull_audio (RetroPaPlayer *self,
+            gsize          n_frames)
+{
+  while (retro_audio_ring_get_n_readable (self->ring) < n_frames)
+    if (retro_core_pull_audio (self->core, pulled_audio_cb, self) == 0)
+      break;
+}
 
-    data.data_in = data_in + frames_used_in * sizeof (gfloat);
-    data.data_out = data_out;
-    data.input_frames = length / 2 - frames_used_in;
-    data.output_frames = length / 2;
-    data.src_ratio = ratio;
-    data.end_of_input = 0;
+static void
+resample (RetroPaPlayer *self,
+          SRC_STATE     *src,
+          const gint16  *frames,
+          gsize          n_frames,
+          gdouble        ratio)
+{
+  SRC_DATA data = { 0 };
+  gint error;
 
-    error = src_process (self->src, &data);
+  data.output_frames = (glong) ceil (n_frames * ratio) + 1;
+  data.data_in = reserve_samples (&self->samples_in,
+                                  &self->samples_in_capacity,
+                                  n_frames * 2);
+  data.data_out = reserve_samples (&self->samples_out,
+                                   &self->samples_out_capacity,
+                                   data.output_frames * 2);
+  data.input_frames = n_frames;
+  data.src_ratio = ratio;
+  data.end_of_input = 0;
+
+  s16_to_float (frames, self->samples_in, n_frames * 2);
+
+  while (data.input_frames > 0) {
+    error = src_process (src, &data);
     if (error) {
       g_critical ("Couldn't resample the audio: %s", src_strerror (error));
 
       return;
     }
 
-    g_array_set_size (self->buffer,
-                      frames_used_out + data.output_frames_gen * 2);
-    src_float_to_short_array (data_out,
-                              (gint16 *) (self->buffer->data +
-                              frames_used_out * sizeof (gint16)),
-                              data.output_frames_gen * 2);
+    write_frames (self, NULL, data.data_out, data.output_frames_gen);
+
+    if (data.input_frames_used == 0 && data.output_frames_gen == 0)
+      return;
 
-    frames_used_in += data.input_frames_used * 2;
-    frames_used_out += data.output_frames_gen * 2;
+    data.data_in += data.input_frames_used * 2;
+    data.input_frames -= data.input_frames_used;
   }
 }
 
-static void
-audio_output_cb (RetroCore     *sender,
-                 gint16        *data,
-                 int            length,
-                 gdouble        sample_rate,
-                 RetroPaPlayer *self)
+/*
+ * Measures the queued latency, both in the ring and in the server, and
+ * returns the factor to apply to the resampling ratio to bring it back to the
+ * target latency: more frames are produced when the latency is below the
+ * target, and fewer when it is above.
+ */
+static gdouble
+update_rate_adjustment (RetroPaPlayer *self)
 {
-  g_array_append_vals (self->buffer, data, length);
+  gdouble direction;
+
+  self->measured_latency =
+    retro_audio_ring_get_n_readable (self->ring) * 1000.0 / self->sample_rate +
+    g_atomic_int_get (&self->stream_latency) / (gdouble) PA_USEC_PER_MSEC;
+
+  if (!self->dynamic_rate_control) {
+    self->rate_adjustment = 1.0;
+
+    return self->rate_adjustment;
+  }
+
+  direction = (self->latency - self->measured_latency) / self->latency;
+  self->rate_adjustment = 1.0 + MAX_RATE_SKEW * CLAMP (direction, -1.0, 1.0);
+
+  return self->rate_adjustment;
 }
 
 static void
-iterated_cb (RetroCore     *core,
-             RetroPaPlayer *self)
+retro_pa_player_set_core (RetroAudioSink *sink,
+                          RetroCore      *core)
 {
-  gdouble sample_rate, speed_rate;
+  RetroPaPlayer *self = RETRO_PA_PLAYER (sink);
 
-  if (retro_core_is_running_ahead (self->core))
+  if (self->core == core)
     return;
 
-  if (self->buffer->len == 0)
-    return;
+  /* PulseAudio's thread may pull audio from the core. */
+  stop_playback (self);
+
+  if (self->core != NULL) {
+    retro_core_set_audio_sink (self->core, NULL);
+    g_clear_object (&self->core);
+  }
+
+  if (core != NULL) {
+    self->core = g_object_ref (core);
+    retro_core_set_audio_sink (core, RETRO_AUDIO_SINK (self));
+  }
+
+  src_reset (self->src);
+  src_reset (self->adjustment_src);
+}
+
+static void
+retro_pa_player_audio_output (RetroAudioSink *sink,
+                              const gint16   *frames,
+                              gsize           n_frames,
+                              gdouble         sample_rate)
+{
+  RetroPaPlayer *self = RETRO_PA_PLAYER (sink);
+  gdouble speed_rate, ratio;
+  SRC_STATE *src;
 
-  sample_rate = retro_core_get_sample_rate (self->core);
   speed_rate = retro_core_get_speed_rate (self->core);
 
   // Libsamplerate cannot resample audio with rates outside this range
   // Since audio isn't going to be useful at these rates anyway, just bail.
   if (speed_rate < 1.0 / 256.0 || speed_rate > 256.0) {
-    g_array_set_size (self->buffer, 0);
-
     g_debug ("Can’t resample the audio for speed rates lower than 1/256 or greater than 256. The audio won’t be played.");
 
     return;
   }
 
-  if (self->simple == NULL || sample_rate != self->sample_rate)
+  if (self->stream == NULL || sample_rate != self->sample_rate)
     prepare_for_sample_rate (self, sample_rate);
 
-  if (self->simple == NULL)
+  if (self->stream == NULL)
+    return;
+
+  /* The audio is pulled from the audio callback by PulseAudio's thread, which
+   * must be the only producer of the ring. Audio produced during iterations
+   * is dropped. */
+  if (retro_core_has_audio_callback (self->core))
     return;
 
-  resample (self, 1 / speed_rate);
+  ratio = update_rate_adjustment (self) / speed_rate;
+  self->resampling_ratio = ratio;
 
-  pa_simple_write (self->simple,
-                   self->buffer->data,
-                   self->buffer->len * sizeof (gint16),
-                   NULL);
+  /* Resampling at a ratio of 1 is a costly no-op. */
+  if (ratio == 1.0)
+    src = NULL;
+  else if (speed_rate == 1.0)
+    src = self->adjustment_src;
+  else
+    src = self->src;
 
-  g_array_set_size (self->buffer, 0);
+  /* Don't carry over the state from before switching resamplers. */
+  if (src != NULL && src != self->active_src)
+    src_reset (src);
+
+  if (src != NULL)
+    resample (self, src, frames, n_frames, ratio);
+  else
+    write_frames (self, frames, NULL, n_frames);
+
+  self->active_src = src;
+}
+
+static void
+retro_pa_player_get_stats (RetroAudioSink  *sink,
+                           RetroAudioStats *stats)
+{
+  RetroPaPlayer *self = RETRO_PA_PLAYER (sink);
+
+  stats->resampling_ratio = self->resampling_ratio;
+  stats->latency = self->measured_latency;
+  stats->n_underruns = g_atomic_int_get (&self->n_underruns);
+  stats->n_dropped_frames = g_atomic_int_get (&self->n_dropped_frames);
+}
+
+static void
+retro_audio_sink_interface_init (RetroAudioSinkInterface *iface)
+{
+  iface->set_core = retro_pa_player_set_core;
+  iface->audio_output = retro_pa_player_audio_output;
+  iface->get_stats = retro_pa_player_get_stats;
 }
 
 /* Public */
 
 /**
- * retro_pa_player_set_core:
+ * retro_pa_player_get_latency:
  * @self: a #RetroPaPlayer
- * @core: (nullable): a #RetroCore, or %NULL
  *
- * Sets @core as the #RetroCore played by @self.
+ * Gets the latency targeted by the audio stream of @self.
+ *
+ * Returns: the target latency in milliseconds
+ */
+guint
+retro_pa_player_get_latency (RetroPaPlayer *self)
+{
+  g_return_val_if_fail (RETRO_IS_PA_PLAYER (self), 0);
+
+  return self->latency;
+}
+
+/**
+ * retro_pa_player_set_latency:
+ * @self: a #RetroPaPlayer
+ * @latency: the target latency in milliseconds
+ *
+ * Sets the latency targeted by the audio stream of @self. Lower latencies make
+ * the audio more responsive but more prone to underruns.
  */
 void
-retro_pa_player_set_core (RetroPaPlayer *self,
-                          RetroCore     *core)
+retro_pa_player_set_latency (RetroPaPlayer *self,
+                             guint          latency)
 {
   g_return_if_fail (RETRO_IS_PA_PLAYER (self));
+  g_return_if_fail (latency > 0);
 
-  if (self->core == core)
+  if (self->latency == latency)
     return;
 
-  if (self->core != NULL) {
-    g_signal_handler_disconnect (G_OBJECT (self->core),
-                                 self->audio_output_cb_id);
-    g_signal_handler_disconnect (G_OBJECT (self->core),
-                                 self->iterated_cb_id);
-    g_clear_object (&self->core);
-  }
+  self->latency = latency;
 
-  if (core != NULL) {
-    self->core = g_object_ref (core);
-    self->audio_output_cb_id =
-      g_signal_connect_object (core,
-                               "audio-output",
-                               (GCallback) audio_output_cb,
-                               self,
-                               0);
-    self->iterated_cb_id =
-      g_signal_connect_object (core,
-                               "iterated",
-                               (GCallback) iterated_cb,
-                               self,
-                               0);
-  }
-
-  g_clear_pointer (&self->simple, pa_simple_free);
-  src_reset (self->src);
+  stop_playback (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_LATENCY]);
+}
+
+/**
+ * retro_pa_player_get_dynamic_rate_control:
+ * @self: a #RetroPaPlayer
+ *
+ * Gets whether @self adjusts the resampling ratio to hold its target latency.
+ *
+ * Returns: whether dynamic rate control is enabled
+ */
+gboolean
+retro_pa_player_get_dynamic_rate_control (RetroPaPlayer *self)
+{
+  g_return_val_if_fail (RETRO_IS_PA_PLAYER (self), FALSE);
+
+  return self->dynamic_rate_control;
+}
+
+/**
+ * retro_pa_player_set_dynamic_rate_control:
+ * @self: a #RetroPaPlayer
+ * @dynamic_rate_control: whether to enable dynamic rate control
+ *
+ * Sets whether @self adjusts the resampling ratio by up to 0.5% to hold its
+ * target latency, compensating for clock drift.
+ */
+void
+retro_pa_player_set_dynamic_rate_control (RetroPaPlayer *self,
+                                          gboolean       dynamic_rate_control)
+{
+  g_return_if_fail (RETRO_IS_PA_PLAYER (self));
+
+  dynamic_rate_control = !!dynamic_rate_control;
+
+  if (self->dynamic_rate_control == dynamic_rate_control)
+    return;
+
+  self->dynamic_rate_control = dynamic_rate_control;
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_DYNAMIC_RATE_CONTROL]);
+}
+
+/**
+ * retro_pa_player_get_measured_latency:
+ * @self: a #RetroPaPlayer
+ *
+ * Gets the latency of the audio queued by @self when it last received audio,
+ * both in its own buffer and in the server.
+ *
+ * Returns: the measured latency in milliseconds
+ */
+gdouble
+retro_pa_player_get_measured_latency (RetroPaPlayer *self)
+{
+  g_return_val_if_fail (RETRO_IS_PA_PLAYER (self), 0.0);
+
+  return self->measured_latency;
+}
+
+/**
+ * retro_pa_player_get_rate_adjustment:
+ * @self: a #RetroPaPlayer
+ *
+ * Gets the factor the resampling ratio was last multiplied by to hold the
+ * target latency.
+ *
+ * Returns: the rate adjustment, 1 if the rate isn't adjusted
+ */
+gdouble
+retro_pa_player_get_rate_adjustment (RetroPaPlayer *self)
+{
+  g_return_val_if_fail (RETRO_IS_PA_PLAYER (self), 1.0);
+
+  return self->rate_adjustment;
+}
+
+/**
+ * retro_pa_player_get_resampler_quality:
+ * @self: a #RetroPaPlayer
+ *
+ * Gets the quality of the resampler used by @self.
+ *
+ * Returns: the resampler quality
+ */
+RetroResamplerQuality
+retro_pa_player_get_resampler_quality (RetroPaPlayer *self)
+{
+  g_return_val_if_fail (RETRO_IS_PA_PLAYER (self), RETRO_RESAMPLER_QUALITY_BEST);
+
+  return self->resampler_quality;
+}
+
+/**
+ * retro_pa_player_set_resampler_quality:
+ * @self: a #RetroPaPlayer
+ * @resampler_quality: the resampler quality
+ *
+ * Sets the quality of the resampler used by @self to play the audio at the
+ * speed rate of the core.
+ */
+void
+retro_pa_player_set_resampler_quality (RetroPaPlayer         *self,
+                                       RetroResamplerQuality  resampler_quality)
+{
+  g_return_if_fail (RETRO_IS_PA_PLAYER (self));
+  g_return_if_fail (resampler_quality <= RETRO_RESAMPLER_QUALITY_ZERO_ORDER_HOLD);
+
+  if (self->resampler_quality == resampler_quality)
+    return;
+
+  self->resampler_quality = resampler_quality;
+
+  create_resampler (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_RESAMPLER_QUALITY]);
 }
 
 /**
@@ -28,12 +28,21 @@ struct _RetroRendererInterface
   RetroProcAddress (*get_proc_address) (RetroRenderer *self,
                                         const gchar   *sym);
   guintptr (*get_current_framebuffer) (RetroRenderer *self);
-  void (*snapshot) (RetroRenderer    *self,
-                    RetroPixelFormat  pixel_format,
-                    guint             width,
-                    guint             height,
-                    gsize             rowstride,
-                    guint8           *data);
+  /* Reads the current frame back. Unless @synchronous is set, the read may
+   * complete asynchronously, in which case an earlier frame is written to the
+   * framebuffer instead. Returns whether a frame was written and is ready to
+   * be published. */
+  gboolean (*snapshot) (RetroRenderer    *self,
+                        RetroPixelFormat  pixel_format,
+                        guint             width,
+                        guint             height,
+                        gfloat            aspect_ratio,
+                        gboolean          synchronous,
+                        RetroFramebuffer *framebuffer);
+  /* Optional. Waits for the reads still in flight and writes the most recent
+   * frame to the framebuffer. Returns whether a frame was written. */
+  gboolean (*flush) (RetroRenderer    *self,
+                     RetroFramebuffer *framebuffer);
 };
 
 void retro_renderer_realize (RetroRenderer *self,
@@ -45,11 +54,15 @@ RetroProcAddress retro_renderer_get_proc_address (RetroRenderer *self,
 
 guintptr retro_renderer_get_current_framebuffer (RetroRenderer *self);
 
-void retro_renderer_snapshot (RetroRenderer    *self,
-                              RetroPixelFormat  pixel_format,
-                              guint             width,
-                              guint             height,
-                              gsize             rowstride,
-                              guint8           *data);
+gboolean retro_renderer_snapshot (RetroRenderer    *self,
+                                  RetroPixelFormat  pixel_format,
+                                  guint             width,
+                                  guint             height,
+                                  gfloat            aspect_ratio,
+                                  gboolean          synchronous,
+                                  RetroFramebuffer *framebuffer);
+
+gboolean retro_renderer_flush (RetroRenderer    *self,
+                               RetroFramebuffer *framebuffer);
 
 G_END_DECLS
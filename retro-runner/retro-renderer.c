@@ -54,21 +54,41 @@ retro_renderer_get_current_framebuffer (RetroRenderer *self)
   return iface->get_current_framebuffer (self);
 }
 
-void
+gboolean
 retro_renderer_snapshot (RetroRenderer    *self,
                          RetroPixelFormat  pixel_format,
                          guint             width,
                          guint             height,
-                         gsize             rowstride,
-                         guint8           *data)
+                         gfloat            aspect_ratio,
+                         gboolean          synchronous,
+                         RetroFramebuffer *framebuffer)
 {
   RetroRendererInterface *iface;
 
-  g_return_if_fail (RETRO_IS_RENDERER (self));
+  g_return_val_if_fail (RETRO_IS_RENDERER (self), FALSE);
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (framebuffer), FALSE);
+
+  iface = RETRO_RENDERER_GET_IFACE (self);
+
+  g_return_val_if_fail (iface->snapshot != NULL, FALSE);
+
+  return iface->snapshot (self, pixel_format, width, height, aspect_ratio,
+                          synchronous, framebuffer);
+}
+
+gboolean
+retro_renderer_flush (RetroRenderer    *self,
+                      RetroFramebuffer *framebuffer)
+{
+  RetroRendererInterface *iface;
+
+  g_return_val_if_fail (RETRO_IS_RENDERER (self), FALSE);
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (framebuffer), FALSE);
 
   iface = RETRO_RENDERER_GET_IFACE (self);
 
-  g_return_if_fail (iface->snapshot != NULL);
+  if (iface->flush == NULL)
+    return FALSE;
 
-  iface->snapshot (self, pixel_format, width, height, rowstride, data);
+  return iface->flush (self, framebuffer);
 }
@@ -0,0 +1,78 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#pragma once
+
+#if !defined(__RETRO_GTK_INSIDE__) && !defined(RETRO_GTK_COMPILATION)
+# error "Only <retro-gtk.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define RETRO_TYPE_AUDIO_QUEUE (retro_audio_queue_get_type())
+
+G_DECLARE_FINAL_TYPE (RetroAudioQueue, retro_audio_queue, RETRO, AUDIO_QUEUE, GObject)
+
+/**
+ * RetroAudioStats:
+ * @frames_per_iteration: the smoothed number of frames produced per iteration
+ * @resampling_ratio: the ratio the audio is resampled at
+ * @latency: the audio queued for playback, in milliseconds
+ * @n_underruns: how many times the playback ran out of audio
+ * @n_dropped_frames: the number of frames dropped for lack of room
+ * @blocked_time: the time the core's thread spent handing audio over to the
+ *   sink, in microseconds
+ *
+ * Statistics about the health of the audio path. The counters are cumulative.
+ */
+typedef struct {
+  gdouble frames_per_iteration;
+  gdouble resampling_ratio;
+  gdouble latency;
+  guint n_underruns;
+  guint n_dropped_frames;
+  gint64 blocked_time;
+} RetroAudioStats;
+
+/**
+ * RetroAudioQueueFunc:
+ * @frames: (array length=n_frames): interleaved stereo frames
+ * @n_frames: the number of frames in @frames
+ * @sample_rate: the sample rate of @frames
+ * @user_data: the user data
+ *
+ * Receives a chunk of audio read from a #RetroAudioQueue. @frames points into
+ * the shared memory and is only valid during the call.
+ */
+typedef void (*RetroAudioQueueFunc) (const gint16 *frames,
+                                     gsize         n_frames,
+                                     gdouble       sample_rate,
+                                     gpointer      user_data);
+
+RetroAudioQueue *retro_audio_queue_new (gint fd);
+
+gint retro_audio_queue_get_fd (RetroAudioQueue *self);
+gboolean retro_audio_queue_has_pending (RetroAudioQueue *self);
+
+#ifdef RETRO_RUNNER_COMPILATION
+
+gboolean retro_audio_queue_write (RetroAudioQueue *self,
+                                  const gint16    *frames,
+                                  gsize            n_frames,
+                                  gdouble          sample_rate);
+guint64 retro_audio_queue_get_n_dropped (RetroAudioQueue *self);
+void retro_audio_queue_set_stats (RetroAudioQueue       *self,
+                                  const RetroAudioStats *stats);
+
+#else
+
+gsize retro_audio_queue_read (RetroAudioQueue     *self,
+                              RetroAudioQueueFunc  func,
+                              gpointer             user_data);
+gboolean retro_audio_queue_get_stats (RetroAudioQueue *self,
+                                      RetroAudioStats *stats);
+
+#endif
+
+G_END_DECLS
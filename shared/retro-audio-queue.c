@@ -0,0 +1,482 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#include "retro-audio-queue-private.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * The audio queue is a lock-free ring of chunks living in shared memory, for
+ * the runner to produce audio and the UI to consume it without any D-Bus call.
+ *
+ * Each chunk starts with a header giving its size, its number of frames and
+ * their sample rate, so sample rate changes are carried in-band and apply
+ * exactly from the chunk they happen at. The frames of a chunk are always
+ * contiguous so they can be handed over straight from the shared memory: a
+ * chunk which wouldn't fit before the end of the ring is preceded by a
+ * padding chunk without frames filling the remaining space.
+ *
+ * The read and write positions are byte counters which only ever increase,
+ * wrapping around, and are only written by the consumer and the producer
+ * respectively. They live on separate cache lines so the two processes don't
+ * keep stealing them from each other.
+ *
+ * The metadata also carries statistics about the audio path, for the UI to
+ * poll without any D-Bus call. They are published by the runner under a
+ * sequence lock: the sequence is odd while they are being written, so the UI
+ * can tell when it read a torn copy and retry, and the runner never waits.
+ */
+
+#define CACHE_LINE_SIZE 64
+#define CHUNK_ALIGNMENT 16
+#define CAPACITY (1 << 18)
+#define FRAME_SIZE (2 * sizeof (gint16))
+#define MAX_CHUNK_FRAMES ((CAPACITY / 4 - sizeof (RetroAudioQueueChunk)) / FRAME_SIZE)
+#define DATA_OFFSET ((sizeof (RetroAudioQueueMetadata) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+/* Don't spin forever on stats left half written by a crashed runner. */
+#define MAX_STATS_READ_ATTEMPTS 8
+
+typedef struct {
+  guint32 size;
+  guint32 n_frames;
+  gdouble sample_rate;
+} RetroAudioQueueChunk;
+
+G_STATIC_ASSERT (sizeof (RetroAudioQueueChunk) == CHUNK_ALIGNMENT);
+
+typedef struct {
+  volatile guint write_position;
+  guint8 write_padding[CACHE_LINE_SIZE - sizeof (guint)];
+  volatile guint read_position;
+  guint8 read_padding[CACHE_LINE_SIZE - sizeof (guint)];
+  guint32 capacity;
+  volatile guint stats_sequence;
+  RetroAudioStats stats;
+} RetroAudioQueueMetadata;
+
+struct _RetroAudioQueue
+{
+  GObject parent_instance;
+
+  gint fd;
+  gsize size;
+  gpointer shared_data;
+  RetroAudioQueueMetadata *metadata;
+  guint8 *data;
+  guint64 n_dropped;
+};
+
+G_DEFINE_TYPE (RetroAudioQueue, retro_audio_queue, G_TYPE_OBJECT)
+
+enum {
+  PROP_0,
+  PROP_FD,
+  N_PROPS,
+};
+
+static GParamSpec *properties [N_PROPS];
+
+static void
+map (RetroAudioQueue *self)
+{
+  gsize size = DATA_OFFSET + CAPACITY;
+
+  self->shared_data = mmap (NULL, size,
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            self->fd, 0);
+
+  if (self->shared_data == MAP_FAILED) {
+    g_critical ("Couldn't map audio queue: %s", g_strerror (errno));
+    self->shared_data = NULL;
+
+    return;
+  }
+
+  self->size = size;
+  self->metadata = (RetroAudioQueueMetadata *) self->shared_data;
+  self->data = (guint8 *) self->shared_data + DATA_OFFSET;
+}
+
+static void
+retro_audio_queue_constructed (GObject *object)
+{
+  RetroAudioQueue *self = RETRO_AUDIO_QUEUE (object);
+
+  G_OBJECT_CLASS (retro_audio_queue_parent_class)->constructed (object);
+
+#ifdef RETRO_RUNNER_COMPILATION
+  if (ftruncate (self->fd, DATA_OFFSET + CAPACITY) != 0) {
+    g_critical ("Couldn't truncate audio queue: %s", g_strerror (errno));
+
+    return;
+  }
+
+  map (self);
+
+  if (self->metadata == NULL)
+    return;
+
+  self->metadata->capacity = CAPACITY;
+  self->metadata->stats.resampling_ratio = 1.0;
+  g_atomic_int_set (&self->metadata->read_position, 0);
+  g_atomic_int_set (&self->metadata->write_position, 0);
+#else
+  map (self);
+
+  if (self->metadata == NULL)
+    return;
+
+  /* Both processes are built from the same sources, this can only happen if
+   * they come from different versions. */
+  if (self->metadata->capacity != CAPACITY) {
+    g_critical ("Unexpected audio queue capacity: %u", self->metadata->capacity);
+    munmap (self->shared_data, self->size);
+    self->shared_data = NULL;
+    self->metadata = NULL;
+    self->data = NULL;
+  }
+#endif
+}
+
+static void
+retro_audio_queue_finalize (GObject *object)
+{
+  RetroAudioQueue *self = (RetroAudioQueue *)object;
+
+  if (self->shared_data) {
+    munmap (self->shared_data, self->size);
+    self->shared_data = NULL;
+  }
+
+  close (self->fd);
+
+  G_OBJECT_CLASS (retro_audio_queue_parent_class)->finalize (object);
+}
+
+static void
+retro_audio_queue_get_property (GObject    *object,
+                                guint       prop_id,
+                                GValue     *value,
+                                GParamSpec *pspec)
+{
+  RetroAudioQueue *self = RETRO_AUDIO_QUEUE (object);
+
+  switch (prop_id) {
+  case PROP_FD:
+    g_value_set_int (value, self->fd);
+
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+
+    break;
+  }
+}
+
+static void
+retro_audio_queue_set_property (GObject      *object,
+                                guint         prop_id,
+                                const GValue *value,
+                                GParamSpec   *pspec)
+{
+  RetroAudioQueue *self = RETRO_AUDIO_QUEUE (object);
+
+  switch (prop_id) {
+  case PROP_FD:
+    self->fd = g_value_get_int (value);
+
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+
+    break;
+  }
+}
+
+static void
+retro_audio_queue_class_init (RetroAudioQueueClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = retro_audio_queue_constructed;
+  object_class->finalize = retro_audio_queue_finalize;
+  object_class->get_property = retro_audio_queue_get_property;
+  object_class->set_property = retro_audio_queue_set_property;
+
+  properties[PROP_FD] =
+    g_param_spec_int ("fd",
+                      "File descriptor",
+                      "The file descriptor backing shared memory.",
+                      -1,
+                      G_MAXINT,
+                      -1,
+                      G_PARAM_READWRITE |
+                      G_PARAM_CONSTRUCT_ONLY |
+                      G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (G_OBJECT_CLASS (klass), N_PROPS, properties);
+}
+
+static void
+retro_audio_queue_init (RetroAudioQueue *self)
+{
+}
+
+RetroAudioQueue *
+retro_audio_queue_new (gint fd)
+{
+  g_return_val_if_fail (fd >= 0, NULL);
+
+  return g_object_new (RETRO_TYPE_AUDIO_QUEUE, "fd", fd, NULL);
+}
+
+gint
+retro_audio_queue_get_fd (RetroAudioQueue *self)
+{
+  g_return_val_if_fail (RETRO_IS_AUDIO_QUEUE (self), 0);
+
+  return self->fd;
+}
+
+/**
+ * retro_audio_queue_has_pending:
+ * @self: a #RetroAudioQueue
+ *
+ * Gets whether some audio was written to @self and not read yet.
+ *
+ * Returns: whether there is pending audio
+ */
+gboolean
+retro_audio_queue_has_pending (RetroAudioQueue *self)
+{
+  g_return_val_if_fail (RETRO_IS_AUDIO_QUEUE (self), FALSE);
+
+  if (self->metadata == NULL)
+    return FALSE;
+
+  return g_atomic_int_get (&self->metadata->write_position) !=
+         g_atomic_int_get (&self->metadata->read_position);
+}
+
+#ifdef RETRO_RUNNER_COMPILATION
+
+static gboolean
+write_chunk (RetroAudioQueue *self,
+             const gint16    *frames,
+             gsize            n_frames,
+             gdouble          sample_rate)
+{
+  RetroAudioQueueChunk *chunk;
+  guint write_position, read_position;
+  gsize offset, size, n_to_end, n_needed;
+
+  size = sizeof (RetroAudioQueueChunk) + n_frames * FRAME_SIZE;
+  size = (size + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+
+  write_position = self->metadata->write_position;
+  read_position = g_atomic_int_get (&self->metadata->read_position);
+  offset = write_position & (CAPACITY - 1);
+  n_to_end = CAPACITY - offset;
+  n_needed = n_to_end < size ? n_to_end + size : size;
+
+  if (CAPACITY - (guint) (write_position - read_position) < n_needed)
+    return FALSE;
+
+  /* Positions are aligned to chunk headers, so there is always room for a
+   * padding chunk's header before the end. */
+  if (n_to_end < size) {
+    chunk = (RetroAudioQueueChunk *) (self->data + offset);
+    chunk->size = n_to_end;
+    chunk->n_frames = 0;
+    chunk->sample_rate = sample_rate;
+
+    write_position += n_to_end;
+    offset = 0;
+  }
+
+  chunk = (RetroAudioQueueChunk *) (self->data + offset);
+  chunk->size = size;
+  chunk->n_frames = n_frames;
+  chunk->sample_rate = sample_rate;
+  memcpy (chunk + 1, frames, n_frames * FRAME_SIZE);
+
+  /* Publish the chunk only once it is written. */
+  g_atomic_int_set (&self->metadata->write_position, write_position + size);
+
+  return TRUE;
+}
+
+/**
+ * retro_audio_queue_write:
+ * @self: a #RetroAudioQueue
+ * @frames: (array length=n_frames): interleaved stereo frames
+ * @n_frames: the number of frames in @frames
+ * @sample_rate: the sample rate of @frames
+ *
+ * Appends @frames to @self, splitting them into several chunks if needed. To
+ * never block the runner, frames which don't fit are dropped.
+ *
+ * Returns: whether all of @frames were written
+ */
+gboolean
+retro_audio_queue_write (RetroAudioQueue *self,
+                         const gint16    *frames,
+                         gsize            n_frames,
+                         gdouble          sample_rate)
+{
+  g_return_val_if_fail (RETRO_IS_AUDIO_QUEUE (self), FALSE);
+  g_return_val_if_fail (frames != NULL || n_frames == 0, FALSE);
+
+  if (self->metadata == NULL)
+    return FALSE;
+
+  while (n_frames > 0) {
+    gsize n_chunk_frames = MIN (n_frames, MAX_CHUNK_FRAMES);
+
+    if (!write_chunk (self, frames, n_chunk_frames, sample_rate)) {
+      self->n_dropped += n_frames;
+
+      return FALSE;
+    }
+
+    frames += n_chunk_frames * 2;
+    n_frames -= n_chunk_frames;
+  }
+
+  return TRUE;
+}
+
+guint64
+retro_audio_queue_get_n_dropped (RetroAudioQueue *self)
+{
+  g_return_val_if_fail (RETRO_IS_AUDIO_QUEUE (self), 0);
+
+  return self->n_dropped;
+}
+
+/**
+ * retro_audio_queue_set_stats:
+ * @self: a #RetroAudioQueue
+ * @stats: the statistics of the audio path
+ *
+ * Publishes @stats for the UI to read.
+ */
+void
+retro_audio_queue_set_stats (RetroAudioQueue       *self,
+                             const RetroAudioStats *stats)
+{
+  g_return_if_fail (RETRO_IS_AUDIO_QUEUE (self));
+  g_return_if_fail (stats != NULL);
+
+  if (self->metadata == NULL)
+    return;
+
+  g_atomic_int_inc (&self->metadata->stats_sequence);
+  self->metadata->stats = *stats;
+  g_atomic_int_inc (&self->metadata->stats_sequence);
+}
+
+#else
+
+/**
+ * retro_audio_queue_read:
+ * @self: a #RetroAudioQueue
+ * @func: (scope call): the function receiving the chunks
+ * @user_data: the data to pass to @func
+ *
+ * Passes every pending chunk of @self to @func in order, and releases it once
+ * @func returns.
+ *
+ * Returns: the number of frames read
+ */
+gsize
+retro_audio_queue_read (RetroAudioQueue     *self,
+                        RetroAudioQueueFunc  func,
+                        gpointer             user_data)
+{
+  guint read_position, write_position;
+  gsize n_frames = 0;
+
+  g_return_val_if_fail (RETRO_IS_AUDIO_QUEUE (self), 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  if (self->metadata == NULL)
+    return 0;
+
+  read_position = self->metadata->read_position;
+  write_position = g_atomic_int_get (&self->metadata->write_position);
+
+  while (read_position != write_position) {
+    gsize offset = read_position & (CAPACITY - 1);
+    RetroAudioQueueChunk *chunk = (RetroAudioQueueChunk *) (self->data + offset);
+    guint32 size = chunk->size;
+    guint32 n_chunk_frames = chunk->n_frames;
+
+    /* Don't trust a misbehaving runner to not make us read out of bounds. */
+    if (G_UNLIKELY (size < sizeof (RetroAudioQueueChunk) ||
+                    size % CHUNK_ALIGNMENT != 0 ||
+                    size > CAPACITY - offset ||
+                    size > (guint) (write_position - read_position) ||
+                    n_chunk_frames * FRAME_SIZE > size - sizeof (RetroAudioQueueChunk))) {
+      g_critical ("Invalid audio queue chunk, skipping the pending audio");
+      read_position = write_position;
+
+      break;
+    }
+
+    if (n_chunk_frames > 0)
+      func ((const gint16 *) (chunk + 1), n_chunk_frames,
+            chunk->sample_rate, user_data);
+
+    n_frames += n_chunk_frames;
+    read_position += size;
+
+    /* Release the chunk right away so the runner can reuse its space. */
+    g_atomic_int_set (&self->metadata->read_position, read_position);
+  }
+
+  g_atomic_int_set (&self->metadata->read_position, read_position);
+
+  return n_frames;
+}
+
+/**
+ * retro_audio_queue_get_stats:
+ * @self: a #RetroAudioQueue
+ * @stats: (out caller-allocates): return location for the statistics
+ *
+ * Reads the latest statistics of the audio path published by the runner.
+ *
+ * Returns: whether consistent statistics could be read
+ */
+gboolean
+retro_audio_queue_get_stats (RetroAudioQueue *self,
+                             RetroAudioStats *stats)
+{
+  g_return_val_if_fail (RETRO_IS_AUDIO_QUEUE (self), FALSE);
+  g_return_val_if_fail (stats != NULL, FALSE);
+
+  if (self->metadata == NULL)
+    return FALSE;
+
+  for (gint i = 0; i < MAX_STATS_READ_ATTEMPTS; i++) {
+    guint sequence = g_atomic_int_get (&self->metadata->stats_sequence);
+
+    if (sequence & 1)
+      continue;
+
+    *stats = self->metadata->stats;
+
+    /* Keep the copy from being reordered after the sequence check. */
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+    if (g_atomic_int_get (&self->metadata->stats_sequence) == sequence)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+#endif
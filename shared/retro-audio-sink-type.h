@@ -0,0 +1,36 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#pragma once
+
+#if !defined(__RETRO_GTK_INSIDE__) && !defined(RETRO_GTK_COMPILATION)
+# error "Only <retro-gtk.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define RETRO_TYPE_AUDIO_SINK_TYPE (retro_audio_sink_type_get_type ())
+
+GType retro_audio_sink_type_get_type (void) G_GNUC_CONST;
+
+/**
+ * RetroAudioSinkType:
+ * @RETRO_AUDIO_SINK_TYPE_PULSEAUDIO: plays the audio with PulseAudio, or
+ * discards it if PulseAudio isn't available
+ * @RETRO_AUDIO_SINK_TYPE_NULL: counts and discards the audio, without any
+ * playback cost, for headless benchmarking
+ * @RETRO_AUDIO_SINK_TYPE_FILE: writes the audio to a file, as a WAV file if
+ * its name ends with ".wav" and as raw signed 16 bits little endian stereo
+ * samples otherwise
+ *
+ * Represents where the audio produced by the core goes.
+ */
+typedef enum
+{
+  RETRO_AUDIO_SINK_TYPE_PULSEAUDIO,
+  RETRO_AUDIO_SINK_TYPE_NULL,
+  RETRO_AUDIO_SINK_TYPE_FILE,
+} RetroAudioSinkType;
+
+G_END_DECLS
@@ -12,6 +12,8 @@
 G_BEGIN_DECLS
 
 #define RETRO_TYPE_CONTROLLER_STATE (retro_controller_state_get_type())
+#define RETRO_CONTROLLER_STATE_MAX_PORTS 16
+#define RETRO_CONTROLLER_STATE_DEFAULT_PORT G_MAXUINT
 
 G_DECLARE_FINAL_TYPE (RetroControllerState, retro_controller_state, RETRO, CONTROLLER_STATE, GObject)
 
@@ -19,30 +21,37 @@ RetroControllerState *retro_controller_state_new (gint fd);
 
 gint retro_controller_state_get_fd (RetroControllerState *self);
 
-void retro_controller_state_lock (RetroControllerState *self);
-void retro_controller_state_unlock (RetroControllerState *self);
-
 #ifdef RETRO_RUNNER_COMPILATION
 
 gboolean retro_controller_state_has_type (RetroControllerState *self,
+                                          guint                 port,
                                           RetroControllerType   type);
 gint16 retro_controller_state_get_input (RetroControllerState *self,
+                                         guint                 port,
                                          RetroInput           *input);
 
-gboolean retro_controller_state_get_supports_rumble (RetroControllerState *self);
+gboolean retro_controller_state_get_supports_rumble (RetroControllerState *self,
+                                                     guint                 port);
 
 void retro_controller_state_snapshot (RetroControllerState *self);
 
 #else
 
+void retro_controller_state_begin_write (RetroControllerState *self,
+                                         guint                 port);
+void retro_controller_state_end_write (RetroControllerState *self,
+                                       guint                 port);
 void retro_controller_state_set_for_type (RetroControllerState *self,
+                                          guint                 port,
                                           RetroControllerType   type,
                                           gint16               *state,
                                           gsize                 n_items);
 void retro_controller_state_clear_type (RetroControllerState *self,
+                                        guint                 port,
                                         RetroControllerType   type);
 
 void retro_controller_state_set_supports_rumble (RetroControllerState *self,
+                                                 guint                 port,
                                                  gboolean              supports_rumble);
 
 #endif
@@ -2,7 +2,6 @@
 
 #include "retro-controller-state-private.h"
 
-#include <semaphore.h>
 #include <errno.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -11,32 +10,71 @@
 #include "retro-input-private.h"
 
 #define RETRO_CONTROLLER_TYPE_COUNT (RETRO_CONTROLLER_TYPE_POINTER + 1)
+/* Don't retry forever if the UI keeps writing while we copy. */
+#define MAX_SNAPSHOT_ATTEMPTS 4
+#define BITSET_SIZE(n_bits) (((n_bits) + 63) / 64)
+/* The default controller has the first slot, followed by the ports. */
+#define N_SLOTS (RETRO_CONTROLLER_STATE_MAX_PORTS + 1)
+#define DEFAULT_SLOT 0
+/* Each slot starts on its own cache line so writing to one doesn't disturb
+ * reading the others. */
+#define SLOT_SIZE ((sizeof (RetroControllerStateSlot) + 63) & ~((gsize) 63))
+#define SHARED_DATA_SIZE (N_SLOTS * SLOT_SIZE)
+
+/*
+ * The state of every port lives in a single shared segment, with one slot
+ * per port plus one for the default controller. The joypad and keyboard only
+ * have digital inputs, so they are packed as bits, which keeps a slot within
+ * a couple of cache lines.
+ *
+ * Each slot is written by the UI and read by the runner under its own
+ * sequence lock. The UI makes the sequence odd while it writes and even
+ * again once done, so it never waits for the runner. The runner copies the
+ * slot and checks the sequence didn't change meanwhile, retrying a few times
+ * if it did, and otherwise keeps its previous snapshot so it never waits for
+ * the UI either. Snapshots are copied into the runner's spare buffer, so a
+ * torn copy never replaces a consistent one.
+ *
+ * Relative inputs like the mouse motion can't simply be overwritten with the
+ * latest value, as the motion from the updates the runner didn't see would be
+ * lost. The UI instead accumulates them into wrapping totals, and the runner
+ * reports the difference between two consecutive snapshots, so the sum of the
+ * deltas the core sees matches the motion the UI received.
+ */
 
 typedef struct {
-  gboolean is_dirty;
+  guint32 available_types;
   gboolean supports_rumble;
-  gint64 available_types;
-  gint16 joypad_data[RETRO_JOYPAD_ID_COUNT];
+  guint32 joypad_buttons;
+  guint64 keyboard_keys[BITSET_SIZE (RETRO_KEYBOARD_KEY_LAST)];
   gint16 mouse_data[RETRO_MOUSE_ID_COUNT];
-  gint16 keyboard_data[RETRO_KEYBOARD_KEY_LAST];
   gint16 lightgun_data[RETRO_LIGHTGUN_ID_COUNT];
   gint16 analog_data[RETRO_ANALOG_ID_COUNT * RETRO_ANALOG_INDEX_COUNT];
   gint16 pointer_data[RETRO_POINTER_ID_COUNT];
 } RetroControllerStateData;
 
 typedef struct {
-  sem_t semaphore;
+  volatile guint sequence;
   RetroControllerStateData data;
-} RetroControllerStateSharedData;
+} RetroControllerStateSlot;
+
+#ifdef RETRO_RUNNER_COMPILATION
+typedef struct {
+  RetroControllerStateData data[2];
+  gint current;
+  guint sequence;
+  gint16 mouse_deltas[RETRO_MOUSE_ID_Y + 1];
+} RetroControllerStateSnapshot;
+#endif
 
 struct _RetroControllerState
 {
   GObject parent_instance;
 
   gint fd;
-  RetroControllerStateSharedData *shared_data;
+  guint8 *shared_data;
 #ifdef RETRO_RUNNER_COMPILATION
-  RetroControllerStateData snapshot;
+  RetroControllerStateSnapshot snapshots[N_SLOTS];
 #endif
 };
 
@@ -50,20 +88,40 @@ enum {
 
 static GParamSpec *properties [N_PROPS];
 
+static RetroControllerStateSlot *
+get_slot (RetroControllerState *self,
+          gint                  slot)
+{
+  return (RetroControllerStateSlot *) (self->shared_data + slot * SLOT_SIZE);
+}
+
+static gint
+get_slot_for_port (guint port)
+{
+  if (port == RETRO_CONTROLLER_STATE_DEFAULT_PORT)
+    return DEFAULT_SLOT;
+
+  if (port >= RETRO_CONTROLLER_STATE_MAX_PORTS)
+    return -1;
+
+  return port + 1;
+}
+
+static gsize
+get_n_inputs_for_type (RetroControllerType type)
+{
+  return retro_controller_type_get_id_count (type) *
+         retro_controller_type_get_index_count (type);
+}
+
 static gint16 *
 get_data_for_type (RetroControllerStateData *data,
                    RetroControllerType       type)
 {
   switch (type) {
-  case RETRO_CONTROLLER_TYPE_JOYPAD:
-    return data->joypad_data;
-
   case RETRO_CONTROLLER_TYPE_MOUSE:
     return data->mouse_data;
 
-  case RETRO_CONTROLLER_TYPE_KEYBOARD:
-    return data->keyboard_data;
-
   case RETRO_CONTROLLER_TYPE_LIGHTGUN:
     return data->lightgun_data;
 
@@ -73,12 +131,46 @@ get_data_for_type (RetroControllerStateData *data,
   case RETRO_CONTROLLER_TYPE_POINTER:
     return data->pointer_data;
 
+  case RETRO_CONTROLLER_TYPE_JOYPAD:
+  case RETRO_CONTROLLER_TYPE_KEYBOARD:
   case RETRO_CONTROLLER_TYPE_NONE:
   default:
     g_assert_not_reached ();
   }
 }
 
+static inline gboolean
+is_digital_type (RetroControllerType type)
+{
+  return type == RETRO_CONTROLLER_TYPE_JOYPAD ||
+         type == RETRO_CONTROLLER_TYPE_KEYBOARD;
+}
+
+static inline gboolean
+is_relative_input (RetroControllerType type,
+                   gsize               i)
+{
+  return type == RETRO_CONTROLLER_TYPE_MOUSE &&
+         (i == RETRO_MOUSE_ID_X || i == RETRO_MOUSE_ID_Y);
+}
+
+static gint16
+get_input (RetroControllerStateData *data,
+           RetroControllerType       type,
+           gsize                     i)
+{
+  switch (type) {
+  case RETRO_CONTROLLER_TYPE_JOYPAD:
+    return (data->joypad_buttons >> i) & 1;
+
+  case RETRO_CONTROLLER_TYPE_KEYBOARD:
+    return (data->keyboard_keys[i / 64] >> (i % 64)) & 1;
+
+  default:
+    return get_data_for_type (data, type)[i];
+  }
+}
+
 static void
 retro_controller_state_constructed (GObject *object)
 {
@@ -86,16 +178,11 @@ retro_controller_state_constructed (GObject *object)
 
   G_OBJECT_CLASS (retro_controller_state_parent_class)->constructed (object);
 
-  if (ftruncate (self->fd, sizeof (RetroControllerStateSharedData)) != 0)
+  if (ftruncate (self->fd, SHARED_DATA_SIZE) != 0)
     g_critical ("Couldn't truncate controller data: %s", g_strerror (errno));
 
-  self->shared_data = mmap (NULL, sizeof (RetroControllerStateSharedData),
+  self->shared_data = mmap (NULL, SHARED_DATA_SIZE,
                             PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
-
-#ifndef RETRO_RUNNER_COMPILATION
-  if (sem_init (&self->shared_data->semaphore, 1, 1) != 0)
-    g_critical ("Couldn't init semaphore: %s", g_strerror (errno));
-#endif
 }
 
 static void
@@ -103,13 +190,8 @@ retro_controller_state_finalize (GObject *object)
 {
   RetroControllerState *self = (RetroControllerState *)object;
 
-#ifndef RETRO_RUNNER_COMPILATION
-  if (sem_destroy (&self->shared_data->semaphore) != 0)
-    g_critical ("Couldn't destroy semaphore: %s", g_strerror (errno));
-#endif
-
   if (self->shared_data) {
-    munmap (self->shared_data, sizeof (RetroControllerStateSharedData));
+    munmap (self->shared_data, SHARED_DATA_SIZE);
     self->shared_data = NULL;
   }
 
@@ -203,72 +285,111 @@ retro_controller_state_get_fd (RetroControllerState *self)
   return self->fd;
 }
 
-void
-retro_controller_state_lock (RetroControllerState *self)
-{
-  g_return_if_fail (RETRO_IS_CONTROLLER_STATE (self));
-
-  if (sem_wait (&self->shared_data->semaphore) != 0)
-    g_critical ("Couldn't lock: %s", g_strerror (errno));
-}
+#ifdef RETRO_RUNNER_COMPILATION
 
-void
-retro_controller_state_unlock (RetroControllerState *self)
+static RetroControllerStateData *
+get_snapshot_data (RetroControllerState *self,
+                   gint                  slot)
 {
-  g_return_if_fail (RETRO_IS_CONTROLLER_STATE (self));
+  RetroControllerStateSnapshot *snapshot = &self->snapshots[slot];
 
-  if (sem_post (&self->shared_data->semaphore) != 0)
-    g_critical ("Couldn't unlock: %s", g_strerror (errno));
+  return &snapshot->data[snapshot->current];
 }
 
-#ifdef RETRO_RUNNER_COMPILATION
-
 gboolean
 retro_controller_state_has_type (RetroControllerState *self,
+                                 guint                 port,
                                  RetroControllerType   type)
 {
-  gint64 available_types;
+  gint slot;
 
   g_return_val_if_fail (RETRO_IS_CONTROLLER_STATE (self), FALSE);
   g_return_val_if_fail (type > RETRO_CONTROLLER_TYPE_NONE, FALSE);
   g_return_val_if_fail (type < RETRO_CONTROLLER_TYPE_COUNT, FALSE);
 
-  available_types = self->snapshot.available_types;
+  /* Cores may poll any port, those we have no slot for have nothing. */
+  slot = get_slot_for_port (port);
+  if (slot < 0)
+    return FALSE;
 
-  return (available_types & (1 << type)) > 0;
+  return (get_snapshot_data (self, slot)->available_types & (1 << type)) != 0;
 }
 
 gint16
 retro_controller_state_get_input (RetroControllerState *self,
+                                  guint                 port,
                                   RetroInput           *input)
 {
   RetroControllerType type;
   guint id, index, stride;
-  gint16 *data;
+  gint slot;
 
   g_return_val_if_fail (RETRO_IS_CONTROLLER_STATE (self), 0);
   g_return_val_if_fail (input != NULL, 0);
 
+  slot = get_slot_for_port (port);
+  if (slot < 0)
+    return 0;
+
   type = input->any.type;
   id = input->any.id;
   index = input->any.index;
 
   stride = retro_controller_type_get_id_count (type);
 
-  if (id > stride || index > retro_controller_type_get_index_count (type))
+  if (id >= stride || index >= retro_controller_type_get_index_count (type))
     return 0;
 
-  data = get_data_for_type (&self->snapshot, type);
+  if (is_relative_input (type, index * stride + id))
+    return self->snapshots[slot].mouse_deltas[id];
 
-  return data[index * stride + id];
+  return get_input (get_snapshot_data (self, slot), type, index * stride + id);
 }
 
 gboolean
-retro_controller_state_get_supports_rumble (RetroControllerState *self)
+retro_controller_state_get_supports_rumble (RetroControllerState *self,
+                                            guint                 port)
 {
+  gint slot;
+
   g_return_val_if_fail (RETRO_IS_CONTROLLER_STATE (self), FALSE);
 
-  return self->snapshot.supports_rumble;
+  slot = get_slot_for_port (port);
+  if (slot < 0)
+    return FALSE;
+
+  return get_snapshot_data (self, slot)->supports_rumble;
+}
+
+static gboolean
+try_snapshot (RetroControllerStateSlot     *slot,
+              RetroControllerStateSnapshot *snapshot)
+{
+  RetroControllerStateData *spare = &snapshot->data[!snapshot->current];
+
+  for (gint i = 0; i < MAX_SNAPSHOT_ATTEMPTS; i++) {
+    guint sequence = g_atomic_int_get (&slot->sequence);
+
+    if (sequence == snapshot->sequence)
+      return FALSE;
+
+    if (sequence & 1)
+      return FALSE;
+
+    memcpy (spare, &slot->data, sizeof (RetroControllerStateData));
+
+    /* Keep the copy from being reordered after the sequence check. */
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+    if (g_atomic_int_get (&slot->sequence) == sequence) {
+      snapshot->current = !snapshot->current;
+      snapshot->sequence = sequence;
+
+      return TRUE;
+    }
+  }
+
+  return FALSE;
 }
 
 void
@@ -276,63 +397,174 @@ retro_controller_state_snapshot (RetroControllerState *self)
 {
   g_return_if_fail (RETRO_IS_CONTROLLER_STATE (self));
 
-  if (!self->shared_data->data.is_dirty)
-    return;
+  for (gint i = 0; i < N_SLOTS; i++) {
+    RetroControllerStateSnapshot *snapshot = &self->snapshots[i];
+    RetroControllerStateData *current, *previous;
+
+    if (!try_snapshot (get_slot (self, i), snapshot)) {
+      /* The motion the UI sent since the last snapshot will be reported
+       * next time, there's none to report for now. */
+      memset (snapshot->mouse_deltas, 0, sizeof (snapshot->mouse_deltas));
+
+      continue;
+    }
 
-  self->shared_data->data.is_dirty = FALSE;
+    current = &snapshot->data[snapshot->current];
+    previous = &snapshot->data[!snapshot->current];
 
-  memcpy (&self->snapshot, &self->shared_data->data, sizeof (RetroControllerStateData));
+    for (gsize j = 0; j < G_N_ELEMENTS (snapshot->mouse_deltas); j++)
+      snapshot->mouse_deltas[j] = (gint16) (guint16) (current->mouse_data[j] - previous->mouse_data[j]);
+  }
 }
 
 #else
 
+static RetroControllerStateSlot *
+get_slot_for_writing (RetroControllerState *self,
+                      guint                 port)
+{
+  gint slot = get_slot_for_port (port);
+
+  g_return_val_if_fail (slot >= 0, NULL);
+
+  return get_slot (self, slot);
+}
+
+static void
+set_input (RetroControllerStateData *data,
+           RetroControllerType       type,
+           gsize                     i,
+           gint16                    value)
+{
+  switch (type) {
+  case RETRO_CONTROLLER_TYPE_JOYPAD:
+    if (value)
+      data->joypad_buttons |= 1u << i;
+    else
+      data->joypad_buttons &= ~(1u << i);
+
+    break;
+  case RETRO_CONTROLLER_TYPE_KEYBOARD:
+    if (value)
+      data->keyboard_keys[i / 64] |= G_GUINT64_CONSTANT (1) << (i % 64);
+    else
+      data->keyboard_keys[i / 64] &= ~(G_GUINT64_CONSTANT (1) << (i % 64));
+
+    break;
+  default:
+    get_data_for_type (data, type)[i] = value;
+
+    break;
+  }
+}
+
+void
+retro_controller_state_begin_write (RetroControllerState *self,
+                                    guint                 port)
+{
+  RetroControllerStateSlot *slot;
+
+  g_return_if_fail (RETRO_IS_CONTROLLER_STATE (self));
+
+  slot = get_slot_for_writing (self, port);
+  if (slot == NULL)
+    return;
+
+  g_return_if_fail (!(slot->sequence & 1));
+
+  g_atomic_int_inc (&slot->sequence);
+}
+
+void
+retro_controller_state_end_write (RetroControllerState *self,
+                                  guint                 port)
+{
+  RetroControllerStateSlot *slot;
+
+  g_return_if_fail (RETRO_IS_CONTROLLER_STATE (self));
+
+  slot = get_slot_for_writing (self, port);
+  if (slot == NULL)
+    return;
+
+  g_return_if_fail (slot->sequence & 1);
+
+  g_atomic_int_inc (&slot->sequence);
+}
+
 void
 retro_controller_state_set_for_type (RetroControllerState *self,
+                                     guint                 port,
                                      RetroControllerType   type,
                                      gint16               *state,
                                      gsize                 n_items)
 {
-  gint16 *data;
+  RetroControllerStateSlot *slot;
+  RetroControllerStateData *data;
 
   g_return_if_fail (RETRO_IS_CONTROLLER_STATE (self));
   g_return_if_fail (state != NULL);
+  g_return_if_fail (n_items <= get_n_inputs_for_type (type));
 
-  data = get_data_for_type (&self->shared_data->data, type);
+  slot = get_slot_for_writing (self, port);
+  if (slot == NULL)
+    return;
 
-  memcpy (data, state, n_items * sizeof (gint16));
-  self->shared_data->data.available_types |= (1 << type);
-  self->shared_data->data.is_dirty = TRUE;
-}
+  data = &slot->data;
 
-static gsize
-get_data_size_for_type (RetroControllerType type)
-{
-  return retro_controller_type_get_id_count (type) *
-         retro_controller_type_get_index_count (type);
+  /* Only touch the inputs that changed, most updates are a single key or
+   * button and this spares dirtying the whole slot. */
+  for (gsize i = 0; i < n_items; i++) {
+    gint16 value = get_input (data, type, i);
+    gint16 new_value = is_digital_type (type) ? state[i] != 0 : state[i];
+
+    if (is_relative_input (type, i))
+      set_input (data, type, i, (gint16) (guint16) (value + new_value));
+    else if (value != new_value)
+      set_input (data, type, i, new_value);
+  }
+
+  data->available_types |= (1 << type);
 }
 
 void
 retro_controller_state_clear_type (RetroControllerState *self,
+                                   guint                 port,
                                    RetroControllerType   type)
 {
-  gint16 *data;
+  RetroControllerStateSlot *slot;
+  RetroControllerStateData *data;
+  gsize n_inputs;
 
   g_return_if_fail (RETRO_IS_CONTROLLER_STATE (self));
 
-  data = get_data_for_type (&self->shared_data->data, type);
-  memset (data, 0, get_data_size_for_type (type) * sizeof (gint16));
+  slot = get_slot_for_writing (self, port);
+  if (slot == NULL)
+    return;
+
+  data = &slot->data;
+  n_inputs = get_n_inputs_for_type (type);
 
-  self->shared_data->data.available_types &= ~(1 << type);
-  self->shared_data->data.is_dirty = TRUE;
+  for (gsize i = 0; i < n_inputs; i++)
+    set_input (data, type, i, 0);
+
+  data->available_types &= ~(1 << type);
 }
 
 void
 retro_controller_state_set_supports_rumble (RetroControllerState *self,
+                                            guint                 port,
                                             gboolean              supports_rumble)
 {
+  RetroControllerStateSlot *slot;
+
   g_return_if_fail (RETRO_IS_CONTROLLER_STATE (self));
 
-  self->shared_data->data.supports_rumble = supports_rumble;
+  slot = get_slot_for_writing (self, port);
+  if (slot == NULL)
+    return;
+
+  slot->data.supports_rumble = supports_rumble;
 }
 
 #endif
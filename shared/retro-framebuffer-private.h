@@ -13,29 +13,47 @@ G_BEGIN_DECLS
 
 #define RETRO_TYPE_FRAMEBUFFER (retro_framebuffer_get_type())
 
+#define RETRO_FRAMEBUFFER_N_SLOTS 3
+
 G_DECLARE_FINAL_TYPE (RetroFramebuffer, retro_framebuffer, RETRO, FRAMEBUFFER, GObject)
 
 RetroFramebuffer *retro_framebuffer_new (gint fd);
 
 gint retro_framebuffer_get_fd (RetroFramebuffer *self);
 
-void retro_framebuffer_lock (RetroFramebuffer *self);
-void retro_framebuffer_unlock (RetroFramebuffer *self);
-
 #ifdef RETRO_RUNNER_COMPILATION
 
-void retro_framebuffer_set_data (RetroFramebuffer *self,
-                                 RetroPixelFormat  format,
-                                 gsize             rowstride,
-                                 guint             width,
-                                 guint             height,
-                                 gfloat            aspect_ratio,
-                                 gpointer          data);
-gpointer retro_framebuffer_get_pixels (RetroFramebuffer *self);
+void retro_framebuffer_reserve (RetroFramebuffer *self,
+                                gsize             capacity);
+void retro_framebuffer_start_run (RetroFramebuffer *self);
+gboolean retro_framebuffer_fits (RetroFramebuffer *self,
+                                 gsize             size);
+gpointer retro_framebuffer_prepare (RetroFramebuffer *self,
+                                    RetroPixelFormat  format,
+                                    gsize             rowstride,
+                                    guint             width,
+                                    guint             height,
+                                    gfloat            aspect_ratio);
+void retro_framebuffer_publish (RetroFramebuffer *self);
+gboolean retro_framebuffer_set_data (RetroFramebuffer *self,
+                                     RetroPixelFormat  format,
+                                     gsize             rowstride,
+                                     guint             width,
+                                     guint             height,
+                                     gfloat            aspect_ratio,
+                                     gconstpointer     data);
+gboolean retro_framebuffer_get_detect_duplicates (RetroFramebuffer *self);
+void retro_framebuffer_set_detect_duplicates (RetroFramebuffer *self,
+                                              gboolean          detect_duplicates);
 
 #else
 
-gboolean retro_framebuffer_get_is_dirty (RetroFramebuffer *self);
+gboolean retro_framebuffer_acquire (RetroFramebuffer *self);
+guint64 retro_framebuffer_get_sequence (RetroFramebuffer *self);
+gint64 retro_framebuffer_get_timestamp (RetroFramebuffer *self);
+gint64 retro_framebuffer_get_run_duration (RetroFramebuffer *self);
+guint64 retro_framebuffer_get_n_duplicated (RetroFramebuffer *self);
+guint64 retro_framebuffer_get_n_dropped (RetroFramebuffer *self);
 RetroPixelFormat retro_framebuffer_get_format (RetroFramebuffer *self);
 gsize retro_framebuffer_get_rowstride (RetroFramebuffer *self);
 guint retro_framebuffer_get_width (RetroFramebuffer *self);
@@ -2,19 +2,45 @@
 
 #include "retro-framebuffer-private.h"
 
-#include <semaphore.h>
 #include <errno.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+/*
+ * The framebuffer is a lock-free triple buffer living in shared memory. The
+ * runner always owns one slot it writes to, the UI always owns one slot it
+ * reads from, and the remaining slot is the latest published frame. Both sides
+ * trade their slot for the published one with an atomic exchange of the
+ * latest field, so neither process ever waits for the other and the UI always
+ * gets the newest complete frame.
+ *
+ * Slots own a region of the shared memory described by their offset and
+ * capacity. When the runner needs a bigger slot it appends a new region at the
+ * end of the shared memory rather than moving existing ones, so a slot the UI
+ * is reading is never touched.
+ */
+
+#define SLOT_INDEX_MASK 0x3
+#define SLOT_FRESH 0x4
+
 typedef struct {
-  sem_t semaphore;
-  gboolean is_dirty;
+  guint64 sequence;
+  gint64 timestamp;
+  gint64 run_duration;
+  guint64 n_duplicated;
+  gsize offset;
+  gsize capacity;
   RetroPixelFormat format;
   gsize rowstride;
   guint width;
   guint height;
   gfloat aspect_ratio;
+} RetroFramebufferSlot;
+
+typedef struct {
+  volatile gint latest;
+  gsize size;
+  RetroFramebufferSlot slots[RETRO_FRAMEBUFFER_N_SLOTS];
 } RetroFramebufferMetadata;
 
 struct _RetroFramebuffer
@@ -25,7 +51,17 @@ struct _RetroFramebuffer
   gsize size;
   gpointer shared_data;
   RetroFramebufferMetadata *metadata;
-  gpointer framebuffer;
+  gint slot;
+  guint64 sequence;
+  gsize region_offset;
+  gsize region_capacity;
+  gint64 run_start_time;
+  gboolean has_published;
+  guint64 n_duplicated;
+  guint64 n_dropped;
+  gboolean detect_duplicates;
+  gboolean has_last_hash;
+  guint64 last_hash;
 };
 
 G_DEFINE_TYPE (RetroFramebuffer, retro_framebuffer, G_TYPE_OBJECT)
@@ -38,30 +74,58 @@ enum {
 
 static GParamSpec *properties [N_PROPS];
 
-static void
-resize (RetroFramebuffer *self,
-        gsize             size)
+static gint
+exchange_slot (volatile gint *atomic,
+               gint           value)
 {
-  size += sizeof (RetroFramebufferMetadata);
+  gint old_value;
+
+  do
+    old_value = g_atomic_int_get (atomic);
+  while (!g_atomic_int_compare_and_exchange (atomic, old_value, value));
 
+  return old_value;
+}
+
+static void
+remap (RetroFramebuffer *self,
+       gsize             size)
+{
   if (G_LIKELY (size == self->size))
     return;
 
   if (self->shared_data) {
     munmap (self->shared_data, self->size);
     self->shared_data = NULL;
+    self->metadata = NULL;
   }
 
-  self->size = size;
+  self->shared_data = mmap (NULL, size,
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            self->fd, 0);
 
-  if (ftruncate (self->fd, size) != 0)
-    g_critical ("Couldn't truncate framebuffer: %s", g_strerror (errno));
+  if (self->shared_data == MAP_FAILED) {
+    g_critical ("Couldn't map framebuffer: %s", g_strerror (errno));
+    self->shared_data = NULL;
+    self->size = 0;
 
-  self->shared_data = mmap (NULL, size,
-                            PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    return;
+  }
 
+  self->size = size;
   self->metadata = (RetroFramebufferMetadata *) self->shared_data;
-  self->framebuffer = (self->shared_data + sizeof (RetroFramebufferMetadata));
+}
+
+static inline RetroFramebufferSlot *
+get_slot (RetroFramebuffer *self)
+{
+  return &self->metadata->slots[self->slot];
+}
+
+static inline gpointer
+get_slot_pixels (RetroFramebuffer *self)
+{
+  return self->shared_data + get_slot (self)->offset;
 }
 
 static void
@@ -71,11 +135,29 @@ retro_framebuffer_constructed (GObject *object)
 
   G_OBJECT_CLASS (retro_framebuffer_parent_class)->constructed (object);
 
-  resize (self, 0);
-
 #ifdef RETRO_RUNNER_COMPILATION
-  if (sem_init (&self->metadata->semaphore, 1, 1) != 0)
-    g_critical ("Couldn't init semaphore: %s", g_strerror (errno));
+  if (ftruncate (self->fd, sizeof (RetroFramebufferMetadata)) != 0)
+    g_critical ("Couldn't truncate framebuffer: %s", g_strerror (errno));
+
+  remap (self, sizeof (RetroFramebufferMetadata));
+
+  if (self->metadata == NULL)
+    return;
+
+  for (gint i = 0; i < RETRO_FRAMEBUFFER_N_SLOTS; i++) {
+    self->metadata->slots[i].offset = sizeof (RetroFramebufferMetadata);
+    self->metadata->slots[i].capacity = 0;
+  }
+
+  /* The runner starts with the first slot, the second one is published but
+   * not fresh, and the UI starts with the last one. */
+  self->metadata->size = sizeof (RetroFramebufferMetadata);
+  self->slot = 0;
+  g_atomic_int_set (&self->metadata->latest, 1);
+#else
+  remap (self, sizeof (RetroFramebufferMetadata));
+
+  self->slot = RETRO_FRAMEBUFFER_N_SLOTS - 1;
 #endif
 }
 
@@ -84,11 +166,6 @@ retro_framebuffer_finalize (GObject *object)
 {
   RetroFramebuffer *self = (RetroFramebuffer *)object;
 
-#ifdef RETRO_RUNNER_COMPILATION
-  if (sem_destroy (&self->metadata->semaphore) != 0)
-    g_critical ("Couldn't destroy semaphore: %s", g_strerror (errno));
-#endif
-
   if (self->shared_data) {
     munmap (self->shared_data, self->size);
     self->shared_data = NULL;
@@ -184,70 +261,426 @@ retro_framebuffer_get_fd (RetroFramebuffer *self)
   return self->fd;
 }
 
+#ifdef RETRO_RUNNER_COMPILATION
+
+#define HASH_PRIME 0x100000001b3ull
+
+static inline guint64
+hash_word (guint64 hash,
+           guint64 word)
+{
+  /* Each step is a bijection of the hash, so a frame differing from the
+   * previous one by a single word always gets a different hash. */
+  hash = (hash ^ word) * HASH_PRIME;
+
+  return hash ^ (hash >> 32);
+}
+
+/* Hashes the geometry and the visible pixels of a frame, ignoring padding. */
+static guint64
+hash_frame (RetroPixelFormat format,
+            gsize            rowstride,
+            guint            width,
+            guint            height,
+            gfloat           aspect_ratio,
+            gconstpointer    data)
+{
+  guint64 hash = 0xcbf29ce484222325ull;
+  guint32 aspect_ratio_bits;
+  gint pixel_size;
+  gsize row_size;
+
+  if (!retro_pixel_format_to_gl (format, NULL, NULL, &pixel_size))
+    pixel_size = rowstride / MAX (width, 1);
+
+  row_size = MIN (width * pixel_size, rowstride);
+
+  memcpy (&aspect_ratio_bits, &aspect_ratio, sizeof (aspect_ratio_bits));
+  hash = hash_word (hash, format);
+  hash = hash_word (hash, rowstride);
+  hash = hash_word (hash, ((guint64) width << 32) | height);
+  hash = hash_word (hash, aspect_ratio_bits);
+
+  for (guint row = 0; row < height; row++) {
+    const guint8 *line = (const guint8 *) data + row * rowstride;
+    gsize i = 0;
+
+    for (; i + sizeof (guint64) <= row_size; i += sizeof (guint64)) {
+      guint64 word;
+
+      memcpy (&word, line + i, sizeof (word));
+      hash = hash_word (hash, word);
+    }
+
+    for (; i < row_size; i++)
+      hash = hash_word (hash, line[i]);
+  }
+
+  return hash;
+}
+
+static gsize
+append_region (RetroFramebuffer *self,
+               gsize             size)
+{
+  gsize page_size, offset;
+
+  page_size = sysconf (_SC_PAGESIZE);
+  offset = (self->metadata->size + page_size - 1) / page_size * page_size;
+
+  if (ftruncate (self->fd, offset + size) != 0) {
+    g_critical ("Couldn't truncate framebuffer: %s", g_strerror (errno));
+
+    return 0;
+  }
+
+  remap (self, offset + size);
+
+  if (self->metadata == NULL)
+    return 0;
+
+  self->metadata->size = offset + size;
+
+  return offset;
+}
+
+static void
+reserve_slot (RetroFramebuffer *self,
+              gsize             capacity)
+{
+  RetroFramebufferSlot *slot = get_slot (self);
+  gsize offset;
+
+  if (G_LIKELY (capacity <= slot->capacity))
+    return;
+
+  /* Move the slot into its part of the preallocated region if it fits. */
+  if (capacity <= self->region_capacity) {
+    slot->offset = self->region_offset + self->slot * self->region_capacity;
+    slot->capacity = self->region_capacity;
+
+    return;
+  }
+
+  /* Append a new region instead of growing the current one, the other slots
+   * may be in use by the UI. */
+  offset = append_region (self, capacity);
+  if (offset == 0)
+    return;
+
+  slot = get_slot (self);
+  slot->offset = offset;
+  slot->capacity = capacity;
+}
+
+/**
+ * retro_framebuffer_reserve:
+ * @self: a #RetroFramebuffer
+ * @capacity: the size in bytes of the biggest expected frame
+ *
+ * Preallocates the shared memory for frames up to @capacity bytes for every
+ * slot at once, so that later geometry changes don't need to resize or remap
+ * the shared memory.
+ */
 void
-retro_framebuffer_lock (RetroFramebuffer *self)
+retro_framebuffer_reserve (RetroFramebuffer *self,
+                           gsize             capacity)
 {
+  gsize offset;
+
   g_return_if_fail (RETRO_IS_FRAMEBUFFER (self));
 
-  if (sem_wait (&self->metadata->semaphore) != 0)
-    g_critical ("Couldn't lock: %s", g_strerror (errno));
+  if (self->metadata == NULL || capacity <= self->region_capacity)
+    return;
+
+  offset = append_region (self, capacity * RETRO_FRAMEBUFFER_N_SLOTS);
+  if (offset == 0)
+    return;
+
+  self->region_offset = offset;
+  self->region_capacity = capacity;
+
+  /* Only the slot owned by the runner can be moved right away, the other ones
+   * will be as they come back to it. */
+  reserve_slot (self, capacity);
 }
 
+/**
+ * retro_framebuffer_fits:
+ * @self: a #RetroFramebuffer
+ * @size: the size in bytes of a frame
+ *
+ * Gets whether a frame of @size bytes can be prepared without growing the
+ * shared memory, which would remap it and invalidate the pointers previously
+ * returned by retro_framebuffer_prepare().
+ *
+ * Returns: whether a frame of @size bytes fits
+ */
+gboolean
+retro_framebuffer_fits (RetroFramebuffer *self,
+                        gsize             size)
+{
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), FALSE);
+
+  if (self->metadata == NULL)
+    return FALSE;
+
+  return size <= get_slot (self)->capacity || size <= self->region_capacity;
+}
+
+/**
+ * retro_framebuffer_start_run:
+ * @self: a #RetroFramebuffer
+ *
+ * Notifies @self that the core is about to run for a frame. This is used to
+ * measure how long it takes the core to produce a frame, and to count the
+ * frames for which the core didn't produce any new video.
+ */
 void
-retro_framebuffer_unlock (RetroFramebuffer *self)
+retro_framebuffer_start_run (RetroFramebuffer *self)
 {
   g_return_if_fail (RETRO_IS_FRAMEBUFFER (self));
 
-  if (sem_post (&self->metadata->semaphore) != 0)
-    g_critical ("Couldn't unlock: %s", g_strerror (errno));
+  if (self->sequence > 0 && !self->has_published)
+    self->n_duplicated++;
+
+  self->run_start_time = g_get_monotonic_time ();
+  self->has_published = FALSE;
 }
 
-#ifdef RETRO_RUNNER_COMPILATION
+/**
+ * retro_framebuffer_prepare:
+ * @self: a #RetroFramebuffer
+ * @format: the pixel format
+ * @rowstride: the distance in bytes between rows
+ * @width: the width
+ * @height: the height
+ * @aspect_ratio: the aspect ratio to render the video
+ *
+ * Prepares the slot owned by the runner to receive a frame. The frame will be
+ * visible to the UI only once retro_framebuffer_publish() is called.
+ *
+ * Returns: (transfer none) (nullable): the pixels of the frame to write to
+ */
+gpointer
+retro_framebuffer_prepare (RetroFramebuffer *self,
+                           RetroPixelFormat  format,
+                           gsize             rowstride,
+                           guint             width,
+                           guint             height,
+                           gfloat            aspect_ratio)
+{
+  RetroFramebufferSlot *slot;
+
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), NULL);
+
+  reserve_slot (self, height * rowstride);
+
+  if (self->metadata == NULL)
+    return NULL;
+
+  slot = get_slot (self);
+  slot->format = format;
+  slot->rowstride = rowstride;
+  slot->width = width;
+  slot->height = height;
+  slot->aspect_ratio = aspect_ratio;
 
+  return get_slot_pixels (self);
+}
+
+/**
+ * retro_framebuffer_publish:
+ * @self: a #RetroFramebuffer
+ *
+ * Publishes the frame written in the slot owned by the runner, replacing any
+ * frame the UI didn't pick up yet, and takes ownership of the slot the
+ * previous frame was in.
+ */
 void
+retro_framebuffer_publish (RetroFramebuffer *self)
+{
+  RetroFramebufferSlot *slot;
+  gint latest;
+
+  g_return_if_fail (RETRO_IS_FRAMEBUFFER (self));
+
+  if (self->metadata == NULL)
+    return;
+
+  slot = get_slot (self);
+  slot->sequence = ++self->sequence;
+  slot->timestamp = g_get_monotonic_time ();
+  slot->run_duration = self->run_start_time ? slot->timestamp - self->run_start_time : 0;
+  slot->n_duplicated = self->n_duplicated;
+
+  self->has_published = TRUE;
+  self->has_last_hash = FALSE;
+
+  latest = exchange_slot (&self->metadata->latest, self->slot | SLOT_FRESH);
+  self->slot = latest & SLOT_INDEX_MASK;
+}
+
+/**
+ * retro_framebuffer_set_data:
+ * @self: a #RetroFramebuffer
+ * @format: the pixel format
+ * @rowstride: the distance in bytes between rows
+ * @width: the width
+ * @height: the height
+ * @aspect_ratio: the aspect ratio to render the video
+ * @data: the pixels of the frame
+ *
+ * Copies a frame into the slot owned by the runner and publishes it. If
+ * duplicate detection is enabled and the frame is identical to the previous
+ * one, it is treated as a duped frame and nothing is published.
+ *
+ * Returns: whether a new frame was published
+ */
+gboolean
 retro_framebuffer_set_data (RetroFramebuffer *self,
                             RetroPixelFormat  format,
                             gsize             rowstride,
                             guint             width,
                             guint             height,
                             gfloat            aspect_ratio,
-                            gpointer          data)
+                            gconstpointer     data)
 {
-  gsize size;
+  gpointer pixels;
+  guint64 hash = 0;
 
-  g_return_if_fail (RETRO_IS_FRAMEBUFFER (self));
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), FALSE);
+  g_return_val_if_fail (data != NULL, FALSE);
 
-  size = height * rowstride;
+  if (self->detect_duplicates) {
+    hash = hash_frame (format, rowstride, width, height, aspect_ratio, data);
 
-  resize (self, size);
+    if (self->has_last_hash && hash == self->last_hash)
+      return FALSE;
+  }
+
+  pixels = retro_framebuffer_prepare (self, format, rowstride,
+                                      width, height, aspect_ratio);
+
+  if (pixels == NULL)
+    return FALSE;
+
+  /* The core may have rendered in place via the software framebuffer. */
+  if (data != pixels)
+    memcpy (pixels, data, height * rowstride);
+
+  retro_framebuffer_publish (self);
 
-  self->metadata->is_dirty = TRUE;
-  self->metadata->format = format;
-  self->metadata->rowstride = rowstride;
-  self->metadata->width = width;
-  self->metadata->height = height;
-  self->metadata->aspect_ratio = aspect_ratio;
+  self->has_last_hash = self->detect_duplicates;
+  self->last_hash = hash;
 
-  if (size && data)
-    memcpy (self->framebuffer, data, size);
+  return TRUE;
 }
 
-gpointer
-retro_framebuffer_get_pixels (RetroFramebuffer *self)
+gboolean
+retro_framebuffer_get_detect_duplicates (RetroFramebuffer *self)
 {
-  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), NULL);
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), FALSE);
 
-  return self->framebuffer;
+  return self->detect_duplicates;
+}
+
+void
+retro_framebuffer_set_detect_duplicates (RetroFramebuffer *self,
+                                         gboolean          detect_duplicates)
+{
+  g_return_if_fail (RETRO_IS_FRAMEBUFFER (self));
+
+  self->detect_duplicates = !!detect_duplicates;
+  self->has_last_hash = FALSE;
 }
 
 #else
 
+/**
+ * retro_framebuffer_acquire:
+ * @self: a #RetroFramebuffer
+ *
+ * Takes ownership of the latest frame published by the runner, if any. The
+ * frame stays valid until the next successful call, so it can be read without
+ * blocking the runner.
+ *
+ * Returns: whether a new frame was acquired
+ */
 gboolean
-retro_framebuffer_get_is_dirty (RetroFramebuffer *self)
+retro_framebuffer_acquire (RetroFramebuffer *self)
 {
+  RetroFramebufferSlot *slot;
+  gint latest;
+
   g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), FALSE);
 
-  return self->metadata->is_dirty;
+  if (self->metadata == NULL)
+    return FALSE;
+
+  if (!(g_atomic_int_get (&self->metadata->latest) & SLOT_FRESH))
+    return FALSE;
+
+  latest = exchange_slot (&self->metadata->latest, self->slot);
+  self->slot = latest & SLOT_INDEX_MASK;
+
+  /* The runner may have grown the shared memory for this slot. */
+  slot = get_slot (self);
+  if (slot->offset + slot->height * slot->rowstride > self->size)
+    remap (self, self->metadata->size);
+
+  if (self->metadata == NULL)
+    return FALSE;
+
+  slot = get_slot (self);
+  if (slot->sequence <= self->sequence)
+    return FALSE;
+
+  /* Frames published while the UI wasn't looking were never shown. */
+  self->n_dropped += slot->sequence - self->sequence - 1;
+  self->sequence = slot->sequence;
+
+  return slot->width != 0 && slot->height != 0;
+}
+
+guint64
+retro_framebuffer_get_sequence (RetroFramebuffer *self)
+{
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0);
+
+  return self->sequence;
+}
+
+gint64
+retro_framebuffer_get_timestamp (RetroFramebuffer *self)
+{
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0);
+
+  return get_slot (self)->timestamp;
+}
+
+gint64
+retro_framebuffer_get_run_duration (RetroFramebuffer *self)
+{
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0);
+
+  return get_slot (self)->run_duration;
+}
+
+guint64
+retro_framebuffer_get_n_duplicated (RetroFramebuffer *self)
+{
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0);
+
+  return get_slot (self)->n_duplicated;
+}
+
+guint64
+retro_framebuffer_get_n_dropped (RetroFramebuffer *self)
+{
+  g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0);
+
+  return self->n_dropped;
 }
 
 RetroPixelFormat
@@ -255,7 +688,7 @@ retro_framebuffer_get_format (RetroFramebuffer *self)
 {
   g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0);
 
-  return self->metadata->format;
+  return get_slot (self)->format;
 }
 
 gsize
@@ -263,7 +696,7 @@ retro_framebuffer_get_rowstride (RetroFramebuffer *self)
 {
   g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0);
 
-  return self->metadata->rowstride;
+  return get_slot (self)->rowstride;
 }
 
 guint
@@ -271,7 +704,7 @@ retro_framebuffer_get_width (RetroFramebuffer *self)
 {
   g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0);
 
-  return self->metadata->width;
+  return get_slot (self)->width;
 }
 
 guint
@@ -279,7 +712,7 @@ retro_framebuffer_get_height (RetroFramebuffer *self)
 {
   g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0);
 
-  return self->metadata->height;
+  return get_slot (self)->height;
 }
 
 gdouble
@@ -287,22 +720,15 @@ retro_framebuffer_get_aspect_ratio (RetroFramebuffer *self)
 {
   g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), 0.0);
 
-  return self->metadata->aspect_ratio;
+  return get_slot (self)->aspect_ratio;
 }
 
 gconstpointer
 retro_framebuffer_get_pixels (RetroFramebuffer *self)
 {
-  gsize size;
-
   g_return_val_if_fail (RETRO_IS_FRAMEBUFFER (self), NULL);
 
-  size = self->metadata->height * self->metadata->rowstride;
-  resize (self, size);
-
-  self->metadata->is_dirty = FALSE;
-
-  return self->framebuffer;
+  return get_slot_pixels (self);
 }
 
 #endif
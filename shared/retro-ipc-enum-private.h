@@ -0,0 +1,22 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#pragma once
+
+#if !defined(__RETRO_GTK_INSIDE__) && !defined(RETRO_GTK_COMPILATION)
+# error "Only <retro-gtk.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+gboolean retro_ipc_enum_to_uint (GBinding     *binding,
+                                 const GValue *from_value,
+                                 GValue       *to_value,
+                                 gpointer      user_data);
+gboolean retro_ipc_uint_to_enum (GBinding     *binding,
+                                 const GValue *from_value,
+                                 GValue       *to_value,
+                                 gpointer      user_data);
+
+G_END_DECLS
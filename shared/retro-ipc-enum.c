@@ -0,0 +1,29 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#include "retro-ipc-enum-private.h"
+
+/* D-Bus has no enumerations, they are sent as unsigned integers. These are
+ * transform functions for binding enumeration properties to their D-Bus
+ * counterparts. */
+
+gboolean
+retro_ipc_enum_to_uint (GBinding     *binding,
+                        const GValue *from_value,
+                        GValue       *to_value,
+                        gpointer      user_data)
+{
+  g_value_set_uint (to_value, g_value_get_enum (from_value));
+
+  return TRUE;
+}
+
+gboolean
+retro_ipc_uint_to_enum (GBinding     *binding,
+                        const GValue *from_value,
+                        GValue       *to_value,
+                        gpointer      user_data)
+{
+  g_value_set_enum (to_value, g_value_get_uint (from_value));
+
+  return TRUE;
+}
@@ -0,0 +1,40 @@
+// This file is part of retro-gtk. License: GPL-3.0+.
+
+#pragma once
+
+#if !defined(__RETRO_GTK_INSIDE__) && !defined(RETRO_GTK_COMPILATION)
+# error "Only <retro-gtk.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define RETRO_TYPE_RESAMPLER_QUALITY (retro_resampler_quality_get_type ())
+
+GType retro_resampler_quality_get_type (void) G_GNUC_CONST;
+
+/**
+ * RetroResamplerQuality:
+ * @RETRO_RESAMPLER_QUALITY_BEST: the best band limited resampler
+ * @RETRO_RESAMPLER_QUALITY_MEDIUM: a band limited resampler, faster than the
+ * best one
+ * @RETRO_RESAMPLER_QUALITY_FASTEST: the fastest band limited resampler
+ * @RETRO_RESAMPLER_QUALITY_LINEAR: a very fast linear resampler, with a poor
+ * quality
+ * @RETRO_RESAMPLER_QUALITY_ZERO_ORDER_HOLD: a blazing fast resampler
+ * repeating samples, with a very poor quality
+ *
+ * Represents the quality of the resampler used to play the audio at the speed
+ * rate of the core, from the most to the least CPU intensive.
+ */
+typedef enum
+{
+  RETRO_RESAMPLER_QUALITY_BEST,
+  RETRO_RESAMPLER_QUALITY_MEDIUM,
+  RETRO_RESAMPLER_QUALITY_FASTEST,
+  RETRO_RESAMPLER_QUALITY_LINEAR,
+  RETRO_RESAMPLER_QUALITY_ZERO_ORDER_HOLD,
+} RetroResamplerQuality;
+
+G_END_DECLS
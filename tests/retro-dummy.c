@@ -130,7 +130,18 @@ retro_reset (void)
 void
 retro_run (void)
 {
+  uint16_t buttons = 0;
+
   input_poll_cb ();
+
+  /* Show the pressed buttons in the first pixel, so tests can check which
+   * input the core saw. */
+  for (unsigned id = 0; id <= RETRO_DEVICE_ID_JOYPAD_R3; id++)
+    if (input_state_cb (0, RETRO_DEVICE_JOYPAD, 0, id))
+      buttons |= 1 << id;
+
+  frame_buffer[0] = 0xffff & ~buttons;
+
   video_cb (frame_buffer, WIDTH, HEIGHT, WIDTH * sizeof (uint16_t));
 }
 
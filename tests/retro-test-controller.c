@@ -56,10 +56,17 @@ retro_test_controller_get_input_state (RetroController *base,
   }
   case RETRO_CONTROLLER_TYPE_MOUSE: {
     RetroMouseId id;
+    gint16 value;
     if (!retro_input_get_mouse (input, &id))
       return 0;
 
-    return self->state[RETRO_CONTROLLER_TYPE_MOUSE][id];
+    value = self->state[RETRO_CONTROLLER_TYPE_MOUSE][id];
+
+    /* The motion is relative, it must be reported only once. */
+    if (id == RETRO_MOUSE_ID_X || id == RETRO_MOUSE_ID_Y)
+      self->state[RETRO_CONTROLLER_TYPE_MOUSE][id] = 0;
+
+    return value;
   }
   case RETRO_CONTROLLER_TYPE_LIGHTGUN: {
     RetroLightgunId id;
@@ -20,7 +20,9 @@
 
 #pragma once
 
+#ifndef RETRO_GTK_USE_UNSTABLE_API
 #define RETRO_GTK_USE_UNSTABLE_API
+#endif
 #include <retro-gtk/retro-gtk.h>
 
 G_BEGIN_DECLS
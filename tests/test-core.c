@@ -18,6 +18,14 @@
 
 #include <retro-gtk.h>
 #include <glib/gstdio.h>
+#include "retro-test-controller.h"
+
+#define MOVIE_N_FRAMES 32
+
+typedef struct {
+  guint32 pixels[MOVIE_N_FRAMES];
+  guint n_frames;
+} MovieOutput;
 
 static gchar *arg_core_filename = NULL;
 static gchar *tmp_filename = NULL;
@@ -309,6 +317,87 @@ test_has_option (RetroCore     **core_pointer,
   g_assert_false (retro_core_has_option (core, "non-existent-option"));
 }
 
+static void
+video_output_cb (RetroCore    *core,
+                 RetroPixdata *pixdata,
+                 MovieOutput  *output)
+{
+  g_autoptr (GdkPixbuf) pixbuf = NULL;
+  const guint8 *pixels;
+
+  g_assert_cmpuint (output->n_frames, <, MOVIE_N_FRAMES);
+
+  /* The dummy core shows the buttons it saw in its first pixel. */
+  pixbuf = retro_pixdata_to_pixbuf (pixdata);
+  pixels = gdk_pixbuf_read_pixels (pixbuf);
+
+  output->pixels[output->n_frames++] = pixels[0] << 16 | pixels[1] << 8 | pixels[2];
+}
+
+static void
+test_movie (RetroCore     **core_pointer,
+            gconstpointer   data)
+{
+  RetroCore *core = *core_pointer;
+  g_autoptr (RetroTestController) controller = NULL;
+  g_autofree gchar *contents = NULL;
+  MovieOutput recorded = { { 0 }, 0 };
+  MovieOutput played = { { 0 }, 0 };
+  gulong handler_id;
+  gsize length;
+  GError *error = NULL;
+
+  retro_core_boot (core, &error);
+  g_assert_no_error (error);
+
+  controller = retro_test_controller_new (RETRO_CONTROLLER_TYPE_JOYPAD);
+  retro_core_set_controller (core, 0, RETRO_CONTROLLER (controller));
+
+  retro_core_record_movie (core, tmp_filename, FALSE, &error);
+  g_assert_no_error (error);
+
+  handler_id = g_signal_connect (core, "video-output", G_CALLBACK (video_output_cb), &recorded);
+  for (guint i = 0; i < MOVIE_N_FRAMES; i++) {
+    /* Press and release the buttons in turn, so most frames differ. */
+    RetroControllerState state = {
+      RETRO_CONTROLLER_TYPE_JOYPAD,
+      i % (RETRO_JOYPAD_ID_R3 + 1),
+      0,
+      i < RETRO_JOYPAD_ID_R3 + 1 ? 1 : 0,
+    };
+
+    retro_test_controller_set_input_state (controller, &state);
+    retro_core_iteration (core);
+  }
+  g_signal_handler_disconnect (core, handler_id);
+
+  g_assert_cmpuint (recorded.n_frames, ==, MOVIE_N_FRAMES);
+  g_assert_cmpuint (recorded.pixels[0], !=, recorded.pixels[MOVIE_N_FRAMES / 2]);
+
+  retro_core_stop_movie (core);
+
+  g_file_get_contents (tmp_filename, &contents, &length, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (length, >=, 8);
+  g_assert_cmpmem (contents, 8, "RETROMOV", 8);
+
+  /* The movie alone must drive the core now. */
+  retro_test_controller_reset (controller);
+  retro_core_set_controller (core, 0, NULL);
+
+  retro_core_play_movie (core, tmp_filename, &error);
+  g_assert_no_error (error);
+
+  handler_id = g_signal_connect (core, "video-output", G_CALLBACK (video_output_cb), &played);
+  for (guint i = 0; i < MOVIE_N_FRAMES; i++)
+    retro_core_iteration (core);
+  g_signal_handler_disconnect (core, handler_id);
+
+  g_assert_cmpuint (played.n_frames, ==, MOVIE_N_FRAMES);
+  g_assert_cmpmem (played.pixels, sizeof (played.pixels),
+                   recorded.pixels, sizeof (recorded.pixels));
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -341,6 +430,7 @@ main (int   argc,
   g_test_add ("/RetroCore/save_memory", RetroCore *, arg_core_filename, tmp_file_test_setup, test_save_memory, tmp_file_test_teardown);
   g_test_add ("/RetroCore/load_memory", RetroCore *, arg_core_filename, tmp_file_test_setup, test_load_memory, tmp_file_test_teardown);
   g_test_add ("/RetroCore/has_option", RetroCore *, arg_core_filename, test_setup, test_has_option, test_teardown);
+  g_test_add ("/RetroCore/movie", RetroCore *, arg_core_filename, tmp_file_test_setup, test_movie, tmp_file_test_teardown);
 
   return g_test_run();
 }
@@ -0,0 +1,76 @@
+/* test-pixdata.c
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <retro-gtk.h>
+#include <string.h>
+#include "retro-pixdata-private.h"
+
+/* Covers the remainders of the widest vectors on both sides of a few full
+ * iterations. */
+#define MAX_WIDTH 69
+
+static void
+test_convert_row (gconstpointer data)
+{
+  RetroPixdataSimd simd = GPOINTER_TO_INT (data);
+  RetroPixelFormat pixel_formats[] = {
+    RETRO_PIXEL_FORMAT_XRGB1555,
+    RETRO_PIXEL_FORMAT_XRGB8888,
+    RETRO_PIXEL_FORMAT_RGB565,
+  };
+  guint8 src[MAX_WIDTH * 4];
+  guint8 expected[MAX_WIDTH * 4];
+  guint8 actual[MAX_WIDTH * 4];
+
+  for (gsize i = 0; i < sizeof (src); i++)
+    src[i] = g_test_rand_int_range (0, 256);
+
+  for (gsize f = 0; f < G_N_ELEMENTS (pixel_formats); f++) {
+    for (gsize width = 1; width <= MAX_WIDTH; width++) {
+      memset (expected, 0, sizeof (expected));
+      memset (actual, 0, sizeof (actual));
+
+      g_assert_true (retro_pixdata_convert_row (RETRO_PIXDATA_SIMD_NONE,
+                                                pixel_formats[f], src,
+                                                expected, width));
+
+      if (!retro_pixdata_convert_row (simd, pixel_formats[f], src, actual, width)) {
+        g_test_skip ("The converters aren't supported on this CPU.");
+
+        return;
+      }
+
+      /* The bytes past the row must be left untouched too. */
+      g_assert_cmpmem (actual, sizeof (actual), expected, sizeof (expected));
+    }
+  }
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_data_func ("/RetroPixdata/convert_row/sse2",
+                        GINT_TO_POINTER (RETRO_PIXDATA_SIMD_SSE2),
+                        test_convert_row);
+  g_test_add_data_func ("/RetroPixdata/convert_row/avx2",
+                        GINT_TO_POINTER (RETRO_PIXDATA_SIMD_AVX2),
+                        test_convert_row);
+
+  return g_test_run();
+}